@@ -96,6 +96,8 @@ function buildmseplayer()
 	if [ $? -eq 0 ] ; then
     mkdir -p $cur_dir/$release_dir/mse-player/
 		cp mse_player $cur_dir/$release_dir/mse-player/
+		cp mse_frames_convert $cur_dir/$release_dir/mse-player/
+		cp mse_frames_generate $cur_dir/$release_dir/mse-player/
 		cp -r mse_frames $cur_dir/$release_dir/mse-player/
 		result=0
 		echo "Exiting mse-player........"
@@ -0,0 +1,61 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "aacparser.h"
+
+#include <cstdio>
+
+namespace {
+
+// sampling_frequency_index (ISO/IEC 14496-3 table 1.18)
+const uint32_t kAacSampleRates[] = {96000, 88200, 64000, 48000, 44100,
+                                    32000, 24000, 22050, 16000, 12000,
+                                    11025, 8000,  7350};
+const size_t kAdtsHeaderSize = 7;
+
+}  // namespace
+
+std::string AacCapsFromAdtsFrame(const uint8_t* data, uint32_t size) {
+  if (size < kAdtsHeaderSize || data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+    return std::string();
+
+  // profile is the audio object type minus one
+  uint32_t object_type = ((data[2] >> 6) & 3) + 1;
+  uint32_t rate_index = (data[2] >> 2) & 0xf;
+  uint32_t channels = ((data[2] & 1) << 2) | (data[3] >> 6);
+  if (rate_index >= sizeof(kAacSampleRates) / sizeof(kAacSampleRates[0]))
+    return std::string();
+  // channel configuration 7 is 7.1, 0 means it is in the stream (PCE)
+  if (channels == 7)
+    channels = 8;
+
+  char caps[256];
+  snprintf(caps, sizeof(caps),
+           "audio/mpeg, mpegversion=(int)%d, framed=(boolean)true, "
+           "stream-format=(string)adts%s, rate=(int)%u",
+           (data[1] & 0x08) ? 2 : 4,
+           object_type == 2 ? ", profile=(string)lc" : "",
+           kAacSampleRates[rate_index]);
+  std::string result = caps;
+  if (channels > 0) {
+    snprintf(caps, sizeof(caps), ", channels=(int)%u", channels);
+    result += caps;
+  }
+  return result;
+}
@@ -0,0 +1,33 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AACPARSER_H_
+#define AACPARSER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+// Returns "audio/mpeg, stream-format=adts" caps with the object type, rate
+// and channel count of an ADTS framed AAC frame, or an empty string if the
+// frame has no ADTS header. Raw AAC frames carry no configuration at all,
+// their AudioSpecificConfig has to come from a caps sidecar.
+std::string AacCapsFromAdtsFrame(const uint8_t* data, uint32_t size);
+
+#endif  // AACPARSER_H_
@@ -0,0 +1,246 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "abrcontroller.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "framefile.h"
+
+namespace {
+
+// reads are pooled until they add up to this before they make a sample
+const uint64_t kMinSampleBytes = 16 * 1024;
+// payload seen before the estimate is trusted
+const uint64_t kMinTotalBytes = 128 * 1024;
+const double kFastHalfLifeUs = 2000000.0;
+const double kSlowHalfLifeUs = 5000000.0;
+
+bool LowerBitrate(const Rendition& a, const Rendition& b) {
+  return a.bitrate_kbps_ < b.bitrate_kbps_;
+}
+
+bool ParseKbps(const char* name, uint32_t* kbps) {
+  char* end = NULL;
+  unsigned long value = strtoul(name, &end, 10);
+  if (end == name || *end != '\0' || value == 0)
+    return false;
+  *kbps = static_cast<uint32_t>(value);
+  return true;
+}
+
+}  // namespace
+
+std::vector<Rendition> FindRenditions(const std::string& dir) {
+  std::vector<Rendition> renditions;
+  DIR* handle = opendir(dir.c_str());
+  if (handle == NULL)
+    return renditions;
+
+  struct dirent* entry;
+  while ((entry = readdir(handle)) != NULL) {
+    Rendition rendition;
+    if (!ParseKbps(entry->d_name, &rendition.bitrate_kbps_))
+      continue;
+
+    // only count directories holding at least a first segment
+    rendition.dir_ = dir + "/" + entry->d_name;
+    std::string video = SegmentPath(rendition.dir_, kVideo, 0);
+    if (access((video + kFrameFileExtension).c_str(), R_OK) == 0 ||
+        access((video + ".txt").c_str(), R_OK) == 0)
+      renditions.push_back(rendition);
+  }
+  closedir(handle);
+
+  std::sort(renditions.begin(), renditions.end(), LowerBitrate);
+  return renditions;
+}
+
+BandwidthEstimator::BandwidthEstimator() {
+  g_mutex_init(&mutex_);
+  Reset();
+}
+
+BandwidthEstimator::~BandwidthEstimator() { g_mutex_clear(&mutex_); }
+
+void BandwidthEstimator::Reset() {
+  g_mutex_lock(&mutex_);
+  pending_bytes_ = 0;
+  pending_us_ = 0;
+  total_bytes_ = 0;
+  fast_.half_life_us_ = kFastHalfLifeUs;
+  slow_.half_life_us_ = kSlowHalfLifeUs;
+  fast_.estimate_ = slow_.estimate_ = 0;
+  fast_.total_weight_ = slow_.total_weight_ = 0;
+  g_mutex_unlock(&mutex_);
+}
+
+void BandwidthEstimator::AddSample(uint64_t bytes, int64_t duration_us) {
+  g_mutex_lock(&mutex_);
+  pending_bytes_ += bytes;
+  pending_us_ += std::max<int64_t>(duration_us, 0);
+  if (pending_bytes_ >= kMinSampleBytes) {
+    // a read from the page cache can take less than the clock resolution
+    double weight = std::max<int64_t>(pending_us_, 1);
+    double bps = pending_bytes_ * 8 * 1000000.0 / weight;
+    Update(&fast_, weight, bps);
+    Update(&slow_, weight, bps);
+    total_bytes_ += pending_bytes_;
+    pending_bytes_ = 0;
+    pending_us_ = 0;
+  }
+  g_mutex_unlock(&mutex_);
+}
+
+void BandwidthEstimator::Update(Average* average, double weight, double bps) {
+  // samples are weighted by their duration, so a long transfer counts more
+  double alpha = pow(0.5, weight / average->half_life_us_);
+  average->estimate_ = alpha * average->estimate_ + (1 - alpha) * bps;
+  average->total_weight_ += weight;
+}
+
+double BandwidthEstimator::Estimate(const Average& average) const {
+  // the averages start at zero, scale that bias back out
+  double zero_factor = 1 - pow(0.5, average.total_weight_ / average.half_life_us_);
+  return zero_factor > 0 ? average.estimate_ / zero_factor : 0;
+}
+
+double BandwidthEstimator::estimate_bps() const {
+  g_mutex_lock(&mutex_);
+  double bps = total_bytes_ < kMinTotalBytes
+                   ? 0
+                   : std::min(Estimate(fast_), Estimate(slow_));
+  g_mutex_unlock(&mutex_);
+  return bps;
+}
+
+AbrController::AbrController()
+  : current_(0), switches_up_(0), switches_down_(0) {}
+
+void AbrController::Configure(const std::vector<Rendition>& renditions,
+                              const AbrOptions& options) {
+  renditions_ = renditions;
+  options_ = options;
+  estimator_.Reset();
+  switches_up_ = switches_down_ = 0;
+  // start low and let the estimate earn the way up
+  current_ = options_.fixed_kbps_ ? ClosestTo(options_.fixed_kbps_) : 0;
+
+  if (renditions_.empty())
+    return;
+  printf("ABR: %zu rendition(s):", renditions_.size());
+  for (size_t i = 0; i < renditions_.size(); i++)
+    printf(" %u", renditions_[i].bitrate_kbps_);
+  printf(" kbps, starting at %u kbps\n", renditions_[current_].bitrate_kbps_);
+}
+
+size_t AbrController::ClosestTo(uint32_t kbps) const {
+  size_t closest = 0;
+  for (size_t i = 1; i < renditions_.size(); i++) {
+    if (labs(static_cast<long>(renditions_[i].bitrate_kbps_) - kbps) <
+        labs(static_cast<long>(renditions_[closest].bitrate_kbps_) - kbps))
+      closest = i;
+  }
+  return closest;
+}
+
+size_t AbrController::Choose(int32_t counter, int64_t buffer_us) {
+  if (!enabled())
+    return current_;
+
+  double bps = estimator_.estimate_bps();
+  size_t target = current_;
+  const char* reason = "no estimate";
+  if (options_.fixed_kbps_) {
+    target = ClosestTo(options_.fixed_kbps_);
+    reason = "fixed";
+  } else if (bps > 0) {
+    // the highest rendition that fits the bandwidth we can count on
+    target = 0;
+    for (size_t i = 0; i < renditions_.size(); i++) {
+      if (renditions_[i].bitrate_kbps_ * 1000.0 <= bps * options_.safety_factor_)
+        target = i;
+    }
+    reason = "throughput";
+
+    // the buffer decides whether acting on the estimate is worth the risk
+    if (buffer_us >= 0) {
+      if (target > current_ && buffer_us < options_.low_buffer_ms_ * 1000LL) {
+        target = current_;
+        reason = "low buffer";
+      } else if (target < current_ &&
+                 buffer_us > options_.high_buffer_ms_ * 1000LL) {
+        target = current_;
+        reason = "high buffer";
+      }
+    }
+  }
+
+  printf("ABR,%" G_GINT64_FORMAT ",decision,%d,%.3f,%.0f,%u,%u,%s\n",
+         g_get_monotonic_time() / 1000,
+         counter,
+         buffer_us / 1000000.0,
+         bps / 1000,
+         renditions_[current_].bitrate_kbps_,
+         renditions_[target].bitrate_kbps_,
+         reason);
+
+  if (target != current_) {
+    if (target > current_)
+      switches_up_++;
+    else
+      switches_down_++;
+    printf("ABR: switching %s to %u kbps at segment %d\n",
+           target > current_ ? "up" : "down",
+           renditions_[target].bitrate_kbps_,
+           counter);
+    current_ = target;
+  }
+  return current_;
+}
+
+void AbrController::LogBuffer(double position_secs, int64_t buffer_us) {
+  if (!enabled())
+    return;
+
+  printf("ABR,%" G_GINT64_FORMAT ",buffer,%.3f,%.3f,%.0f,%u\n",
+         g_get_monotonic_time() / 1000,
+         position_secs,
+         buffer_us / 1000000.0,
+         estimator_.estimate_bps() / 1000,
+         renditions_[current_].bitrate_kbps_);
+}
+
+void AbrController::PrintStats() const {
+  if (!enabled())
+    return;
+
+  printf("ABR: %u up / %u down switch(es), ending at %u kbps, estimate "
+         "%.0f kbps\n",
+         switches_up_,
+         switches_down_,
+         renditions_[current_].bitrate_kbps_,
+         estimator_.estimate_bps() / 1000);
+}
@@ -0,0 +1,118 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ABRCONTROLLER_H_
+#define ABRCONTROLLER_H_
+
+#include <glib.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// One encoding of the content, the frame files in <dir>/<bitrate_kbps>/.
+struct Rendition {
+  std::string dir_;
+  uint32_t bitrate_kbps_;
+};
+
+// Returns the renditions under dir, lowest bitrate first, or nothing if dir
+// holds the frame files itself.
+std::vector<Rendition> FindRenditions(const std::string& dir);
+
+struct AbrOptions {
+  AbrOptions() : safety_factor_(0.8f), low_buffer_ms_(8000),
+                 high_buffer_ms_(20000), fixed_kbps_(0) {}
+
+  // share of the estimated bandwidth a rendition may use
+  float safety_factor_;
+  // no up-switch with less buffer than this, no down-switch with more than
+  // high_buffer_ms_
+  uint32_t low_buffer_ms_;
+  uint32_t high_buffer_ms_;
+  // always play the rendition closest to this bitrate, 0 = adapt
+  uint32_t fixed_kbps_;
+};
+
+// Throughput estimate from the transfer of payload, as two exponentially
+// weighted moving averages of different half-lives; the lower one wins so
+// the estimate drops quickly and recovers slowly. Thread safe.
+class BandwidthEstimator {
+ public:
+  BandwidthEstimator();
+  ~BandwidthEstimator();
+
+  // bytes took duration_us to arrive
+  void AddSample(uint64_t bytes, int64_t duration_us);
+  // bits per second, 0 until enough payload was seen
+  double estimate_bps() const;
+  void Reset();
+
+ private:
+  struct Average {
+    double half_life_us_;
+    double estimate_;
+    double total_weight_;
+  };
+
+  void Update(Average* average, double weight, double bps);
+  double Estimate(const Average& average) const;
+
+  mutable GMutex mutex_;
+  // small reads are pooled into one sample, their timing alone is noise
+  uint64_t pending_bytes_;
+  int64_t pending_us_;
+  uint64_t total_bytes_;
+  Average fast_;
+  Average slow_;
+};
+
+// Picks the rendition to play the next segment in from the bandwidth
+// estimate and the buffered media, and logs every decision as
+//   ABR,<time_ms>,<event>,...
+// lines that can be grepped out of the log to tune it offline.
+class AbrController {
+ public:
+  AbrController();
+
+  void Configure(const std::vector<Rendition>& renditions,
+                 const AbrOptions& options);
+  bool enabled() const { return renditions_.size() > 1; }
+  size_t current() const { return current_; }
+  BandwidthEstimator& estimator() { return estimator_; }
+
+  // Decision at the start of segment counter. buffer_us is the media
+  // buffered ahead of playback, or -1 if unknown.
+  size_t Choose(int32_t counter, int64_t buffer_us);
+  // Logs a point of the buffer trajectory.
+  void LogBuffer(double position_secs, int64_t buffer_us);
+  void PrintStats() const;
+
+ private:
+  size_t ClosestTo(uint32_t kbps) const;
+
+  std::vector<Rendition> renditions_;
+  AbrOptions options_;
+  BandwidthEstimator estimator_;
+  size_t current_;
+  uint32_t switches_up_;
+  uint32_t switches_down_;
+};
+
+#endif  // ABRCONTROLLER_H_
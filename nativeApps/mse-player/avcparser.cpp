@@ -0,0 +1,403 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "avcparser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "framefile.h"
+
+namespace {
+
+// Exp-Golomb reader over the start of a NAL unit payload, skipping emulation
+// prevention bytes.
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size), byte_(0), bit_(0), zeros_(0) {}
+
+  bool ReadBit(uint32_t* bit) {
+    if (bit_ == 0) {
+      // 00 00 03 is an escaped 00 00, drop the 03
+      if (zeros_ >= 2 && byte_ < size_ && data_[byte_] == 3) {
+        byte_++;
+        zeros_ = 0;
+      }
+      if (byte_ >= size_)
+        return false;
+      zeros_ = data_[byte_] == 0 ? zeros_ + 1 : 0;
+    }
+
+    *bit = (data_[byte_] >> (7 - bit_)) & 1;
+    if (++bit_ == 8) {
+      bit_ = 0;
+      byte_++;
+    }
+    return true;
+  }
+
+  bool ReadUe(uint32_t* value) {
+    int leading_zeros = 0;
+    uint32_t bit = 0;
+    while (ReadBit(&bit) && bit == 0) {
+      if (++leading_zeros > 31)
+        return false;
+    }
+    if (bit != 1)
+      return false;
+
+    uint32_t suffix = 0;
+    for (int i = 0; i < leading_zeros; i++) {
+      if (!ReadBit(&bit))
+        return false;
+      suffix = (suffix << 1) | bit;
+    }
+    *value = (1u << leading_zeros) - 1 + suffix;
+    return true;
+  }
+
+  bool ReadSe(int32_t* value) {
+    uint32_t code = 0;
+    if (!ReadUe(&code))
+      return false;
+    *value = (code & 1) ? static_cast<int32_t>((code + 1) / 2)
+                        : -static_cast<int32_t>(code / 2);
+    return true;
+  }
+
+  bool ReadBits(int count, uint32_t* value) {
+    uint32_t bit = 0;
+    *value = 0;
+    for (int i = 0; i < count; i++) {
+      if (!ReadBit(&bit))
+        return false;
+      *value = (*value << 1) | bit;
+    }
+    return true;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t byte_;
+  int bit_;
+  int zeros_;
+};
+
+uint32_t SliceFrameType(uint32_t slice_type) {
+  // 0..4 and 5..9 (all slices of the picture share the type) mean the same
+  switch (slice_type % 5) {
+    case 2:  // I
+    case 4:  // SI
+      return kFrameTypeI;
+    case 0:  // P
+    case 3:  // SP
+      return kFrameTypeP;
+    case 1:
+      return kFrameTypeB;
+  }
+  return 0;
+}
+
+// The parts of a sequence parameter set that go into caps.
+struct SpsInfo {
+  uint32_t profile_idc_;
+  uint32_t constraint_flags_;
+  uint32_t level_idc_;
+  uint32_t width_;
+  uint32_t height_;
+};
+
+bool SkipScalingList(BitReader* reader, int size) {
+  int32_t last_scale = 8, next_scale = 8;
+  for (int i = 0; i < size; i++) {
+    if (next_scale != 0) {
+      int32_t delta = 0;
+      if (!reader->ReadSe(&delta))
+        return false;
+      next_scale = (last_scale + delta + 256) % 256;
+    }
+    if (next_scale != 0)
+      last_scale = next_scale;
+  }
+  return true;
+}
+
+// nal is the SPS NAL unit without its length prefix (ITU-T H.264 7.3.2.1.1)
+bool ParseSps(const uint8_t* nal, size_t size, SpsInfo* sps) {
+  if (size < 4)
+    return false;
+  sps->profile_idc_ = nal[1];
+  sps->constraint_flags_ = nal[2];
+  sps->level_idc_ = nal[3];
+
+  BitReader reader(nal + 4, size - 4);
+  uint32_t value = 0, flag = 0;
+  uint32_t chroma_format_idc = 1;
+  if (!reader.ReadUe(&value))  // seq_parameter_set_id
+    return false;
+
+  switch (sps->profile_idc_) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138:
+    case 139: case 134: case 135:
+      if (!reader.ReadUe(&chroma_format_idc))
+        return false;
+      if (chroma_format_idc == 3 && !reader.ReadBit(&flag))
+        return false;  // separate_colour_plane_flag
+      // bit depths, qpprime_y_zero_transform_bypass_flag
+      if (!reader.ReadUe(&value) || !reader.ReadUe(&value) ||
+          !reader.ReadBit(&flag) || !reader.ReadBit(&flag))
+        return false;
+      if (flag) {  // seq_scaling_matrix_present_flag
+        int lists = chroma_format_idc == 3 ? 12 : 8;
+        for (int i = 0; i < lists; i++) {
+          uint32_t present = 0;
+          if (!reader.ReadBit(&present) ||
+              (present && !SkipScalingList(&reader, i < 6 ? 16 : 64)))
+            return false;
+        }
+      }
+      break;
+  }
+
+  uint32_t poc_type = 0;
+  if (!reader.ReadUe(&value) ||  // log2_max_frame_num_minus4
+      !reader.ReadUe(&poc_type))
+    return false;
+  if (poc_type == 0) {
+    if (!reader.ReadUe(&value))  // log2_max_pic_order_cnt_lsb_minus4
+      return false;
+  } else if (poc_type == 1) {
+    int32_t offset = 0;
+    uint32_t cycle = 0;
+    if (!reader.ReadBit(&flag) || !reader.ReadSe(&offset) ||
+        !reader.ReadSe(&offset) || !reader.ReadUe(&cycle))
+      return false;
+    for (uint32_t i = 0; i < cycle; i++) {
+      if (!reader.ReadSe(&offset))
+        return false;
+    }
+  }
+
+  uint32_t width_mbs = 0, height_map_units = 0, frame_mbs_only = 0;
+  if (!reader.ReadUe(&value) ||   // max_num_ref_frames
+      !reader.ReadBit(&flag) ||   // gaps_in_frame_num_value_allowed_flag
+      !reader.ReadUe(&width_mbs) || !reader.ReadUe(&height_map_units) ||
+      !reader.ReadBit(&frame_mbs_only))
+    return false;
+  if (!frame_mbs_only && !reader.ReadBit(&flag))  // mb_adaptive_frame_field
+    return false;
+  if (!reader.ReadBit(&flag))  // direct_8x8_inference_flag
+    return false;
+
+  uint32_t crop[4] = {0, 0, 0, 0};  // left, right, top, bottom
+  uint32_t cropping = 0;
+  if (!reader.ReadBit(&cropping))
+    return false;
+  for (int i = 0; cropping && i < 4; i++) {
+    if (!reader.ReadUe(&crop[i]))
+      return false;
+  }
+
+  // crop units depend on the chroma subsampling (table 6-1)
+  uint32_t crop_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+  uint32_t crop_y = (chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+  sps->width_ = (width_mbs + 1) * 16 - crop_x * (crop[0] + crop[1]);
+  sps->height_ = (height_map_units + 1) * 16 * (2 - frame_mbs_only) -
+                 crop_y * (crop[2] + crop[3]);
+  return sps->width_ > 0 && sps->height_ > 0;
+}
+
+const char* AvcProfileName(const SpsInfo& sps) {
+  switch (sps.profile_idc_) {
+    case 66:
+      return (sps.constraint_flags_ & 0x40) ? "constrained-baseline"
+                                            : "baseline";
+    case 77:
+      return "main";
+    case 88:
+      return "extended";
+    case 100:
+      return "high";
+    case 110:
+      return "high-10";
+    case 122:
+      return "high-4:2:2";
+    case 244:
+      return "high-4:4:4";
+  }
+  return NULL;
+}
+
+struct MemoryAccessUnit {
+  const uint8_t* data_;
+  uint32_t size_;
+};
+
+bool ReadMemory(uint64_t offset, size_t size, uint8_t* buffer, void* context) {
+  const MemoryAccessUnit* unit = static_cast<const MemoryAccessUnit*>(context);
+  if (offset + size > unit->size_)
+    return false;
+  memcpy(buffer, unit->data_ + offset, size);
+  return true;
+}
+
+}  // namespace
+
+uint32_t ScanAvcAccessUnit(uint32_t size, AvcReadFunction read, void* context) {
+  uint32_t flags = 0;
+  bool have_slice = false;
+  bool reference = false;
+
+  uint64_t offset = 0;
+  while (offset + 5 <= size) {
+    uint8_t peek[kAvcNalPeekSize];
+    size_t peek_size = std::min<uint64_t>(kAvcNalPeekSize, size - offset);
+    if (!read(offset, peek_size, peek, context))
+      return 0;
+
+    uint32_t nal_size = (static_cast<uint32_t>(peek[0]) << 24) |
+                        (peek[1] << 16) | (peek[2] << 8) | peek[3];
+    if (nal_size == 0 || nal_size > size - offset - 4)
+      return 0;
+
+    uint8_t nal_ref_idc = (peek[4] >> 5) & 3;
+    uint8_t nal_type = peek[4] & 0x1f;
+    switch (nal_type) {
+      case kAvcNalIdrSlice:
+        flags |= kFrameFlagKeyframe;
+        // fall through
+      case kAvcNalSlice:
+        if (!have_slice) {
+          // first_mb_in_slice, then slice_type
+          BitReader reader(peek + 5, std::min<size_t>(peek_size - 5, nal_size - 1));
+          uint32_t first_mb = 0, slice_type = 0;
+          if (reader.ReadUe(&first_mb) && reader.ReadUe(&slice_type))
+            flags |= SliceFrameType(slice_type);
+          have_slice = true;
+        }
+        reference |= nal_ref_idc != 0;
+        break;
+      case kAvcNalSps:
+      case kAvcNalPps:
+        flags |= kFrameFlagParameterSets;
+        break;
+    }
+
+    offset += 4 + static_cast<uint64_t>(nal_size);
+  }
+
+  if (!have_slice)
+    return 0;
+  if (!reference)
+    flags |= kFrameFlagNonReference;
+  return flags | kFrameFlagScanned;
+}
+
+uint32_t ScanAvcAccessUnit(const uint8_t* data, uint32_t size) {
+  MemoryAccessUnit unit = {data, size};
+  return ScanAvcAccessUnit(size, ReadMemory, &unit);
+}
+
+std::string AvcCapsFromAccessUnit(const uint8_t* data, uint32_t size) {
+  std::vector<std::pair<const uint8_t*, uint32_t> > sps_units, pps_units;
+  uint32_t offset = 0;
+  while (offset + 5 <= size) {
+    const uint8_t* nal = data + offset + 4;
+    uint32_t nal_size = (static_cast<uint32_t>(data[offset]) << 24) |
+                        (data[offset + 1] << 16) | (data[offset + 2] << 8) |
+                        data[offset + 3];
+    if (nal_size == 0 || nal_size > size - offset - 4 || nal_size > 0xffff)
+      return std::string();
+
+    if ((nal[0] & 0x1f) == kAvcNalSps)
+      sps_units.push_back(std::make_pair(nal, nal_size));
+    else if ((nal[0] & 0x1f) == kAvcNalPps)
+      pps_units.push_back(std::make_pair(nal, nal_size));
+    offset += 4 + nal_size;
+  }
+
+  SpsInfo sps;
+  if (sps_units.empty() || pps_units.empty() || sps_units.size() > 31 ||
+      pps_units.size() > 255 ||
+      !ParseSps(sps_units[0].first, sps_units[0].second, &sps))
+    return std::string();
+
+  // AVCDecoderConfigurationRecord (ISO/IEC 14496-15 5.2.4.1), with 4 byte
+  // NAL unit lengths
+  std::vector<uint8_t> config;
+  config.push_back(1);
+  config.push_back(sps.profile_idc_);
+  config.push_back(sps.constraint_flags_);
+  config.push_back(sps.level_idc_);
+  config.push_back(0xfc | 3);
+  config.push_back(0xe0 | sps_units.size());
+  for (size_t i = 0; i < sps_units.size(); i++) {
+    config.push_back(sps_units[i].second >> 8);
+    config.push_back(sps_units[i].second & 0xff);
+    config.insert(config.end(), sps_units[i].first,
+                  sps_units[i].first + sps_units[i].second);
+  }
+  config.push_back(pps_units.size());
+  for (size_t i = 0; i < pps_units.size(); i++) {
+    config.push_back(pps_units[i].second >> 8);
+    config.push_back(pps_units[i].second & 0xff);
+    config.insert(config.end(), pps_units[i].first,
+                  pps_units[i].first + pps_units[i].second);
+  }
+
+  std::string caps =
+      "video/x-h264, stream-format=(string)avc, alignment=(string)au";
+  char field[64];
+  if (sps.level_idc_ % 10)
+    snprintf(field, sizeof(field), ", level=(string)%u.%u",
+             sps.level_idc_ / 10, sps.level_idc_ % 10);
+  else
+    snprintf(field, sizeof(field), ", level=(string)%u", sps.level_idc_ / 10);
+  caps += field;
+  if (AvcProfileName(sps)) {
+    caps += ", profile=(string)";
+    caps += AvcProfileName(sps);
+  }
+  caps += ", codec_data=(buffer)";
+  for (size_t i = 0; i < config.size(); i++) {
+    snprintf(field, sizeof(field), "%02x", config[i]);
+    caps += field;
+  }
+  snprintf(field, sizeof(field), ", width=(int)%u, height=(int)%u",
+           sps.width_, sps.height_);
+  caps += field;
+  return caps;
+}
+
+const char* AvcFrameTypeName(uint32_t flags) {
+  switch (flags & kFrameTypeMask) {
+    case kFrameTypeI:
+      return "I";
+    case kFrameTypeP:
+      return "P";
+    case kFrameTypeB:
+      return "B";
+  }
+  return "?";
+}
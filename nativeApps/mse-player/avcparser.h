@@ -0,0 +1,67 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AVCPARSER_H_
+#define AVCPARSER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Classification of H.264 access units stored as 4-byte length prefixed NAL
+// units (stream-format=avc), as in the mse_frames video payloads. Only the
+// NAL headers and the start of the first slice header are looked at, so a
+// frame costs a few bytes of reading however large it is.
+
+// NAL unit types (ITU-T H.264 table 7-1)
+enum AvcNalType {
+  kAvcNalSlice = 1,
+  kAvcNalIdrSlice = 5,
+  kAvcNalSei = 6,
+  kAvcNalSps = 7,
+  kAvcNalPps = 8,
+  kAvcNalAccessUnitDelimiter = 9,
+};
+
+// Bytes of each NAL unit that ScanAvcAccessUnit() needs to see, enough for
+// the length prefix, the NAL header and the slice type.
+const size_t kAvcNalPeekSize = 16;
+
+// Returns kFrameFlag* bits for an access unit whose NAL units are read with
+// read(offset, size, buffer, context), offset being relative to the start of
+// the access unit. Returns 0 if the payload isn't a valid AVC access unit.
+typedef bool (*AvcReadFunction)(uint64_t offset,
+                                size_t size,
+                                uint8_t* buffer,
+                                void* context);
+uint32_t ScanAvcAccessUnit(uint32_t size, AvcReadFunction read, void* context);
+// Same for an access unit in memory.
+uint32_t ScanAvcAccessUnit(const uint8_t* data, uint32_t size);
+
+// Returns "video/x-h264, stream-format=avc" caps with codec_data, profile,
+// level and size taken from the SPS and PPS units of an access unit in
+// memory, or an empty string if it carries none or they can't be parsed.
+// There is no framerate, the SPS timing info is usually absent.
+std::string AvcCapsFromAccessUnit(const uint8_t* data, uint32_t size);
+
+// "I", "P", "B" or "?" for the frame type bits of flags
+const char* AvcFrameTypeName(uint32_t flags);
+
+#endif  // AVCPARSER_H_
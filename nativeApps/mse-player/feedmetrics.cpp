@@ -0,0 +1,128 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "feedmetrics.h"
+
+namespace {
+
+void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Max(std::atomic<uint64_t>& counter, uint64_t value) {
+  uint64_t current = counter.load(std::memory_order_relaxed);
+  while (value > current &&
+         !counter.compare_exchange_weak(current, value,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t Get(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+TrackMetrics::TrackMetrics() {
+  Reset();
+}
+
+void TrackMetrics::Reset() {
+  wakeups_ = 0;
+  frames_ = 0;
+  bytes_ = 0;
+  pushes_ = 0;
+  push_total_us_ = 0;
+  push_max_us_ = 0;
+  need_data_ = 0;
+  enough_data_ = 0;
+  underruns_ = 0;
+  segments_ = 0;
+}
+
+FeedMetrics::FeedMetrics() {
+  Reset();
+}
+
+void FeedMetrics::Reset() {
+  tracks_[kAudio].Reset();
+  tracks_[kVideo].Reset();
+  seeks_ = 0;
+  seeks_completed_ = 0;
+  seek_latency_total_us_ = 0;
+  seek_latency_max_us_ = 0;
+}
+
+void FeedMetrics::RecordWakeup(AVType type) {
+  Add(tracks_[type].wakeups_, 1);
+}
+
+void FeedMetrics::RecordPush(AVType type,
+                             uint64_t frames,
+                             uint64_t bytes,
+                             int64_t push_us) {
+  TrackMetrics& track = tracks_[type];
+  uint64_t us = push_us > 0 ? push_us : 0;
+  Add(track.frames_, frames);
+  Add(track.bytes_, bytes);
+  Add(track.pushes_, 1);
+  Add(track.push_total_us_, us);
+  Max(track.push_max_us_, us);
+}
+
+void FeedMetrics::RecordNeedData(AVType type, bool underrun) {
+  Add(tracks_[type].need_data_, 1);
+  if (underrun)
+    Add(tracks_[type].underruns_, 1);
+}
+
+void FeedMetrics::RecordEnoughData(AVType type) {
+  Add(tracks_[type].enough_data_, 1);
+}
+
+void FeedMetrics::RecordSegment(AVType type) {
+  Add(tracks_[type].segments_, 1);
+}
+
+void FeedMetrics::RecordSeek() {
+  Add(seeks_, 1);
+}
+
+void FeedMetrics::RecordSeekLatency(int64_t latency_us) {
+  uint64_t us = latency_us > 0 ? latency_us : 0;
+  Add(seeks_completed_, 1);
+  Add(seek_latency_total_us_, us);
+  Max(seek_latency_max_us_, us);
+}
+
+uint64_t FeedMetrics::seeks() const {
+  return Get(seeks_);
+}
+
+uint64_t FeedMetrics::seeks_completed() const {
+  return Get(seeks_completed_);
+}
+
+uint64_t FeedMetrics::seek_latency_total_us() const {
+  return Get(seek_latency_total_us_);
+}
+
+uint64_t FeedMetrics::seek_latency_max_us() const {
+  return Get(seek_latency_max_us_);
+}
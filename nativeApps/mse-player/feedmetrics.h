@@ -0,0 +1,80 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FEEDMETRICS_H_
+#define FEEDMETRICS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "framefile.h"
+
+// Feed counters of one track. Writers only do relaxed atomic updates, so each
+// field is consistent on its own but a snapshot may straddle a push.
+struct TrackMetrics {
+  TrackMetrics();
+  void Reset();
+
+  std::atomic<uint64_t> wakeups_;        // feed attempts, pushing or not
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> pushes_;         // push calls, one per buffer list
+  std::atomic<uint64_t> push_total_us_;  // time spent inside push calls
+  std::atomic<uint64_t> push_max_us_;
+  std::atomic<uint64_t> need_data_;
+  std::atomic<uint64_t> enough_data_;
+  std::atomic<uint64_t> underruns_;      // need-data with an empty appsrc
+  std::atomic<uint64_t> segments_;       // segments the track moved into
+};
+
+// Counters of the feed into both appsrcs, updated from the main loop, the
+// feeder threads and the appsrc signal handlers alike.
+class FeedMetrics {
+ public:
+  FeedMetrics();
+  void Reset();
+
+  void RecordWakeup(AVType type);
+  void RecordPush(AVType type, uint64_t frames, uint64_t bytes, int64_t push_us);
+  void RecordNeedData(AVType type, bool underrun);
+  void RecordEnoughData(AVType type);
+  void RecordSegment(AVType type);
+  void RecordSeek();
+  // time from a seek to its first frame at the sink
+  void RecordSeekLatency(int64_t latency_us);
+
+  const TrackMetrics& track(AVType type) const { return tracks_[type]; }
+  uint64_t seeks() const;
+  uint64_t seeks_completed() const;
+  uint64_t seek_latency_total_us() const;
+  uint64_t seek_latency_max_us() const;
+
+ private:
+  FeedMetrics(const FeedMetrics&);
+  FeedMetrics& operator=(const FeedMetrics&);
+
+  TrackMetrics tracks_[2];  // indexed by AVType
+  std::atomic<uint64_t> seeks_;
+  std::atomic<uint64_t> seeks_completed_;
+  std::atomic<uint64_t> seek_latency_total_us_;
+  std::atomic<uint64_t> seek_latency_max_us_;
+};
+
+#endif  // FEEDMETRICS_H_
@@ -0,0 +1,711 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "framefile.h"
+
+#include "aacparser.h"
+#include "avcparser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+const char kFrameFileMagic[4] = {'M', 'S', 'E', 'F'};
+
+const char kDefaultVideoCaps[] =
+    "video/x-h264, stream-format=(string)avc, alignment=(string)au, "
+    "level=(string)3.1, profile=(string)main, "
+    "codec_data=(buffer)014d401fffe1001b674d401fe8802802dd80b5010101400000fa40003a9803c60c448001000468ebaf20, "
+    "width=(int)1280, height=(int)720, pixel-aspect-ratio=(fraction)1/1, "
+    "framerate=(fraction)100000/3357";
+const char kDefaultAudioCaps[] =
+    "audio/mpeg, mpegversion=(int)4, framed=(boolean)true, "
+    "stream-format=(string)raw, level=(string)2, base-profile=(string)lc, "
+    "profile=(string)lc, codec_data=(buffer)1210, rate=(int)44100, "
+    "channels=(int)2";
+
+namespace {
+
+static_assert(sizeof(FrameFileHeader) == 56, "FrameFileHeader layout changed");
+static_assert(sizeof(FrameRecord) == 40, "FrameRecord layout changed");
+
+const size_t kCopyBufferSize = 64 * 1024;
+
+bool ReadTextFile(const std::string& path, std::string* contents) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+
+  char buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents->append(buffer, read);
+  fclose(file);
+  return true;
+}
+
+bool WriteFully(int fd, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    ssize_t ret = write(fd, p, size);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    p += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+// orders record positions by the pts of the records
+class PtsOrder {
+ public:
+  explicit PtsOrder(const std::vector<FrameRecord>& records) : records_(records) {}
+  bool operator()(size_t a, size_t b) const {
+    return records_[a].pts_us_ < records_[b].pts_us_;
+  }
+
+ private:
+  const std::vector<FrameRecord>& records_;
+};
+
+// ScanAvcAccessUnit() reader for a frame in a payload file
+struct PayloadRange {
+  int fd_;
+  uint64_t offset_;
+};
+
+bool ReadPayload(uint64_t offset, size_t size, uint8_t* buffer, void* range) {
+  const PayloadRange* payload = static_cast<const PayloadRange*>(range);
+  return ReadFully(payload->fd_, buffer, size, payload->offset_ + offset);
+}
+
+uint64_t GreatestCommonDivisor(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+}  // namespace
+
+bool ReadFully(int fd, void* data, size_t size, uint64_t offset) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    ssize_t ret = pread(fd, p, size, offset);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    p += ret;
+    size -= ret;
+    offset += ret;
+  }
+  return true;
+}
+
+std::string SegmentPath(const std::string& dir, AVType type, int32_t counter) {
+  std::ostringstream path;
+  path << dir << (type == kVideo ? "/raw_video_frames_" : "/raw_audio_frames_")
+       << counter;
+  return path.str();
+}
+
+FrameIndex::FrameIndex() { Clear(); }
+
+void FrameIndex::Clear() {
+  type_ = kAudio;
+  caps_.clear();
+  payload_path_.clear();
+  records_.clear();
+  keyframes_.clear();
+  first_pts_us_ = kTimestampNone;
+  last_pts_us_ = kTimestampNone;
+  payload_bytes_ = 0;
+}
+
+void FrameIndex::UpdateSummary() {
+  first_pts_us_ = kTimestampNone;
+  last_pts_us_ = kTimestampNone;
+  payload_bytes_ = 0;
+
+  for (size_t i = 0; i < records_.size(); i++) {
+    const FrameRecord& record = records_[i];
+    if (first_pts_us_ == kTimestampNone || record.pts_us_ < first_pts_us_)
+      first_pts_us_ = record.pts_us_;
+    if (last_pts_us_ == kTimestampNone || record.pts_us_ > last_pts_us_)
+      last_pts_us_ = record.pts_us_;
+    payload_bytes_ += record.size_;
+  }
+
+  keyframes_.clear();
+  for (size_t i = 0; i < records_.size(); i++) {
+    if (type_ == kAudio || (records_[i].flags_ & kFrameFlagKeyframe))
+      keyframes_.push_back(i);
+  }
+}
+
+void FrameIndex::DeriveTiming() {
+  size_t count = records_.size();
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), PtsOrder(records_));
+
+  for (size_t k = 0; k < count; k++) {
+    FrameRecord& record = records_[order[k]];
+    if (record.duration_us_ != 0)
+      continue;
+
+    // the last frame is assumed to last as long as the one before it
+    int64_t duration_us = 0;
+    if (k + 1 < count)
+      duration_us = records_[order[k + 1]].pts_us_ - record.pts_us_;
+    else if (k > 0)
+      duration_us = record.pts_us_ - records_[order[k - 1]].pts_us_;
+    record.duration_us_ = static_cast<uint32_t>(
+        std::min<int64_t>(std::max<int64_t>(duration_us, 0),
+                          std::numeric_limits<uint32_t>::max()));
+  }
+
+  // no frame may decode after it is presented
+  int64_t delay_us = 0;
+  for (size_t i = 0; i < count; i++) {
+    delay_us = std::max(delay_us,
+                        records_[order[i]].pts_us_ - records_[i].pts_us_);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (records_[i].dts_us_ == kTimestampNone)
+      records_[i].dts_us_ = records_[order[i]].pts_us_ - delay_us;
+  }
+}
+
+size_t FrameIndex::ScanVideoFrames(int payload_fd) {
+  if (type_ != kVideo)
+    return 0;
+
+  size_t scanned = 0;
+  for (size_t i = 0; i < records_.size(); i++) {
+    FrameRecord& record = records_[i];
+    if (record.flags_ & kFrameFlagScanned)
+      continue;
+
+    PayloadRange range = {payload_fd, record.offset_};
+    record.flags_ |= ScanAvcAccessUnit(record.size_, ReadPayload, &range);
+    scanned++;
+  }
+  return scanned;
+}
+
+void FrameIndex::ResolveCaps(const std::string& segment_path, int payload_fd) {
+  std::string sidecar;
+  if (ReadTextFile(segment_path + kCapsExtension, &sidecar)) {
+    size_t end = sidecar.find_last_not_of(" \t\r\n");
+    caps_ = sidecar.substr(0, end == std::string::npos ? 0 : end + 1);
+    if (!caps_.empty())
+      return;
+  }
+
+  caps_ = DeriveCaps(payload_fd);
+  if (caps_.empty())
+    caps_ = (type_ == kVideo) ? kDefaultVideoCaps : kDefaultAudioCaps;
+}
+
+std::string FrameIndex::DeriveCaps(int payload_fd) const {
+  if (payload_fd < 0)
+    return std::string();
+
+  // the first frame with parameter sets describes the video, any frame the
+  // audio
+  size_t frame = 0;
+  if (type_ == kVideo) {
+    while (frame < records_.size() &&
+           !(records_[frame].flags_ & kFrameFlagParameterSets))
+      frame++;
+  }
+  if (frame >= records_.size())
+    return std::string();
+
+  const FrameRecord& record = records_[frame];
+  std::vector<uint8_t> payload(record.size_);
+  if (!ReadFully(payload_fd, payload.data(), payload.size(), record.offset_))
+    return std::string();
+
+  if (type_ == kAudio)
+    return AacCapsFromAdtsFrame(payload.data(), record.size_);
+
+  std::string caps = AvcCapsFromAccessUnit(payload.data(), record.size_);
+  uint64_t total_us = 0;
+  for (size_t i = 0; i < records_.size(); i++)
+    total_us += records_[i].duration_us_;
+  if (!caps.empty() && total_us > 0) {
+    // frames per total_us microseconds; caps fractions are gints, so reduce
+    // and, for odd timings of long segments, give up precision to fit
+    uint64_t num = records_.size() * static_cast<uint64_t>(1000000);
+    uint64_t den = total_us;
+    uint64_t gcd = GreatestCommonDivisor(num, den);
+    num /= gcd;
+    den /= gcd;
+    while (num > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()) ||
+           den > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+      num = (num + 1) / 2;
+      den = (den + 1) / 2;
+    }
+
+    char framerate[64];
+    snprintf(framerate, sizeof(framerate), ", framerate=(fraction)%llu/%llu",
+             static_cast<unsigned long long>(num),
+             static_cast<unsigned long long>(den));
+    caps += framerate;
+  }
+  return caps;
+}
+
+size_t FrameIndex::FindKeyframe(int64_t pts_us) const {
+  if (keyframes_.empty())
+    return 0;
+
+  // first keyframe after pts_us, the one before it is the answer
+  size_t low = 0, high = keyframes_.size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (records_[keyframes_[mid]].pts_us_ <= pts_us)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return keyframes_[low > 0 ? low - 1 : 0];
+}
+
+bool FrameIndex::Load(const std::string& segment_path, AVType type) {
+  if (LoadContainer(segment_path + kFrameFileExtension)) {
+    if (type_ == type)
+      return true;
+    fprintf(stderr, "%s%s holds the wrong track type\n",
+            segment_path.c_str(), kFrameFileExtension);
+  }
+
+  return LoadLegacy(segment_path + ".txt", segment_path + ".bin", type);
+}
+
+bool FrameIndex::LoadContainer(const std::string& path) {
+  Clear();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  FrameFileHeader header;
+  bool ok = fstat(fd, &st) == 0 &&
+            ReadFully(fd, &header, sizeof(header), 0) &&
+            memcmp(header.magic_, kFrameFileMagic, sizeof(kFrameFileMagic)) == 0;
+  if (ok && header.version_ != kFrameFileVersion) {
+    fprintf(stderr, "%s is a version %u frame container, convert it again\n",
+            path.c_str(), header.version_);
+    close(fd);
+    return false;
+  }
+  if (!ok || header.track_type_ > kVideo) {
+    fprintf(stderr, "%s is not a valid frame container\n", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  // nothing may be sized from the header before it is known to fit the file,
+  // a truncated or corrupt container would otherwise allocate or read
+  // whatever its fields say
+  uint64_t file_size = st.st_size;
+  if (header.caps_size_ > file_size - sizeof(header) ||
+      header.index_offset_ < sizeof(header) + header.caps_size_ ||
+      header.index_offset_ > file_size ||
+      header.frame_count_ >
+          (file_size - header.index_offset_) / sizeof(FrameRecord)) {
+    fprintf(stderr, "%s: frame index points past the end of the file\n",
+            path.c_str());
+    close(fd);
+    return false;
+  }
+
+  std::vector<char> caps(header.caps_size_);
+  records_.resize(header.frame_count_);
+  ok = ReadFully(fd, caps.data(), caps.size(), sizeof(header)) &&
+       ReadFully(fd, records_.data(), records_.size() * sizeof(FrameRecord),
+                 header.index_offset_);
+
+  if (!ok) {
+    fprintf(stderr, "%s: truncated frame index\n", path.c_str());
+    close(fd);
+    Clear();
+    return false;
+  }
+
+  for (size_t i = 0; i < records_.size(); i++) {
+    const FrameRecord& record = records_[i];
+    if (record.offset_ > file_size ||
+        record.size_ > file_size - record.offset_) {
+      fprintf(stderr, "%s: frame %zu lies outside the payload\n",
+              path.c_str(), i);
+      close(fd);
+      Clear();
+      return false;
+    }
+  }
+
+  type_ = static_cast<AVType>(header.track_type_);
+  caps_.assign(caps.begin(), caps.end());
+  payload_path_ = path;
+  // containers converted before frames were scanned have no video flags,
+  // derive them now (converting again persists them)
+  ScanVideoFrames(fd);
+  DeriveTiming();
+  if (caps_.empty())
+    ResolveCaps(path.substr(0, path.size() - strlen(kFrameFileExtension)), fd);
+  close(fd);
+  UpdateSummary();
+  return true;
+}
+
+bool FrameIndex::LoadLegacy(const std::string& timestamp_path,
+                            const std::string& payload_path,
+                            AVType type) {
+  Clear();
+
+  std::string text;
+  if (!ReadTextFile(timestamp_path, &text))
+    return false;
+
+  // "pts_us,size," pairs in decode order, payloads back to back in the .bin
+  const char* p = text.c_str();
+  uint64_t offset = 0;
+  while (*p) {
+    char* end;
+    int64_t pts_us = strtoll(p, &end, 10);
+    if (end == p || *end != ',')
+      break;
+    p = end + 1;
+    long size = strtol(p, &end, 10);
+    if (end == p || size < 0)
+      break;
+    p = (*end == ',') ? end + 1 : end;
+
+    FrameRecord record;
+    record.offset_ = offset;
+    record.size_ = static_cast<uint32_t>(size);
+    record.flags_ = (type == kAudio) ? kFrameFlagKeyframe : 0;
+    record.pts_us_ = pts_us;
+    record.dts_us_ = kTimestampNone;
+    record.duration_us_ = 0;
+    record.reserved_ = 0;
+    records_.push_back(record);
+    offset += size;
+
+    while (*p == '\n' || *p == '\r' || *p == ' ')
+      ++p;
+  }
+
+  // drop trailing frames whose payload is missing from the .bin, the old
+  // reader treated a short read as the end of the segment too
+  struct stat st;
+  if (stat(payload_path.c_str(), &st) != 0) {
+    Clear();
+    return false;
+  }
+  while (!records_.empty() &&
+         records_.back().offset_ + records_.back().size_ >
+             static_cast<uint64_t>(st.st_size))
+    records_.pop_back();
+
+  type_ = type;
+  payload_path_ = payload_path;
+
+  int payload_fd = open(payload_path.c_str(), O_RDONLY);
+  if (payload_fd >= 0)
+    ScanVideoFrames(payload_fd);
+  DeriveTiming();
+
+  std::string segment_path = timestamp_path;
+  if (segment_path.size() > 4 &&
+      segment_path.compare(segment_path.size() - 4, 4, ".txt") == 0)
+    segment_path.erase(segment_path.size() - 4);
+  ResolveCaps(segment_path, payload_fd);
+  if (payload_fd >= 0)
+    close(payload_fd);
+  UpdateSummary();
+  return true;
+}
+
+FrameMapping* FrameMapping::Create(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    return NULL;
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  return new FrameMapping(static_cast<uint8_t*>(data), 0, st.st_size, true);
+}
+
+FrameMapping* FrameMapping::Load(int fd, uint64_t offset, size_t size) {
+  uint8_t* data = static_cast<uint8_t*>(malloc(size));
+  if (!data)
+    return NULL;
+
+  if (!ReadFully(fd, data, size, offset)) {
+    free(data);
+    return NULL;
+  }
+
+  return new FrameMapping(data, offset, size, false);
+}
+
+FrameMapping::FrameMapping(uint8_t* data,
+                           uint64_t offset,
+                           size_t size,
+                           bool mapped)
+    : data_(data), offset_(offset), size_(size), mapped_(mapped), refcount_(1) {}
+
+FrameMapping::~FrameMapping() {
+  if (mapped_)
+    munmap(data_, size_);
+  else
+    free(data_);
+}
+
+void FrameMapping::Ref() { refcount_.fetch_add(1, std::memory_order_relaxed); }
+
+void FrameMapping::Unref() {
+  if (refcount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete this;
+}
+
+std::shared_ptr<PayloadFile> PayloadFile::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s\n", path.c_str());
+    return std::shared_ptr<PayloadFile>();
+  }
+  return std::shared_ptr<PayloadFile>(new PayloadFile(fd));
+}
+
+PayloadFile::~PayloadFile() { close(fd_); }
+
+FrameReader::FrameReader()
+    : mapping_(NULL), prefetched_(NULL), next_frame_(0) {}
+
+FrameReader::~FrameReader() { Close(); }
+
+bool FrameReader::Open(const std::string& segment_path,
+                       AVType type,
+                       bool use_mmap) {
+  std::shared_ptr<FrameIndex> index(new FrameIndex());
+  if (!index->Load(segment_path, type))
+    return false;
+
+  std::shared_ptr<PayloadFile> file = PayloadFile::Open(index->payload_path());
+  if (!file)
+    return false;
+
+  return Open(index, file, use_mmap);
+}
+
+bool FrameReader::Open(const std::shared_ptr<const FrameIndex>& index,
+                       const std::shared_ptr<PayloadFile>& file,
+                       bool use_mmap) {
+  Close();
+
+  if (!index || !file)
+    return false;
+
+  index_ = index;
+  file_ = file;
+
+  if (use_mmap)
+    mapping_ = FrameMapping::Create(file_->fd());
+
+  // the mapping may still fail to cover a truncated payload file
+  if (mapping_ && !index_->empty()) {
+    const FrameRecord& last = (*index_)[index_->size() - 1];
+    if (!mapping_->Contains(last.offset_, last.size_)) {
+      mapping_->Unref();
+      mapping_ = NULL;
+    }
+  }
+
+  if (!mapping_)
+    posix_fadvise(file_->fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+  return true;
+}
+
+void FrameReader::Close() {
+  if (mapping_)
+    mapping_->Unref();
+  if (prefetched_)
+    prefetched_->Unref();
+  mapping_ = NULL;
+  prefetched_ = NULL;
+  file_.reset();
+  index_.reset();
+  next_frame_ = 0;
+}
+
+bool FrameReader::SeekTo(size_t frame) {
+  if (!file_ || frame > index_->size())
+    return false;
+  next_frame_ = frame;
+  return true;
+}
+
+const FrameRecord* FrameReader::Peek() const {
+  if (!file_ || next_frame_ >= index_->size())
+    return NULL;
+  return &(*index_)[next_frame_];
+}
+
+bool FrameReader::Read(uint8_t* data) {
+  const FrameRecord* record = Peek();
+  if (!record || !ReadFully(file_->fd(), data, record->size_, record->offset_))
+    return false;
+
+  ++next_frame_;
+  return true;
+}
+
+bool FrameReader::Skip() {
+  if (!Peek())
+    return false;
+
+  ++next_frame_;
+  return true;
+}
+
+void FrameReader::SetPrefetched(FrameMapping* block) {
+  if (prefetched_)
+    prefetched_->Unref();
+  prefetched_ = block;
+  if (prefetched_)
+    prefetched_->Ref();
+}
+
+bool FrameReader::is_mapped() const {
+  const FrameRecord* record = Peek();
+  if (!record)
+    return mapping_ != NULL;
+
+  return mapping_ != NULL ||
+         (prefetched_ && prefetched_->Contains(record->offset_, record->size_));
+}
+
+const uint8_t* FrameReader::ReadMapped(FrameMapping** mapping) {
+  const FrameRecord* record = Peek();
+  if (!record)
+    return NULL;
+
+  // prefer the prefetched copy, it is already in memory
+  FrameMapping* source = mapping_;
+  if (prefetched_ && prefetched_->Contains(record->offset_, record->size_))
+    source = prefetched_;
+  if (!source)
+    return NULL;
+
+  ++next_frame_;
+  source->Ref();
+  *mapping = source;
+  return source->at(record->offset_);
+}
+
+bool WriteFrameFile(const std::string& path,
+                    const FrameIndex& index,
+                    int payload_fd) {
+  FrameFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, kFrameFileMagic, sizeof(kFrameFileMagic));
+  header.version_ = kFrameFileVersion;
+  header.track_type_ = index.type();
+  header.frame_count_ = index.size();
+  header.first_pts_us_ = index.first_pts_us();
+  header.last_pts_us_ = index.last_pts_us();
+  header.caps_size_ = index.caps().size();
+  header.index_offset_ = sizeof(header) + header.caps_size_;
+  // keep the record array 8 byte aligned
+  header.index_offset_ = (header.index_offset_ + 7) & ~static_cast<uint64_t>(7);
+  header.payload_offset_ =
+      header.index_offset_ + index.size() * sizeof(FrameRecord);
+
+  std::vector<FrameRecord> records(index.records());
+  uint64_t offset = header.payload_offset_;
+  for (size_t i = 0; i < records.size(); i++) {
+    records[i].offset_ = offset;
+    offset += records[i].size_;
+  }
+
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create %s\n", tmp_path.c_str());
+    return false;
+  }
+
+  static const char kPadding[8] = {0};
+  bool ok = WriteFully(fd, &header, sizeof(header)) &&
+            WriteFully(fd, index.caps().data(), index.caps().size()) &&
+            WriteFully(fd, kPadding,
+                       header.index_offset_ - sizeof(header) - header.caps_size_) &&
+            WriteFully(fd, records.data(), records.size() * sizeof(FrameRecord));
+
+  std::vector<uint8_t> buffer(kCopyBufferSize);
+  for (size_t i = 0; ok && i < index.size(); i++) {
+    uint64_t src_offset = index[i].offset_;
+    uint32_t remaining = index[i].size_;
+    while (ok && remaining > 0) {
+      size_t chunk = std::min<size_t>(remaining, buffer.size());
+      ok = ReadFully(payload_fd, buffer.data(), chunk, src_offset) &&
+           WriteFully(fd, buffer.data(), chunk);
+      src_offset += chunk;
+      remaining -= chunk;
+    }
+  }
+
+  if (close(fd) != 0)
+    ok = false;
+
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "Failed to write %s\n", path.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
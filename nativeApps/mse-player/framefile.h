@@ -0,0 +1,261 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEFILE_H_
+#define FRAMEFILE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Frame segments come in two layouts:
+//
+//  - legacy: raw_<track>_frames_N.txt holding "pts_us,size," pairs in decode
+//    order and raw_<track>_frames_N.bin holding the concatenated payloads
+//  - indexed: a single raw_<track>_frames_N.msef container, laid out as
+//      FrameFileHeader | caps string | FrameRecord[frame_count] | payloads
+//    so the whole index can be loaded with two reads and any frame can be
+//    located without parsing text.
+//
+// All container fields are stored in host byte order (little endian on every
+// supported target).
+
+enum AVType { kAudio = 0, kVideo };
+
+extern const char kFrameFileMagic[4];
+// 2: FrameRecord::duration_us_, records carry derived dts
+const uint32_t kFrameFileVersion = 2;
+const char kFrameFileExtension[] = ".msef";
+// optional raw_<track>_frames_N.caps sidecar holding a gstreamer caps string
+const char kCapsExtension[] = ".caps";
+
+// FrameRecord::flags_
+const uint32_t kFrameFlagKeyframe = 1 << 0;       // IDR or audio frame
+const uint32_t kFrameFlagParameterSets = 1 << 1;  // carries SPS/PPS
+const uint32_t kFrameFlagNonReference = 1 << 2;   // can be dropped
+// video flags were derived from the bitstream, without it a video frame
+// without kFrameFlagKeyframe may still be one
+const uint32_t kFrameFlagScanned = 1 << 3;
+// type of the first slice of a scanned video frame
+const uint32_t kFrameTypeMask = 3 << 4;
+const uint32_t kFrameTypeI = 1 << 4;
+const uint32_t kFrameTypeP = 2 << 4;
+const uint32_t kFrameTypeB = 3 << 4;
+
+// pts/dts value for a timestamp the source did not provide
+const int64_t kTimestampNone = std::numeric_limits<int64_t>::min();
+
+// default caps of the bundled mse_frames content
+extern const char kDefaultVideoCaps[];
+extern const char kDefaultAudioCaps[];
+
+struct FrameFileHeader {
+  char magic_[4];
+  uint32_t version_;
+  uint32_t track_type_;
+  uint32_t frame_count_;
+  int64_t first_pts_us_;
+  int64_t last_pts_us_;
+  uint32_t caps_size_;  // length of the caps string following the header
+  uint32_t reserved_;
+  uint64_t index_offset_;
+  uint64_t payload_offset_;
+};
+
+// {offset, size, flags, pts, dts, duration} of one frame; 32 bit fields are
+// paired so the record packs into 40 bytes without padding
+struct FrameRecord {
+  uint64_t offset_;  // absolute offset of the payload in the payload file
+  uint32_t size_;
+  uint32_t flags_;
+  int64_t pts_us_;
+  int64_t dts_us_;
+  uint32_t duration_us_;  // 0 if unknown
+  uint32_t reserved_;
+};
+
+// In-memory index of one track of one segment, loaded from either layout.
+class FrameIndex {
+ public:
+  FrameIndex();
+
+  // Loads <segment_path>.msef, falling back to <segment_path>.txt/.bin.
+  bool Load(const std::string& segment_path, AVType type);
+  bool LoadContainer(const std::string& path);
+  bool LoadLegacy(const std::string& timestamp_path,
+                  const std::string& payload_path,
+                  AVType type);
+  void Clear();
+
+  bool empty() const { return records_.empty(); }
+  size_t size() const { return records_.size(); }
+  const FrameRecord& operator[](size_t i) const { return records_[i]; }
+  AVType type() const { return type_; }
+  const std::string& caps() const { return caps_; }
+  void set_caps(const std::string& caps) { caps_ = caps; }
+  const std::string& payload_path() const { return payload_path_; }
+  int64_t first_pts_us() const { return first_pts_us_; }
+  int64_t last_pts_us() const { return last_pts_us_; }
+  uint64_t payload_bytes() const { return payload_bytes_; }
+  std::vector<FrameRecord>& records() { return records_; }
+  const std::vector<FrameRecord>& records() const { return records_; }
+
+  // Recomputes first/last pts, the payload byte count and the keyframe index
+  // from the records.
+  void UpdateSummary();
+  // Fills in missing dts and durations from the pts of the frames: the
+  // n-th frame in decode order decodes at the n-th presentation time minus
+  // the reorder delay, and lasts until the next frame is presented.
+  void DeriveTiming();
+  // Derives the flags of video frames that were never scanned from their
+  // payloads in payload_fd. Returns the number of frames scanned.
+  size_t ScanVideoFrames(int payload_fd);
+
+  // Picks the caps of a legacy track, or of a container stored without any:
+  // the <segment_path>.caps sidecar, else caps derived from the SPS/PPS or
+  // ADTS header of the payloads, else the defaults.
+  void ResolveCaps(const std::string& segment_path, int payload_fd);
+
+  // Returns the decode order position of the last keyframe with a pts at or
+  // before pts_us, or of the first keyframe if they are all later. Audio
+  // frames all count as keyframes; a video track without any keyframe flags
+  // can only be entered at its first frame.
+  size_t FindKeyframe(int64_t pts_us) const;
+
+ private:
+  std::string DeriveCaps(int payload_fd) const;
+
+  AVType type_;
+  std::string caps_;
+  std::string payload_path_;
+  std::vector<FrameRecord> records_;
+  // positions of the keyframes in records_, keyframe pts increase with
+  // decode order so this is sorted by pts as well
+  std::vector<uint32_t> keyframes_;
+  int64_t first_pts_us_;
+  int64_t last_pts_us_;
+  uint64_t payload_bytes_;
+};
+
+// Read-only view of a payload file range, either an mmap of the whole file or
+// a heap copy of a prefetched range. Every frame handed out of it holds a
+// reference, so it stays valid until the last one is released even after the
+// reader has moved on to the next segment.
+class FrameMapping {
+ public:
+  static FrameMapping* Create(int fd);
+  static FrameMapping* Load(int fd, uint64_t offset, size_t size);
+
+  void Ref();
+  void Unref();
+  bool Contains(uint64_t offset, size_t size) const {
+    return offset >= offset_ && offset + size <= offset_ + size_;
+  }
+  const uint8_t* at(uint64_t offset) const { return data_ + (offset - offset_); }
+  size_t size() const { return size_; }
+
+ private:
+  FrameMapping(uint8_t* data, uint64_t offset, size_t size, bool mapped);
+  ~FrameMapping();
+  FrameMapping(const FrameMapping&);
+  FrameMapping& operator=(const FrameMapping&);
+
+  uint8_t* data_;
+  uint64_t offset_;  // file offset of data_[0]
+  size_t size_;
+  bool mapped_;
+  std::atomic<int> refcount_;
+};
+
+// Open payload file, shared between the segment catalog and its readers.
+class PayloadFile {
+ public:
+  static std::shared_ptr<PayloadFile> Open(const std::string& path);
+  ~PayloadFile();
+  int fd() const { return fd_; }
+
+ private:
+  explicit PayloadFile(int fd) : fd_(fd) {}
+  PayloadFile(const PayloadFile&);
+  PayloadFile& operator=(const PayloadFile&);
+
+  int fd_;
+};
+
+// Sequential reader over one track of one segment.
+class FrameReader {
+ public:
+  FrameReader();
+  ~FrameReader();
+
+  // With use_mmap the payload file is mapped once and frames are served with
+  // ReadMapped(), falling back to Read() if the mapping fails.
+  bool Open(const std::string& segment_path, AVType type, bool use_mmap = false);
+  // Opens an index and payload file already loaded by the segment catalog.
+  bool Open(const std::shared_ptr<const FrameIndex>& index,
+            const std::shared_ptr<PayloadFile>& file,
+            bool use_mmap = false);
+  void Close();
+  // Continues reading at frame (decode order) of the index.
+  bool SeekTo(size_t frame);
+  // Serves the frames covered by block from memory; takes a reference.
+  void SetPrefetched(FrameMapping* block);
+  bool is_open() const { return file_ != NULL; }
+  // true if the next frame can be served with ReadMapped()
+  bool is_mapped() const;
+  // only valid while the reader is open
+  const FrameIndex& index() const { return *index_; }
+
+  // Returns the next frame in decode order, or NULL at the end of the segment.
+  const FrameRecord* Peek() const;
+  // Reads the payload of the frame returned by Peek() and advances.
+  bool Read(uint8_t* data);
+  // Advances past the frame returned by Peek() without reading it.
+  bool Skip();
+  // Returns a pointer into the mapping for the frame returned by Peek() and
+  // advances. *mapping receives a reference the caller must Unref().
+  const uint8_t* ReadMapped(FrameMapping** mapping);
+
+ private:
+  FrameReader(const FrameReader&);
+  FrameReader& operator=(const FrameReader&);
+
+  std::shared_ptr<const FrameIndex> index_;
+  std::shared_ptr<PayloadFile> file_;
+  FrameMapping* mapping_;
+  FrameMapping* prefetched_;
+  size_t next_frame_;
+};
+
+// "<dir>/raw_<audio|video>_frames_<counter>", without extension
+std::string SegmentPath(const std::string& dir, AVType type, int32_t counter);
+
+// Writes index and its payloads (read from payload_fd at the offsets in the
+// index) to a container at path. Record offsets are rewritten.
+bool WriteFrameFile(const std::string& path,
+                    const FrameIndex& index,
+                    int payload_fd);
+
+bool ReadFully(int fd, void* data, size_t size, uint64_t offset);
+
+#endif  // FRAMEFILE_H_
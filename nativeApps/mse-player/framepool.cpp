@@ -0,0 +1,150 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "framepool.h"
+
+#include <cstdio>
+
+namespace {
+
+const int kMinClassShift = 6;   // 64 bytes, smaller than any aac frame
+const int kMaxClassShift = 20;  // 1 MiB, larger than any I-frame we ship
+const int kNumClasses = kMaxClassShift - kMinClassShift + 1;
+const uint64_t kMaxCachedBytes =
+    8 * 1024 * 1024;  // memory kept on the free lists beyond this goes back to
+                      // the heap, so a burst of huge frames isn't pinned forever
+
+int SizeClass(size_t size) {
+  int shift = kMinClassShift;
+  while (shift <= kMaxClassShift && (static_cast<size_t>(1) << shift) < size)
+    shift++;
+  return shift <= kMaxClassShift ? shift - kMinClassShift : -1;
+}
+
+}  // namespace
+
+struct FramePool::Block {
+  FramePool* pool_;
+  Block* next_;
+  int32_t size_class_;  // -1 for oversized frames
+  uint32_t capacity_;
+  uint64_t padding_;  // keeps the payload 8 byte aligned on 32 bit targets
+
+  guint8* data() { return reinterpret_cast<guint8*>(this + 1); }
+};
+
+FramePool::FramePool(const std::string& name) : name_(name) {
+  g_mutex_init(&mutex_);
+  free_lists_ = g_new0(Block*, kNumClasses);
+}
+
+FramePool::~FramePool() {
+  for (int i = 0; i < kNumClasses; i++) {
+    while (free_lists_[i]) {
+      Block* block = free_lists_[i];
+      free_lists_[i] = block->next_;
+      g_free(block);
+    }
+  }
+  g_free(free_lists_);
+  g_mutex_clear(&mutex_);
+}
+
+guint8* FramePool::Alloc(size_t size, gpointer* owner, GDestroyNotify* release) {
+  int size_class = SizeClass(size);
+  Block* block = NULL;
+
+  g_mutex_lock(&mutex_);
+  if (size_class >= 0 && free_lists_[size_class]) {
+    block = free_lists_[size_class];
+    free_lists_[size_class] = block->next_;
+    stats_.cached_bytes_ -= block->capacity_;
+    stats_.reuses_++;
+  }
+
+  if (!block) {
+    size_t capacity = size_class >= 0
+                          ? static_cast<size_t>(1) << (size_class + kMinClassShift)
+                          : size;
+    block = static_cast<Block*>(g_malloc(sizeof(Block) + capacity));
+    block->pool_ = this;
+    block->size_class_ = size_class;
+    block->capacity_ = capacity;
+    stats_.allocations_++;
+    if (size_class < 0)
+      stats_.oversized_++;
+  }
+
+  block->next_ = NULL;
+  stats_.in_use_++;
+  stats_.in_use_bytes_ += block->capacity_;
+  if (stats_.in_use_ > stats_.high_water_)
+    stats_.high_water_ = stats_.in_use_;
+  if (stats_.in_use_bytes_ > stats_.high_water_bytes_)
+    stats_.high_water_bytes_ = stats_.in_use_bytes_;
+  g_mutex_unlock(&mutex_);
+
+  *owner = block;
+  *release = ReleaseStatic;
+  return block->data();
+}
+
+void FramePool::ReleaseStatic(gpointer block) {
+  Block* b = static_cast<Block*>(block);
+  b->pool_->Release(b);
+}
+
+void FramePool::Release(Block* block) {
+  g_mutex_lock(&mutex_);
+  stats_.in_use_--;
+  stats_.in_use_bytes_ -= block->capacity_;
+
+  bool cache = block->size_class_ >= 0 &&
+               stats_.cached_bytes_ + block->capacity_ <= kMaxCachedBytes;
+  if (cache) {
+    block->next_ = free_lists_[block->size_class_];
+    free_lists_[block->size_class_] = block;
+    stats_.cached_bytes_ += block->capacity_;
+  }
+  g_mutex_unlock(&mutex_);
+
+  if (!cache)
+    g_free(block);
+}
+
+FramePoolStats FramePool::stats() {
+  g_mutex_lock(&mutex_);
+  FramePoolStats stats = stats_;
+  g_mutex_unlock(&mutex_);
+  return stats;
+}
+
+void FramePool::PrintStats() {
+  FramePoolStats s = stats();
+  printf("%s frame pool: heap allocations:%llu reuses:%llu oversized:%llu "
+         "in use:%u high water:%u blocks/%llu KB cached:%llu KB\n",
+         name_.c_str(),
+         static_cast<unsigned long long>(s.allocations_),
+         static_cast<unsigned long long>(s.reuses_),
+         static_cast<unsigned long long>(s.oversized_),
+         s.in_use_,
+         s.high_water_,
+         static_cast<unsigned long long>(s.high_water_bytes_ / 1024),
+         static_cast<unsigned long long>(s.cached_bytes_ / 1024));
+}
@@ -0,0 +1,71 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#include <glib.h>
+#include <stdint.h>
+
+#include <string>
+
+struct FramePoolStats {
+  FramePoolStats() : allocations_(0), reuses_(0), oversized_(0), in_use_(0),
+                     in_use_bytes_(0), high_water_(0), high_water_bytes_(0),
+                     cached_bytes_(0) {}
+
+  uint64_t allocations_;  // blocks taken from the heap
+  uint64_t reuses_;       // blocks recycled from a free list
+  uint64_t oversized_;    // frames too large for any size class
+  uint32_t in_use_;
+  uint64_t in_use_bytes_;
+  uint32_t high_water_;
+  uint64_t high_water_bytes_;
+  uint64_t cached_bytes_;  // held on the free lists
+};
+
+// Size-class allocator recycling frame payload memory for one appsrc.
+// Payloads are released from gstreamer streaming threads through the
+// GDestroyNotify handed out with every block, so the pool is thread safe.
+// Once warmed up, steady-state playback takes no payload memory from the heap.
+class FramePool {
+ public:
+  explicit FramePool(const std::string& name);
+  ~FramePool();
+
+  // Returns size bytes of payload memory. *owner and *release must be passed
+  // to gst_buffer_new_wrapped_full() (or called directly) to give it back.
+  guint8* Alloc(size_t size, gpointer* owner, GDestroyNotify* release);
+
+  FramePoolStats stats();
+  void PrintStats();
+
+ private:
+  struct Block;
+
+  static void ReleaseStatic(gpointer block);
+  void Release(Block* block);
+
+  std::string name_;
+  GMutex mutex_;
+  Block** free_lists_;
+  FramePoolStats stats_;
+};
+
+#endif  // FRAMEPOOL_H_
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 class EventSource {
 public:
@@ -105,3 +106,87 @@ GSource* pipe_source_new(int pipefd[2], PipeSourceCallback cb, void* ctx)
 
   return source;
 }
+
+DispatchLatencyProbe::DispatchLatencyProbe()
+  : handle_(0), interval_ms_(0)
+{
+  Reset();
+}
+
+DispatchLatencyProbe::~DispatchLatencyProbe()
+{
+  Stop();
+}
+
+void DispatchLatencyProbe::Start(guint interval_ms)
+{
+  Stop();
+  interval_ms_ = interval_ms;
+  last_dispatch_us_ = g_get_monotonic_time();
+  handle_ = g_timeout_add(interval_ms, TickStatic, this);
+}
+
+void DispatchLatencyProbe::Stop()
+{
+  if (handle_)
+    g_source_remove(handle_);
+  handle_ = 0;
+}
+
+void DispatchLatencyProbe::Reset()
+{
+  samples_ = 0;
+  total_us_ = 0;
+  max_us_ = 0;
+  memset(histogram_, 0, sizeof(histogram_));
+}
+
+gboolean DispatchLatencyProbe::TickStatic(gpointer probe)
+{
+  static_cast<DispatchLatencyProbe*>(probe)->Tick();
+  return TRUE;
+}
+
+void DispatchLatencyProbe::Tick()
+{
+  // glib schedules the next expiration from the time of this dispatch
+  gint64 now_us = g_get_monotonic_time();
+  gint64 late_us = now_us - last_dispatch_us_ - interval_ms_ * 1000;
+  last_dispatch_us_ = now_us;
+  if (late_us < 0)
+    late_us = 0;
+
+  samples_++;
+  total_us_ += late_us;
+  if (late_us > max_us_)
+    max_us_ = late_us;
+
+  gint64 bucket = late_us / 1000;
+  histogram_[bucket < kHistogramSize ? bucket : kHistogramSize - 1]++;
+}
+
+void DispatchLatencyProbe::PrintStats(const char* label) const
+{
+  if (samples_ == 0)
+    return;
+
+  // upper bound of the bucket holding the 99th percentile
+  guint64 seen = 0;
+  int p99_ms = kHistogramSize;
+  for (int i = 0; i < kHistogramSize; i++) {
+    seen += histogram_[i];
+    if (seen * 100 >= samples_ * 99) {
+      p99_ms = i + 1;
+      break;
+    }
+  }
+
+  printf("%s main loop dispatch latency: avg:%.2f ms p99:<%d%s ms max:%.2f ms "
+         "(%llu samples)\n",
+         label,
+         total_us_ / 1000.0 / samples_,
+         p99_ms,
+         p99_ms >= kHistogramSize ? "+" : "",
+         max_us_ / 1000.0,
+         static_cast<unsigned long long>(samples_));
+}
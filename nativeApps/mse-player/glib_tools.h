@@ -47,4 +47,33 @@ typedef void (*PipeSourceCallback)(void* ctx);
 
 GSource* pipe_source_new(int pipefd[2], PipeSourceCallback cb, void* ctx);
 
+// Periodic timer on the default main context that records how late it gets
+// dispatched, i.e. how long everything else on the loop keeps it waiting.
+class DispatchLatencyProbe {
+public:
+  DispatchLatencyProbe();
+  ~DispatchLatencyProbe();
+
+  void Start(guint interval_ms);
+  void Stop();
+  bool running() const { return handle_ != 0; }
+  // Prints the lateness since the last Reset().
+  void PrintStats(const char* label) const;
+  void Reset();
+
+private:
+  static constexpr int kHistogramSize = 100;  // 1 ms buckets, last one open
+
+  static gboolean TickStatic(gpointer probe);
+  void Tick();
+
+  guint handle_;
+  guint interval_ms_;
+  gint64 last_dispatch_us_;
+  guint64 samples_;
+  gint64 total_us_;
+  gint64 max_us_;
+  guint64 histogram_[kHistogramSize];
+};
+
 #endif // GLIB_TOOLS_H
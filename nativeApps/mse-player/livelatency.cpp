@@ -0,0 +1,107 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "livelatency.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// pushes kept for matching; frames reach the sink well within this many
+// frames of their push, the older ones were flushed or dropped
+const size_t kMaxPendingPushes = 256;
+
+}  // namespace
+
+LiveLatencyMeter::LiveLatencyMeter() {
+  g_mutex_init(&mutex_);
+}
+
+LiveLatencyMeter::~LiveLatencyMeter() {
+  g_mutex_clear(&mutex_);
+}
+
+void LiveLatencyMeter::Reset() {
+  g_mutex_lock(&mutex_);
+  pushes_.clear();
+  total_ = LiveLatencyStats();
+  interval_ = LiveLatencyStats();
+  g_mutex_unlock(&mutex_);
+}
+
+void LiveLatencyMeter::RecordPush(int64_t pts_ns, int64_t push_us) {
+  g_mutex_lock(&mutex_);
+  if (pushes_.size() >= kMaxPendingPushes)
+    pushes_.pop_front();
+  pushes_.push_back(std::make_pair(pts_ns, push_us));
+  g_mutex_unlock(&mutex_);
+}
+
+void LiveLatencyMeter::RecordRender(int64_t pts_ns, int64_t render_us) {
+  g_mutex_lock(&mutex_);
+  // frames are pushed in decode order and rendered in presentation order,
+  // so the match is usually near but not at the front
+  std::deque<std::pair<int64_t, int64_t> >::iterator it = pushes_.begin();
+  while (it != pushes_.end() && it->first != pts_ns)
+    ++it;
+
+  if (it == pushes_.end()) {
+    total_.unmatched_++;
+    interval_.unmatched_++;
+  } else {
+    int64_t latency_us = std::max<int64_t>(render_us - it->second, 0);
+    pushes_.erase(it);
+    Add(&total_, latency_us);
+    Add(&interval_, latency_us);
+  }
+  g_mutex_unlock(&mutex_);
+}
+
+LiveLatencyStats LiveLatencyMeter::total() const {
+  g_mutex_lock(&mutex_);
+  LiveLatencyStats stats = total_;
+  g_mutex_unlock(&mutex_);
+  return stats;
+}
+
+void LiveLatencyMeter::PrintInterval(const char* prefix) {
+  g_mutex_lock(&mutex_);
+  LiveLatencyStats stats = interval_;
+  interval_ = LiveLatencyStats();
+  g_mutex_unlock(&mutex_);
+
+  if (stats.samples_ == 0)
+    return;
+  printf("%slive latency: avg %.1f ms, min %.1f ms, max %.1f ms over %llu "
+         "frames (%llu unmatched)\n",
+         prefix,
+         stats.total_us_ / 1000.0 / stats.samples_,
+         stats.min_us_ / 1000.0,
+         stats.max_us_ / 1000.0,
+         static_cast<unsigned long long>(stats.samples_),
+         static_cast<unsigned long long>(stats.unmatched_));
+}
+
+void LiveLatencyMeter::Add(LiveLatencyStats* stats, int64_t latency_us) {
+  stats->samples_++;
+  stats->total_us_ += latency_us;
+  stats->min_us_ = std::min(stats->min_us_, latency_us);
+  stats->max_us_ = std::max(stats->max_us_, latency_us);
+}
@@ -0,0 +1,71 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIVELATENCY_H_
+#define LIVELATENCY_H_
+
+#include <glib.h>
+#include <stdint.h>
+
+#include <deque>
+#include <utility>
+
+struct LiveLatencyStats {
+  LiveLatencyStats() : samples_(0), unmatched_(0), total_us_(0),
+                       min_us_(G_MAXINT64), max_us_(0) {}
+
+  uint64_t samples_;
+  uint64_t unmatched_;  // frames at the sink without a recorded push
+  int64_t total_us_;
+  int64_t min_us_;
+  int64_t max_us_;
+};
+
+// Glass-to-glass latency of the live feed of one track: the time from
+// pushing a frame into its appsrc to the sink rendering it. Pushes are
+// recorded by the feed, renders by the sink streaming thread.
+class LiveLatencyMeter {
+ public:
+  LiveLatencyMeter();
+  ~LiveLatencyMeter();
+  void Reset();
+
+  // buffer with pts_ns was pushed at monotonic time push_us
+  void RecordPush(int64_t pts_ns, int64_t push_us);
+  // buffer with pts_ns will be rendered at monotonic time render_us
+  void RecordRender(int64_t pts_ns, int64_t render_us);
+
+  LiveLatencyStats total() const;
+  // Prints the latency since the last call and starts a new interval.
+  void PrintInterval(const char* prefix);
+
+ private:
+  LiveLatencyMeter(const LiveLatencyMeter&);
+  LiveLatencyMeter& operator=(const LiveLatencyMeter&);
+
+  static void Add(LiveLatencyStats* stats, int64_t latency_us);
+
+  mutable GMutex mutex_;
+  // {pts_ns, push_us} in push order, i.e. decode order
+  std::deque<std::pair<int64_t, int64_t> > pushes_;
+  LiveLatencyStats total_;
+  LiveLatencyStats interval_;
+};
+
+#endif  // LIVELATENCY_H_
@@ -20,10 +20,14 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 #include <essos.h>
 
 #include <unistd.h>
+#include <getopt.h>
 #include <linux/input.h>
 #include <cstdio>
 #include <libgen.h>
@@ -35,23 +39,398 @@
 
 #include <glib/gstdio.h>
 #include "mediasourcepipeline.h"
+#include "prefetcher.h"
+#include "resourceusage.h"
 
 #include "wayland-client.h"
 
 
 #define UNUSED( x ) ((void)(x))
 
+const int kMaxInstances = 9;
+const int kDefaultDisplayWidth = 1280;
+const int kDefaultDisplayHeight = 720;
+
+enum Layout { kLayoutMosaic = 0, kLayoutPip };
+
 std::string files_path_;
+PipelineOptions options_;
+int instances_ = 1;
+Layout layout_ = kLayoutMosaic;
+int io_threads_ = 0;  // 0 = one per instance, up to 4
 int gPipefd[2];
 
+// the pipelines of the process; keys go to the focused one
+struct Instances {
+  Instances() : focused_(0), finished_(0), main_loop_(NULL) {}
+
+  std::vector<MediaSourcePipeline*> pipelines_;
+  std::vector<rtObjectRef> refs_;  // keep the pipelines alive until exit
+  size_t focused_;
+  size_t finished_;
+  GMainLoop* main_loop_;
+};
+
+// "LOW_KB,HIGH_KB[,HIGH_MS]"
+bool ParseWatermarks(const char* arg, FeedWatermarks* marks) {
+  unsigned long low_kb = 0, high_kb = 0, high_ms = 0;
+  int fields = sscanf(arg, "%lu,%lu,%lu", &low_kb, &high_kb, &high_ms);
+  if (fields < 2 || high_kb == 0 || low_kb >= high_kb) {
+    printf("Invalid watermarks '%s', expected LOW_KB,HIGH_KB[,HIGH_MS] with "
+           "LOW_KB < HIGH_KB\n", arg);
+    return false;
+  }
+
+  *marks = FeedWatermarks(low_kb * 1024, high_kb * 1024, fields > 2 ? high_ms : 0);
+  return true;
+}
+
+// "MS[,uniform|normal|pareto]"
+bool ParseJitter(const char* arg, NetworkProfile* profile) {
+  char distribution[16] = "uniform";
+  unsigned int jitter_ms = 0;
+  if (sscanf(arg, "%u,%15s", &jitter_ms, distribution) < 1) {
+    printf("Invalid jitter '%s'\n", arg);
+    return false;
+  }
+
+  if (strcmp(distribution, "uniform") == 0) {
+    profile->jitter_distribution_ = kJitterUniform;
+  } else if (strcmp(distribution, "normal") == 0) {
+    profile->jitter_distribution_ = kJitterNormal;
+  } else if (strcmp(distribution, "pareto") == 0) {
+    profile->jitter_distribution_ = kJitterPareto;
+  } else {
+    printf("Unknown jitter distribution '%s'\n", distribution);
+    return false;
+  }
+
+  profile->jitter_ms_ = jitter_ms;
+  return true;
+}
+
+// "RATE[,STALL_MS]"
+bool ParseLoss(const char* arg, NetworkProfile* profile) {
+  float rate = 0;
+  unsigned int stall_ms = profile->loss_stall_ms_;
+  if (sscanf(arg, "%f,%u", &rate, &stall_ms) < 1 || rate < 0 || rate >= 1) {
+    printf("Invalid loss '%s', expected RATE[,STALL_MS] with 0 <= RATE < 1\n",
+           arg);
+    return false;
+  }
+
+  profile->loss_rate_ = rate;
+  profile->loss_stall_ms_ = stall_ms;
+  return true;
+}
+
+// "LOW_MS,HIGH_MS"
+bool ParseAbrBuffer(const char* arg, AbrOptions* abr) {
+  unsigned int low_ms = 0, high_ms = 0;
+  if (sscanf(arg, "%u,%u", &low_ms, &high_ms) != 2 || low_ms >= high_ms) {
+    printf("Invalid ABR buffer '%s', expected LOW_MS,HIGH_MS with "
+           "LOW_MS < HIGH_MS\n", arg);
+    return false;
+  }
+
+  abr->low_buffer_ms_ = low_ms;
+  abr->high_buffer_ms_ = high_ms;
+  return true;
+}
+
+// Westeros rectangle of instance index out of count, on a width x height
+// display: an even grid for a mosaic, or instance 0 full screen with the
+// others as quarter size windows filling up from the bottom right for
+// picture-in-picture.
+std::string InstanceRectangle(Layout layout, int index, int count,
+                              int width, int height) {
+  int x, y, w, h;
+  if (layout == kLayoutPip) {
+    if (index == 0) {
+      x = y = 0;
+      w = width;
+      h = height;
+    } else {
+      w = width / 4;
+      h = height / 4;
+      x = width - ((index - 1) % 4 + 1) * w;
+      y = height - ((index - 1) / 4 + 1) * h;
+    }
+  } else {
+    int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    int rows = (count + columns - 1) / columns;
+    w = width / columns;
+    h = height / rows;
+    x = (index % columns) * w;
+    y = (index / columns) * h;
+  }
+
+  char rectangle[64];
+  snprintf(rectangle, sizeof(rectangle), "%d,%d,%d,%d", x, y, w, h);
+  return rectangle;
+}
+
+void PrintUsage(const char* name) {
+  printf("Usage: %s [options] [directory]\n"
+         "  --mmap                 map segment files and push frames without copying them\n"
+         "  --no-frame-pool        allocate every frame payload from the heap\n"
+         "  --batch-ms=MS          push up to MS of media per wake-up as one buffer list\n"
+         "  --batch-bytes=BYTES    push up to BYTES of payload per wake-up as one buffer list\n"
+         "  --prefetch-at=FRACTION read the next segment ahead once this fraction of the\n"
+         "                         current one has played (default 0.5)\n"
+         "  --prefetch-secs=SECS   seconds of the next segment to read ahead, 0 disables\n"
+         "                         read-ahead (default 2)\n"
+         "  --demand-feed          fill each appsrc to its high watermark on need-data\n"
+         "                         instead of pushing on a fixed timer\n"
+         "  --video-watermarks=LOW_KB,HIGH_KB[,HIGH_MS]\n"
+         "                         video appsrc fill levels (default 64,256)\n"
+         "  --audio-watermarks=LOW_KB,HIGH_KB[,HIGH_MS]\n"
+         "                         audio appsrc fill levels (default 16,64)\n"
+         "  --feeder-threads       read and push each track on its own thread\n"
+         "  --dispatch-latency     report main loop dispatch latency every second\n"
+         "  --gapless              append segments back to back on one timeline\n"
+         "                         instead of flushing between them\n"
+         "  --fast-start           link the sources on source setup and push the first\n"
+         "                         GOP before playing instead of linking from the\n"
+         "                         main loop\n"
+         "  --suspend-tier=TIER    what suspend gives up: light keeps the pipeline in\n"
+         "                         READY, deep tears it down (default deep)\n"
+         "  --stats-interval=MS    emit the onStats rtRemote event every MS\n"
+         "  --live[=LATENCY_MS]    live appsrcs reporting LATENCY_MS (default 100) with\n"
+         "                         watermark sized queues, no playbin buffering, and\n"
+         "                         frames pushed as the pipeline clock reaches them;\n"
+         "                         prints the push to render latency every second\n"
+         "Multiple pipelines:\n"
+         "  --instances=N          play N (1-%d) pipelines in this process on one main\n"
+         "                         loop, registered as <name>, <name>_1, <name>_2...\n"
+         "  --layout=LAYOUT        mosaic tiles the screen, pip shows the first\n"
+         "                         pipeline full screen and the others as windows\n"
+         "                         (default mosaic)\n"
+         "  --io-threads=N         I/O workers shared by all pipelines (default one\n"
+         "                         per pipeline, up to 4)\n"
+         "Benchmarking:\n"
+         "  --headless             feed appsrc straight into fakesinks, no display,\n"
+         "                         no keyboard and no hardware decoder; unless --sync,\n"
+         "                         the feed runs on demand so the sinks set the pace\n"
+         "  --sync                 let the headless sinks sync to the clock instead\n"
+         "                         of consuming as fast as possible\n"
+         "  --software-decode      decode with decodebin before the headless sinks\n"
+         "  --loops=N              stop after playing the content N times and print\n"
+         "                         throughput and resource usage\n"
+         "Network emulation, off unless one of these is given:\n"
+         "  --net-bandwidth=KBPS   token bucket rate of the emulated link\n"
+         "  --net-burst=KB         token bucket depth (default 64)\n"
+         "  --net-trace=FILE       replay \"<duration_ms> <kbps>\" lines in a loop\n"
+         "                         instead of a fixed bandwidth\n"
+         "  --net-rtt=MS           round trip time paid by every request\n"
+         "  --net-jitter=MS[,uniform|normal|pareto]\n"
+         "                         mean extra request delay and its distribution\n"
+         "  --net-loss=RATE[,STALL_MS]\n"
+         "                         chance of a packet burst loss per request, each\n"
+         "                         costing a backed off stall (default 200 ms)\n"
+         "  --net-request-kb=KB    request size, 0 = one request per segment\n"
+         "  --net-seed=N           random seed for jitter and loss (default 1)\n"
+         "Adaptive bitrate, when the directory holds <kbps>/ rendition directories:\n"
+         "  --abr-safety=FRACTION  share of the estimated bandwidth a rendition may\n"
+         "                         use (default 0.8)\n"
+         "  --abr-buffer=LOW_MS,HIGH_MS\n"
+         "                         no up-switch below LOW_MS of buffer, no down-switch\n"
+         "                         above HIGH_MS (default 8000,20000, gapless only)\n"
+         "  --abr-fixed=KBPS       play the rendition closest to KBPS throughout\n",
+         name,
+         kMaxInstances);
+}
+
 bool ParseCommandLine(int argc, char** argv) {
-  if (argc > 2) {
+  static const struct option kOptions[] = {
+    { "mmap", no_argument, NULL, 'm' },
+    { "no-frame-pool", no_argument, NULL, 'F' },
+    { "batch-ms", required_argument, NULL, 'B' },
+    { "batch-bytes", required_argument, NULL, 'Y' },
+    { "prefetch-at", required_argument, NULL, 'P' },
+    { "prefetch-secs", required_argument, NULL, 'S' },
+    { "demand-feed", no_argument, NULL, 'D' },
+    { "video-watermarks", required_argument, NULL, 'V' },
+    { "audio-watermarks", required_argument, NULL, 'A' },
+    { "feeder-threads", no_argument, NULL, 'T' },
+    { "dispatch-latency", no_argument, NULL, 'L' },
+    { "gapless", no_argument, NULL, 'G' },
+    { "fast-start", no_argument, NULL, 'Q' },
+    { "suspend-tier", required_argument, NULL, 'R' },
+    { "stats-interval", required_argument, NULL, 'I' },
+    { "live", optional_argument, NULL, 'v' },
+    { "instances", required_argument, NULL, 'i' },
+    { "layout", required_argument, NULL, 'y' },
+    { "io-threads", required_argument, NULL, 'o' },
+    { "headless", no_argument, NULL, 'H' },
+    { "sync", no_argument, NULL, 'c' },
+    { "software-decode", no_argument, NULL, 'd' },
+    { "loops", required_argument, NULL, 'n' },
+    { "net-bandwidth", required_argument, NULL, 'b' },
+    { "net-burst", required_argument, NULL, 'u' },
+    { "net-trace", required_argument, NULL, 't' },
+    { "net-rtt", required_argument, NULL, 'r' },
+    { "net-jitter", required_argument, NULL, 'j' },
+    { "net-loss", required_argument, NULL, 'l' },
+    { "net-request-kb", required_argument, NULL, 'q' },
+    { "net-seed", required_argument, NULL, 's' },
+    { "abr-safety", required_argument, NULL, 'a' },
+    { "abr-buffer", required_argument, NULL, 'f' },
+    { "abr-fixed", required_argument, NULL, 'x' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", kOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'm':
+        options_.use_mmap_ = true;
+        break;
+      case 'F':
+        options_.use_frame_pool_ = false;
+        break;
+      case 'B':
+        options_.batch_ms_ = atoi(optarg);
+        break;
+      case 'Y':
+        options_.batch_bytes_ = atoi(optarg);
+        break;
+      case 'P':
+        options_.prefetch_at_ = atof(optarg);
+        break;
+      case 'S':
+        options_.prefetch_secs_ = atof(optarg);
+        break;
+      case 'D':
+        options_.demand_feed_ = true;
+        break;
+      case 'V':
+        if (!ParseWatermarks(optarg, &options_.watermarks_[kVideo]))
+          return false;
+        break;
+      case 'A':
+        if (!ParseWatermarks(optarg, &options_.watermarks_[kAudio]))
+          return false;
+        break;
+      case 'T':
+        options_.feeder_threads_ = true;
+        break;
+      case 'L':
+        options_.measure_dispatch_latency_ = true;
+        break;
+      case 'G':
+        options_.gapless_ = true;
+        break;
+      case 'Q':
+        options_.fast_start_ = true;
+        break;
+      case 'R':
+        if (!ParseSuspendTier(optarg, &options_.suspend_tier_)) {
+          printf("Unknown suspend tier '%s', expected light or deep\n", optarg);
+          return false;
+        }
+        break;
+      case 'I':
+        options_.stats_interval_ms_ = atoi(optarg);
+        break;
+      case 'v':
+        options_.live_ = true;
+        if (optarg) {
+          options_.live_latency_ms_ = atoi(optarg);
+          if (options_.live_latency_ms_ <= 0) {
+            printf("Invalid live latency '%s'\n", optarg);
+            return false;
+          }
+        }
+        break;
+      case 'i':
+        instances_ = atoi(optarg);
+        if (instances_ < 1 || instances_ > kMaxInstances) {
+          printf("Invalid instance count '%s', expected 1-%d\n", optarg,
+                 kMaxInstances);
+          return false;
+        }
+        break;
+      case 'y':
+        if (strcmp(optarg, "mosaic") == 0) {
+          layout_ = kLayoutMosaic;
+        } else if (strcmp(optarg, "pip") == 0) {
+          layout_ = kLayoutPip;
+        } else {
+          printf("Unknown layout '%s', expected mosaic or pip\n", optarg);
+          return false;
+        }
+        break;
+      case 'o':
+        io_threads_ = atoi(optarg);
+        break;
+      case 'H':
+        options_.headless_ = true;
+        break;
+      case 'c':
+        options_.headless_sync_ = true;
+        break;
+      case 'd':
+        options_.software_decode_ = true;
+        break;
+      case 'n':
+        options_.loops_ = atoi(optarg);
+        break;
+      case 'b':
+        options_.network_.bandwidth_kbps_ = strtoul(optarg, NULL, 10);
+        break;
+      case 'u':
+        options_.network_.burst_kb_ = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        options_.network_.trace_path_ = optarg;
+        break;
+      case 'r':
+        options_.network_.rtt_ms_ = strtoul(optarg, NULL, 10);
+        break;
+      case 'j':
+        if (!ParseJitter(optarg, &options_.network_))
+          return false;
+        break;
+      case 'l':
+        if (!ParseLoss(optarg, &options_.network_))
+          return false;
+        break;
+      case 'q':
+        options_.network_.request_kb_ = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        options_.network_.seed_ = strtoul(optarg, NULL, 10);
+        break;
+      case 'a':
+        options_.abr_.safety_factor_ = atof(optarg);
+        if (options_.abr_.safety_factor_ <= 0) {
+          printf("Invalid ABR safety factor '%s'\n", optarg);
+          return false;
+        }
+        break;
+      case 'f':
+        if (!ParseAbrBuffer(optarg, &options_.abr_))
+          return false;
+        break;
+      case 'x':
+        options_.abr_.fixed_kbps_ = strtoul(optarg, NULL, 10);
+        break;
+      case 'h':
+      default:
+        PrintUsage(argv[0]);
+        return false;
+    }
+  }
+
+  if (argc - optind > 1) {
     printf(
         "Please specify a directory containing raw frame files for media "
         "source playback!\n");
     return false;
-  } else if (argc == 2) {
-    files_path_ = argv[1];
+  } else if (argc - optind == 1) {
+    files_path_ = argv[optind];
   }
 
   return true;
@@ -59,8 +438,14 @@ bool ParseCommandLine(int argc, char** argv) {
 
 static void keyPressed( void* data, unsigned int key )
 {
-  MediaSourcePipeline* pi = (MediaSourcePipeline*) data;
-  pi->HandleKeyboardInput(key); 
+  Instances* instances = (Instances*) data;
+  // tab moves the focus on to the next pipeline
+  if (key == KEY_TAB) {
+    instances->focused_ = (instances->focused_ + 1) % instances->pipelines_.size();
+    printf("Keys go to pipeline %zu\n", instances->focused_);
+    return;
+  }
+  instances->pipelines_[instances->focused_]->HandleKeyboardInput(key);
 }
 
 static void keyReleased( void *, unsigned int )
@@ -94,12 +479,14 @@ void rtRemoteCallback(void*)
     fprintf(stderr,"can't write to pipe");
 }
 
-bool initRt(GMainLoop* main_loop, GSource* source, rtObjectRef pipeline)
+bool initRt(GMainLoop* main_loop, const Instances& instances)
 {
   rtError rc;
-  // Use pipe mechanism to process rt events efficiently
-  source = pipe_source_new(gPipefd, rtMainLoopCb, nullptr);
+  // Use pipe mechanism to process rt events efficiently, the context keeps
+  // the source
+  GSource* source = pipe_source_new(gPipefd, rtMainLoopCb, nullptr);
   g_source_attach(source, g_main_loop_get_context(main_loop));
+  g_source_unref(source);
 
   rtRemoteRegisterQueueReadyHandler( rtEnvironmentGetGlobal(), rtRemoteCallback, nullptr );
 
@@ -108,9 +495,15 @@ bool initRt(GMainLoop* main_loop, GSource* source, rtObjectRef pipeline)
 
   const char* objectName = getenv("PX_WAYLAND_CLIENT_REMOTE_OBJECT_NAME");
   if (!objectName) objectName = "MEDIASOURCE_PIPELINE_RT";
-  printf("Register RT object: %s\n", objectName);
-
-  rc = rtRemoteRegisterObject(objectName, pipeline);
+  for (size_t i = 0; i < instances.pipelines_.size() && rc == RT_OK; i++) {
+    std::string name = objectName;
+    if (i > 0)
+      name += "_" + std::to_string(i);
+    printf("Register RT object: %s\n", name.c_str());
+
+    rtObjectRef pipeline = instances.pipelines_[i];
+    rc = rtRemoteRegisterObject(name.c_str(), pipeline);
+  }
 
   return (rc == RT_OK);
 }
@@ -132,6 +525,15 @@ gboolean essosIteration(gint fd,GIOCondition condition,gpointer user_data)
   return TRUE;
 }
 
+static gboolean quitMainLoop(gpointer data)
+{
+  // runs once per pipeline, the loop ends with the last one
+  Instances* instances = static_cast<Instances*>(data);
+  if (++instances->finished_ == instances->pipelines_.size())
+    g_main_loop_quit(instances->main_loop_);
+  return FALSE;
+}
+
 gboolean runEssosEventLoop(EssCtx* ctx)
 {
   EssContextRunEventLoopOnce( ctx );
@@ -140,10 +542,8 @@ gboolean runEssosEventLoop(EssCtx* ctx)
 
 int main(int argc, char** argv) {
 
-  // Use Essos to simplify connecting to a wayland display and getting keyboard input from wayland
-  EssCtx* ctx = EssContextCreate();
+  EssCtx* ctx = NULL;
   GMainLoop* g_main_loop = NULL;
-  GSource* source = NULL;
 
   if (!ParseCommandLine(argc, argv)) {
     fprintf(stderr, "Failed to parse command line\n");
@@ -152,8 +552,12 @@ int main(int argc, char** argv) {
 
   gst_init(&argc, &argv);
 
+  // Use Essos to simplify connecting to a wayland display and getting keyboard input from wayland
+  if (!options_.headless_)
+    ctx = EssContextCreate();
+
   //Tell Essos to use wayland so it connects to a wayland display
-  if ( !EssContextSetUseWayland( ctx, true ) )
+  if ( ctx && !EssContextSetUseWayland( ctx, true ) )
   {
     printf("Failed to connect to wayland display, exiting...\n");
     exit(1);
@@ -180,20 +584,45 @@ int main(int argc, char** argv) {
     printf("Using path:%s\n",files_path_.c_str());
   }
 
-  MediaSourcePipeline* pi = new MediaSourcePipeline(files_path_);
-  //rtObjectRef piRef = pi;
+  // prefetches of all pipelines share one worker pool
+  if (io_threads_ <= 0)
+    io_threads_ = std::min(instances_, 4);
+  SegmentPrefetcher::SetWorkerThreads(io_threads_);
+
+  int display_width = kDefaultDisplayWidth;
+  int display_height = kDefaultDisplayHeight;
+  if (ctx && instances_ > 1 &&
+      !EssContextGetDisplaySize(ctx, &display_width, &display_height)) {
+    display_width = kDefaultDisplayWidth;
+    display_height = kDefaultDisplayHeight;
+  }
 
-  if (!pi->Start()) {
-    fprintf(stderr, "Failed to start pipeline!\n");
-    return 1;
+  Instances instances;
+  for (int i = 0; i < instances_; i++) {
+    PipelineOptions options = options_;
+    if (instances_ > 1) {
+      options.name_ = std::to_string(i);
+      if (!options.headless_)
+        options.video_rectangle_ = InstanceRectangle(
+            layout_, i, instances_, display_width, display_height);
+    }
+
+    MediaSourcePipeline* pi = new MediaSourcePipeline(files_path_, options);
+    if (!pi->Start()) {
+      fprintf(stderr, "Failed to start pipeline %d!\n", i);
+      return 1;
+    }
+    instances.pipelines_.push_back(pi);
+    instances.refs_.push_back(pi);
   }
+  ResourceUsage start_usage = ResourceUsage::Sample();
 
-  if ( !EssContextSetKeyListener( ctx, pi, &keyListener ) )
+  if ( ctx && !EssContextSetKeyListener( ctx, &instances, &keyListener ) )
   {
     printf("Failed to connect to essos key listener\n");
   }
 
-  if ( !EssContextStart( ctx ) )
+  if ( ctx && !EssContextStart( ctx ) )
   {
     printf("Failed to start essos context\n");
     return 1;
@@ -201,11 +630,16 @@ int main(int argc, char** argv) {
 
   // Create a GLib Main Loop and set it to run
   g_main_loop = g_main_loop_new(NULL, FALSE);
+  instances.main_loop_ = g_main_loop;
+  for (size_t i = 0; i < instances.pipelines_.size(); i++)
+    instances.pipelines_[i]->SetFinishedCallback(quitMainLoop, &instances);
 
-  if(!initRt(g_main_loop,source,pi))
+  if(!initRt(g_main_loop,instances))
   {
     fprintf(stderr, "Failed to init rt!\n");
-    return 1;
+    // a benchmark run doesn't need to be remote controlled
+    if (!options_.headless_)
+      return 1;
   }
 
   // use the display fd to know when to process, so we don't waste cpu cycles
@@ -217,18 +651,44 @@ int main(int argc, char** argv) {
   */
   
   // works on pi and comcast devices but not as cpu effiecient
-  g_idle_add ((GSourceFunc) runEssosEventLoop, ctx);
+  if (ctx)
+    g_idle_add ((GSourceFunc) runEssosEventLoop, ctx);
 
   g_main_loop_run(g_main_loop);
 
+  // process wide cost of all pipelines, for scaling with the instance count
+  if (instances_ > 1) {
+    ResourceUsage end_usage = ResourceUsage::Sample();
+    double secs = (end_usage.wall_us_ - start_usage.wall_us_) / 1000000.0;
+    double cpu_secs = (end_usage.user_us_ - start_usage.user_us_ +
+                       end_usage.system_us_ - start_usage.system_us_) / 1000000.0;
+    if (secs > 0)
+      printf("%d instances: %.1f s, cpu %.2f s (%.0f%%), heap %+.1f MB, "
+             "max rss %.1f MB\n",
+             instances_,
+             secs,
+             cpu_secs,
+             cpu_secs * 100.0 / secs,
+             (static_cast<double>(end_usage.heap_bytes_) - start_usage.heap_bytes_) /
+                 (1024.0 * 1024.0),
+             end_usage.max_rss_kb_ / 1024.0);
+  }
+
+  // take every pipeline down while gstreamer is still around: feeder
+  // threads joined, teardowns finished and their summaries printed
+  for (size_t i = 0; i < instances.pipelines_.size(); i++)
+    instances.pipelines_[i]->Stop();
+
   /* Free resources */
   g_main_loop_unref(g_main_loop);
 
   rtRemoteShutdown();
+  instances.pipelines_.clear();
+  instances.refs_.clear();
   gst_deinit();
-  g_source_unref(source);
 
-  EssContextDestroy( ctx );
+  if (ctx)
+    EssContextDestroy( ctx );
 
   return 0;
 }
@@ -20,6 +20,8 @@
 #include "mediasourcepipeline.h"
 #include "GstMSESrc.h"
 
+#include <gst/base/gstbasesink.h>
+
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <linux/input.h>
@@ -34,29 +36,71 @@
 rtDefineObject (MediaSourcePipeline, rtObject);
 rtDefineMethod (MediaSourcePipeline, suspend);
 rtDefineMethod (MediaSourcePipeline, resume);
+rtDefineMethod (MediaSourcePipeline, seek);
+rtDefineMethod (MediaSourcePipeline, suspendTier);
+rtDefineProperty (MediaSourcePipeline, startupTimes);
+rtDefineProperty (MediaSourcePipeline, videoStats);
+rtDefineProperty (MediaSourcePipeline, audioStats);
+rtDefineProperty (MediaSourcePipeline, seekStats);
+rtDefineProperty (MediaSourcePipeline, statsInterval);
+rtDefineProperty (MediaSourcePipeline, qosStats);
+rtDefineProperty (MediaSourcePipeline, liveStats);
 
 namespace {
 const int kVideoReadDelayMs =
-    25;  // add some artificial network latency to video frame reads
+    25;  // video frame read interval when the network is not emulated
 const int kAudioReadDelayMs =
-    10;  // add some artificial network latency to audio frame reads
+    10;  // audio frame read interval when the network is not emulated
 const int kStatusDelayMs =
-    50;  // update interval for checking status, like playback position
-const float kSeekEndDeltaSecs =
-    0.0f;  // delta time from end of current playback file to trigger a seek
+    1000;  // update interval of the playback position and stats, segment
+           // ends are detected by a probe on the sink
 const int kChunkDemuxerSeekDelayMs =
     50;  // simulated chunk demuxer seek latency before a seek is completed
-const int kPlaybackPositionHistorySize =
-    10;  // size of history for collecting playback position to determine
-        // end of a raw frame file playback
 const int64_t kPlaybackPositionUpdateIntervalMs =
     1000;  // Update interval in milliseconds
            // of when playback position is outputted to stdout
+const guint kInitialBatchSize =
+    32;  // initial capacity of a batched feed buffer list
+const guint kDispatchProbeIntervalMs =
+    10;  // period of the main loop dispatch latency probe
+const int64_t kKeySeekStepUs =
+    10000000;  // how far KEY_LEFT/KEY_RIGHT seek back and forward
+const int64_t kFastStartMaxGopUs =
+    5000000;  // fast start stops pushing video here if no keyframe shows up
+const int64_t kFastStartAudioUs =
+    1000000;  // audio pushed up front by fast start when there is no video
+const int64_t kLivePollUs =
+    10000;  // how often a live feed checks for the pipeline clock to run
+const int64_t kSegmentEndStallUs =
+    3000000;  // a fed segment ends if playback stops moving for this long
+const size_t kRememberedRenditions =
+    4;  // segments whose rendition choice the lagging track can look up
+
+// printed and used as rtRemote keys, indexed by StartupMilestone
+const char* const kStartupNames[kStartupMilestones] = {
+    "build", "sourceSetup", "padLink", "firstPush",
+    "preroll", "playing", "firstFrame"};
 
 }  // namespace
 
 // #define DEBUG_PRINTS // define to get more verbose printing
 
+bool ParseSuspendTier(const std::string& name, SuspendTier* tier)
+{
+  if (name == "light")
+    *tier = kSuspendLight;
+  else if (name == "deep")
+    *tier = kSuspendDeep;
+  else
+    return false;
+  return true;
+}
+
+const char* SuspendTierName(SuspendTier tier)
+{
+  return tier == kSuspendLight ? "light" : "deep";
+}
+
 unsigned getGstPlayFlag(const char* nick)
 {
   static GFlagsClass* flagsClass = static_cast<GFlagsClass*>(g_type_class_ref(g_type_from_name("GstPlayFlags")));
@@ -77,11 +121,15 @@ static gboolean MessageCallbackStatic(GstBus*,
 static void StartFeedStatic(GstAppSrc* appsrc,
                             guint size,
                             MediaSourcePipeline* msp) {
-  msp->StartFeedingAppSource(appsrc);
+  msp->OnAppSourceSignal(appsrc, true);
+  msp->StartFeedingAppSource(appsrc, size);
 }
 
 static void StopFeedStatic(GstAppSrc* appsrc, MediaSourcePipeline* msp) {
-  msp->StopFeedingAppSource(appsrc);
+  msp->OnAppSourceSignal(appsrc, false);
+  // a feeder thread simply blocks in the push once the appsrc is full
+  if (!msp->UsesFeederThreads())
+    msp->StopFeedingAppSource(appsrc);
 }
 
 static gboolean SeekDataStatic(GstAppSrc* appsrc,
@@ -111,6 +159,22 @@ static gboolean readAudioFrameStatic(MediaSourcePipeline* msp) {
   return msp->ReadAudioFrame();
 }
 
+static gboolean fillVideoStatic(MediaSourcePipeline* msp) {
+  return msp->FillAppSource(kVideo);
+}
+
+static gboolean fillAudioStatic(MediaSourcePipeline* msp) {
+  return msp->FillAppSource(kAudio);
+}
+
+static gboolean feedEmulatedVideoStatic(MediaSourcePipeline* msp) {
+  return msp->FeedEmulated(kVideo);
+}
+
+static gboolean feedEmulatedAudioStatic(MediaSourcePipeline* msp) {
+  return msp->FeedEmulated(kAudio);
+}
+
 static gboolean StatusPollStatic(MediaSourcePipeline* msp) {
   return msp->StatusPoll();
 }
@@ -119,6 +183,99 @@ static gboolean ChunkDemuxerSeekStatic(MediaSourcePipeline* msp) {
   return msp->ChunkDemuxerSeek();
 }
 
+static gboolean EmitStatsStatic(MediaSourcePipeline* msp) {
+  return msp->EmitStats();
+}
+
+static gpointer FeederThreadStatic(gpointer feeder) {
+  MediaSourcePipeline::Feeder* f = static_cast<MediaSourcePipeline::Feeder*>(feeder);
+  f->pipeline_->RunFeeder(f->type_);
+  return NULL;
+}
+
+static gboolean EndSegmentSwitchStatic(MediaSourcePipeline* msp) {
+  msp->EndSegmentSwitch();
+  return FALSE;
+}
+
+struct AppSourceSeek {
+  MediaSourcePipeline* pipeline_;
+  GstAppSrc* appsrc_;
+  guint64 position_;
+};
+
+static gboolean AppSourceSeekStatic(AppSourceSeek* seek) {
+  seek->pipeline_->RepositionAppSource(seek->appsrc_, seek->position_);
+  delete seek;
+  return FALSE;
+}
+
+static GstPadProbeReturn FirstFrameAfterSeekStatic(GstPad* pad,
+                                                   GstPadProbeInfo* info,
+                                                   MediaSourcePipeline* msp) {
+  msp->OnFirstFrameAfterSeek();
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static GstPadProbeReturn LiveFrameAtSinkStatic(GstPad* pad,
+                                               GstPadProbeInfo* info,
+                                               MediaSourcePipeline* msp) {
+  msp->OnLiveFrameAtSink(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn SegmentEndProbeStatic(GstPad* pad,
+                                               GstPadProbeInfo* info,
+                                               MediaSourcePipeline* msp) {
+  msp->OnSegmentEndProbe(info);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean SegmentEndStatic(MediaSourcePipeline* msp) {
+  return msp->OnSegmentEnd();
+}
+
+static gboolean FinishLinkingStatic(MediaSourcePipeline* msp) {
+  msp->finishPipelineLinkingAndStartPlaybackIfNeeded();
+  return FALSE;
+}
+
+static GstPadProbeReturn FirstFrameAtSinkStatic(GstPad* pad,
+                                                GstPadProbeInfo* info,
+                                                MediaSourcePipeline* msp) {
+  msp->OnFirstFrameAtSink();
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static gboolean ReportStartupStatic(MediaSourcePipeline* msp) {
+  msp->ReportStartup();
+  return FALSE;
+}
+
+static gpointer TeardownThreadStatic(gpointer msp) {
+  static_cast<MediaSourcePipeline*>(msp)->RunTeardown(true);
+  return NULL;
+}
+
+static gboolean TeardownDoneStatic(MediaSourcePipeline* msp) {
+  return msp->OnTeardownDone();
+}
+
+static void FrameMappingUnrefStatic(gpointer mapping) {
+  static_cast<FrameMapping*>(mapping)->Unref();
+}
+
+static void ReleaseFrame(const AVFrame& frame) {
+  if (frame.release_)
+    frame.release_(frame.owner_);
+  else
+    g_free(frame.data_);
+}
+
+static uint64_t LoadCounter(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
 static void sourceChangedCallback(GstElement* element, GstElement* source, gpointer data)
 {
   MediaSourcePipeline* msp = (MediaSourcePipeline*) data;
@@ -127,10 +284,41 @@ static void sourceChangedCallback(GstElement* element, GstElement* source, gpoin
 
 void MediaSourcePipeline::sourceChanged()
 {
-  if (!source_)
-    g_object_get(pipeline_, "source", &source_, NULL);
+  // uridecodebin drops its source on the way to READY and makes a new one on
+  // the way back, e.g. around a light suspend
+  GstElement* source = NULL;
+  g_object_get(pipeline_, "source", &source, NULL);
+  if (source == source_) {
+    if (source)
+      gst_object_unref(source);
+  } else {
+    if (source_) {
+      ReleaseAppSources(source_);
+      gst_object_unref(source_);
+    }
+    source_ = source;
+  }
 
   printf("sourceChanged!:%p\n",source_);
+  MarkStartup(kStartupSourceSetup);
+
+  if (options_.fast_start_) {
+    // source-setup comes before the msesrc changes state, so the appsrcs can
+    // go in now and the pipeline, already heading for PLAYING, prerolls on
+    // the first GOP
+    if (LinkSources()) {
+      printf("Fast start: linked pipeline on source setup\n");
+      // an emulated network decides when frames arrive, leave it to the feed
+      if (!network_.enabled())
+        PushFirstGop();
+      WatchForSegmentEnd();
+    }
+    return;
+  }
+
+  // source-setup is emitted during a state change, link up from the main
+  // loop rather than waiting for the next status poll
+  g_idle_add(reinterpret_cast<GSourceFunc>(FinishLinkingStatic), this);
 }
 
 gboolean MediaSourcePipeline::HandleMessage(GstMessage* message) {
@@ -150,6 +338,15 @@ gboolean MediaSourcePipeline::HandleMessage(GstMessage* message) {
       g_error_free(error);
       g_free(debug);
       break;
+    case GST_MESSAGE_QOS:
+      qos_.HandleQos(message);
+      break;
+    case GST_MESSAGE_LATENCY:
+      qos_.HandleLatency(pipeline_);
+      break;
+    case GST_MESSAGE_BUFFERING:
+      qos_.HandleBuffering(message);
+      break;
     case GST_MESSAGE_EOS: {
 
       printf("Gstreamer EOS message received\n");
@@ -180,9 +377,11 @@ gboolean MediaSourcePipeline::HandleMessage(GstMessage* message) {
       } else if (oldstate == GST_STATE_READY && newstate == GST_STATE_PAUSED) {
         GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(pipeline_), GST_DEBUG_GRAPH_SHOW_ALL, "paused-pipeline");
         printf("Ready to Paused finished!\n");
+        MarkStartup(kStartupPreroll);
       } else if (oldstate == GST_STATE_PAUSED && newstate == GST_STATE_PAUSED) {
       } else if (oldstate == GST_STATE_PAUSED && newstate == GST_STATE_PLAYING) {
         printf("Pipeline is now in play state!\n");
+        MarkStartup(kStartupPlaying);
         GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(pipeline_), GST_DEBUG_GRAPH_SHOW_ALL, "playing-pipeline");
       } else if (oldstate == GST_STATE_PLAYING && newstate == GST_STATE_PAUSED) {
          printf("Pipline finished from play to pause\n");
@@ -197,238 +396,779 @@ gboolean MediaSourcePipeline::HandleMessage(GstMessage* message) {
 }
 
 bool MediaSourcePipeline::ShouldPerformSeek() {
-  float seek_delta_secs =
-      std::fabs(playback_position_secs_ - current_end_time_secs_);
-
-  if (seek_delta_secs < kSeekEndDeltaSecs || playback_position_secs_ >= current_end_time_secs_)
-    return true;
-
-  // Since it's possible that the playback position won't reach the time
-  // reported by the last possible frame timestamp, we will assume that we are
-  // done with a frame file if we are playing and the playback position stays
-  // the same for kPlaybackPositionHistorySize
-  if (is_playing_ && IsPlaybackStalled())
-    return true;
+  if (end_probe_pad_ == NULL)
+    return playback_position_secs_ >= current_end_time_secs_;
+
+  // the probe may never see the end, e.g. when an element between the
+  // appsrc and the sink drops the EOS. Once the position track is fully fed
+  // and playback stops moving, the segment is over
+  int64_t now_us = g_get_monotonic_time();
+  if (!is_playing_ || !track_ended_[SegmentEndTrack()] ||
+      stall_start_us_ == 0 || playback_position_us_ != stall_position_us_) {
+    stall_position_us_ = playback_position_us_;
+    stall_start_us_ = now_us;
+    return false;
+  }
+  if (now_us - stall_start_us_ < kSegmentEndStallUs)
+    return false;
 
-  return false;
+  printf("Segment %d stalled at %f secs, ending it\n", current_file_counter_,
+         playback_position_secs_);
+  return true;
 }
 
 bool MediaSourcePipeline::IsPlaybackOver() {
   // playback is over when there are no more files to play
+  return catalog_.segment(current_file_counter_ + 1) == NULL;
+}
 
-  std::ostringstream counter_stream;
-  counter_stream << (current_file_counter_ + 1);
+bool MediaSourcePipeline::LinkSources()
+{
+  if (!source_ || gst_mse_src_configured(source_))
+    return false;
 
-  std::string audio_timestamp_path =
-      frame_files_path_ + "/raw_audio_frames_" + counter_stream.str() + ".txt";
-  std::string video_timestamp_path =
-      frame_files_path_ + "/raw_video_frames_" + counter_stream.str() + ".txt";
+  if(pipeline_type_ != kAudioOnly)
+    gst_mse_src_register_player(source_, (GstElement*) appsrc_source_video_);
+  if(pipeline_type_ != kVideoOnly)
+    gst_mse_src_register_player(source_, (GstElement*) appsrc_source_audio_);
 
-  FILE* audio_timestamp_file = fopen(audio_timestamp_path.c_str(), "r");
-  FILE* video_timestamp_file = fopen(video_timestamp_path.c_str(), "r");
+  gst_mse_src_configuration_done(source_);
+  MarkStartup(kStartupPadLink);
+  WatchForFirstFrame();
+  return true;
+}
 
-  if (audio_timestamp_file == NULL && video_timestamp_file == NULL) {
-    return true;
-  } else {
-    if (audio_timestamp_file)
-      fclose(audio_timestamp_file);
-    if (video_timestamp_file)
-      fclose(video_timestamp_file);
-    return false;
+void MediaSourcePipeline::ReleaseAppSources(GstElement* source)
+{
+  GstElement* appsrcs[2] = {GST_ELEMENT(appsrc_source_audio_),
+                            GST_ELEMENT(appsrc_source_video_)};
+  for (int type = kAudio; type <= kVideo; type++) {
+    GstElement* appsrc = appsrcs[type];
+    if (appsrc == NULL || GST_OBJECT_PARENT(appsrc) != GST_OBJECT(source))
+      continue;
+
+    // the bin holds the only reference, keep the appsrc alive and hand the
+    // reference to the next bin it is added to
+    gst_object_ref(appsrc);
+    gst_mse_src_unregister_player(source, appsrc);
+    g_object_force_floating(G_OBJECT(appsrc));
   }
 }
 
-bool MediaSourcePipeline::HasPlaybackAdvanced() {
-  int32_t pos = current_playback_history_cnt_ - 1;
-  if (pos < 0)
-    pos = kPlaybackPositionHistorySize - 1;
+void MediaSourcePipeline::PushFirstGop()
+{
+  int64_t end_pts_us = kTimestampNone;
+  if (pipeline_type_ != kAudioOnly)
+    end_pts_us = PushStartupFrames(kVideo, kTimestampNone);
+  if (pipeline_type_ != kVideoOnly)
+    PushStartupFrames(kAudio, end_pts_us);
+}
 
-  int32_t counter = 1;
-  int64_t val = playback_position_history_[pos];
-  bool did_advance = true;
-  while (counter < kPlaybackPositionHistorySize) {
-    pos--;
-    if (pos < 0)
-      pos = kPlaybackPositionHistorySize - 1;
+int64_t MediaSourcePipeline::PushStartupFrames(AVType type, int64_t end_pts_us)
+{
+  int64_t max_us = (type == kVideo) ? kFastStartMaxGopUs : kFastStartAudioUs;
+  int64_t first_pts_us = kTimestampNone;
+  int64_t pushed_end_us = kTimestampNone;
+  uint64_t bytes = 0;
+  guint frames = 0;
+  GstBufferList* list = gst_buffer_list_new_sized(kInitialBatchSize);
+
+  while (true) {
+    if (frames > 0) {
+      const FrameRecord* next = readers_[type].Peek();
+      if (next == NULL)
+        break;
+      int64_t pts_us = next->pts_us_ + timeline_shift_us_[type];
+      if (end_pts_us != kTimestampNone) {
+        if (pts_us >= end_pts_us)
+          break;
+      } else if (pts_us - first_pts_us >= max_us ||
+                 (type == kVideo && (next->flags_ & kFrameFlagKeyframe))) {
+        break;
+      }
+    }
 
-    if (val <= playback_position_history_[pos] ||
-        playback_position_history_[pos] == -1) {
-      did_advance = false;
+    AVFrame frame;
+    if (GetNextFrame(&frame, type) != kFrameRead)
       break;
-    }
 
-    val = playback_position_history_[pos];
-    ++counter;
+    if (first_pts_us == kTimestampNone)
+      first_pts_us = frame.pts_us_;
+    pushed_end_us = std::max(pushed_end_us, frame.pts_us_ + frame.duration_us_);
+    bytes += frame.size_;
+    frames++;
+    gst_buffer_list_add(list, CreateBuffer(frame));
+  }
+
+  if (frames == 0) {
+    gst_buffer_list_unref(list);
+    return kTimestampNone;
   }
 
-  return did_advance;
+  // the appsrc queue is still empty, so even a blocking one takes the list
+  // without waiting
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  int64_t push_start_us = g_get_monotonic_time();
+  if (gst_app_src_push_buffer_list(appsrc, list) != GST_FLOW_OK) {
+    fprintf(stderr, "APPSRC PUSH FAILED!\n");
+    return kTimestampNone;
+  }
+  metrics_.RecordPush(type, frames, bytes, g_get_monotonic_time() - push_start_us);
+
+  OnFramePushed();
+
+  printf("Fast start: pushed %u %s frames, %.1f KB, %.1f ms of media\n",
+         frames,
+         type == kVideo ? "video" : "audio",
+         bytes / 1024.0,
+         (pushed_end_us - first_pts_us) / 1000.0);
+  return pushed_end_us;
 }
 
-void MediaSourcePipeline::AddPlaybackPositionToHistory(int64_t position) {
-  GstState state;
-  gst_element_get_state(pipeline_, &state, 0, 0);
+void MediaSourcePipeline::WatchForFirstFrame()
+{
+  GstElement* sink = (pipeline_type_ != kAudioOnly) ? video_sink_ : audio_sink_;
+  if (sink == NULL)
+    return;
 
-  if (state == GST_STATE_PLAYING) {
-    playback_position_history_[current_playback_history_cnt_] = position;
-    current_playback_history_cnt_ =
-        (current_playback_history_cnt_ + 1) % kPlaybackPositionHistorySize;
-  }
+  GstPad* pad = gst_element_get_static_pad(sink, "sink");
+  if (pad == NULL)
+    return;
+
+  gst_pad_add_probe(pad,
+                    GST_PAD_PROBE_TYPE_BUFFER,
+                    reinterpret_cast<GstPadProbeCallback>(FirstFrameAtSinkStatic),
+                    this,
+                    NULL);
+  gst_object_unref(pad);
 }
 
-bool MediaSourcePipeline::IsPlaybackStalled() {
-  int64_t first_pos = playback_position_history_[0];
+void MediaSourcePipeline::OnFirstFrameAtSink()
+{
+  // runs on the streaming thread of the sink
+  MarkStartup(kStartupFirstFrame);
+
+  int64_t resume_us = resume_start_us_.exchange(0);
+  if (resume_us)
+    printf("Resume (%s): first frame after %.1f ms\n",
+           SuspendTierName(suspended_tier_),
+           (g_get_monotonic_time() - resume_us) / 1000.0);
+}
 
-  for (size_t i = 1; i < playback_position_history_.size(); i++) {
-    if (playback_position_history_[i] != first_pos ||
-        playback_position_history_[i] < 0)
-      return false;
+void MediaSourcePipeline::WatchLiveLatency()
+{
+  if (!options_.live_ || live_probe_pad_ != NULL)
+    return;
+
+  GstElement* sink = SegmentEndTrack() == kVideo ? video_sink_ : audio_sink_;
+  if (sink == NULL)
+    return;
+
+  live_probe_pad_ = gst_element_get_static_pad(sink, "sink");
+  if (live_probe_pad_ == NULL)
+    return;
+
+  live_probe_id_ = gst_pad_add_probe(
+      live_probe_pad_,
+      GST_PAD_PROBE_TYPE_BUFFER,
+      reinterpret_cast<GstPadProbeCallback>(LiveFrameAtSinkStatic),
+      this,
+      NULL);
+}
+
+void MediaSourcePipeline::OnLiveFrameAtSink(GstPad* pad, GstBuffer* buffer)
+{
+  // runs on the streaming thread of the sink, before it waits for the clock
+  if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    return;
+
+  int64_t render_us = g_get_monotonic_time();
+  GstElement* sink = GST_PAD_PARENT(pad);
+  gint64 running_ns = RunningTimeNs();
+  if (running_ns >= 0 && GST_IS_BASE_SINK(sink) &&
+      gst_base_sink_get_sync(GST_BASE_SINK(sink))) {
+    // a syncing sink renders at the buffer's running time plus the latency
+    // of the pipeline; the appsrc segment starts at 0, so that is the pts
+    GstBaseSink* base_sink = GST_BASE_SINK(sink);
+    gint64 render_ns = GST_BUFFER_PTS(buffer) +
+                       gst_base_sink_get_latency(base_sink) +
+                       gst_base_sink_get_render_delay(base_sink);
+    if (render_ns > running_ns)
+      render_us += (render_ns - running_ns) / 1000;
   }
+  live_latency_.RecordRender(GST_BUFFER_PTS(buffer), render_us);
+}
 
-  return true; //playback_started_;
+gint64 MediaSourcePipeline::RunningTimeNs() const
+{
+  if (pipeline_ == NULL)
+    return -1;
+
+  GST_OBJECT_LOCK(pipeline_);
+  bool playing = GST_STATE(pipeline_) == GST_STATE_PLAYING;
+  GST_OBJECT_UNLOCK(pipeline_);
+  GstClock* clock = playing ? gst_element_get_clock(pipeline_) : NULL;
+  if (clock == NULL)
+    return -1;
+
+  GstClockTime now = gst_clock_get_time(clock);
+  GstClockTime base_time = gst_element_get_base_time(pipeline_);
+  gst_object_unref(clock);
+  return now > base_time ? static_cast<gint64>(now - base_time) : 0;
 }
 
-void MediaSourcePipeline::finishPipelineLinkingAndStartPlaybackIfNeeded()
+int64_t MediaSourcePipeline::LiveDelayUs(const AVFrame& frame) const
 {
-  if (source_ && !gst_mse_src_configured(source_)) {
-     if(pipeline_type_ != kAudioOnly)
-       gst_mse_src_register_player(source_, (GstElement*) appsrc_source_video_);
-     if(pipeline_type_ != kVideoOnly)
-       gst_mse_src_register_player(source_, (GstElement*) appsrc_source_audio_);
+  // frames go out in decode order, pacing by pts would hold a reference
+  // frame back until the B frames shown before it were already late
+  int64_t time_us = frame.dts_us_ != kTimestampNone ? frame.dts_us_ : frame.pts_us_;
+  gint64 due_ns = (time_us - seek_offset_) * 1000;
+  gint64 running_ns = RunningTimeNs();
+
+  // until the clock runs, e.g. while paused, only the first latency worth of
+  // media goes in so there is something to start with
+  if (running_ns < 0)
+    return due_ns <= options_.live_latency_ms_ * GST_MSECOND ? 0 : kLivePollUs;
+  return std::max<gint64>(due_ns - running_ns, 0) / 1000;
+}
+
+void MediaSourcePipeline::MarkStartup(StartupMilestone milestone)
+{
+  if (startup_us_[milestone] >= 0)
+    return;
+
+  int64_t unset = -1;
+  int64_t elapsed_us = g_get_monotonic_time() - startup_start_us_;
+  if (!startup_us_[milestone].compare_exchange_strong(unset, elapsed_us))
+    return;
+
+  printf("Startup: %s after %.1f ms\n", kStartupNames[milestone],
+         elapsed_us / 1000.0);
 
-     gst_mse_src_configuration_done(source_);
+  // the first frame can reach the sink before or after the pipeline is
+  // PLAYING, report once both happened
+  if (startup_us_[kStartupFirstFrame] >= 0 &&
+      startup_us_[kStartupPlaying] >= 0 &&
+      !startup_reported_.exchange(true))
+    g_idle_add(reinterpret_cast<GSourceFunc>(ReportStartupStatic), this);
+}
+
+void MediaSourcePipeline::ResetStartup()
+{
+  startup_start_us_ = g_get_monotonic_time();
+  for (int i = 0; i < kStartupMilestones; i++)
+    startup_us_[i] = -1;
+  startup_reported_ = false;
+}
 
+void MediaSourcePipeline::ReportStartup()
+{
+  std::ostringstream line;
+  line.setf(std::ios::fixed);
+  line.precision(1);
+  for (int i = 0; i < kStartupMilestones; i++) {
+    if (i > 0)
+      line << ", ";
+    line << kStartupNames[i] << " ";
+    if (startup_us_[i] >= 0)
+      line << startup_us_[i] / 1000.0;
+    else
+      line << "-";
+  }
+  printf("Time to first frame: %.1f ms%s (%s)\n",
+         startup_us_[kStartupFirstFrame] / 1000.0,
+         options_.fast_start_ ? " [fast start]" : "",
+         line.str().c_str());
+
+  rtObjectRef times;
+  startupTimes(times);
+  mEmit.send("onStartup", times);
+}
+
+rtError MediaSourcePipeline::startupTimes(rtObjectRef& times) const
+{
+  times = new rtMapObject;
+  for (int i = 0; i < kStartupMilestones; i++) {
+    int64_t us = startup_us_[i];
+    times.set(kStartupNames[i], us >= 0 ? us / 1000.0 : -1.0);
+  }
+  return RT_OK;
+}
+
+void MediaSourcePipeline::finishPipelineLinkingAndStartPlaybackIfNeeded()
+{
+  if (LinkSources()) {
      printf("Finished linking pipeline and putting it in play!\n");
      gst_element_set_state(pipeline_, GST_STATE_PLAYING);
      is_playing_ = true;
+     WatchForSegmentEnd();
+     WatchLiveLatency();
   }
 }
 
 gboolean MediaSourcePipeline::StatusPoll() {
-  GstFormat fmt = GST_FORMAT_TIME;
-  gint64 position = -1;
-
   // finish linking all of pipeline if we haven't yet
   finishPipelineLinkingAndStartPlaybackIfNeeded();
 
-  if(pipeline_type_ != kAudioOnly) // westeros sink gives a more accurate position
-    gst_element_query_position(video_sink_, fmt, &position);
+  gint64 position = QueryPosition();
+  if (position >= 0) {
+    position += (seek_offset_ * 1000);
+    playback_position_secs_ = (static_cast<double>(position) / GST_SECOND);
+    playback_position_us_ = position / 1000;
+
+    if (position_update_ms_ == 0) {
+      printf("%splayback position: %f secs\n", LogPrefix().c_str(),
+             playback_position_secs_);
+      if (IsBatchFeeding() || UsesDemandFeed())
+        PrintFeedStats();
+      if (dispatch_probe_.running()) {
+        dispatch_probe_.PrintStats(UsesFeederThreads() ? "[feeder threads]"
+                                                       : "[main loop feed]");
+        dispatch_probe_.Reset();
+      }
+      abr_.LogBuffer(playback_position_secs_, BufferedUs());
+      if (options_.live_)
+        live_latency_.PrintInterval(LogPrefix().c_str());
+    }
+
+    position_update_ms_ = (position_update_ms_ + kStatusDelayMs) %
+                          kPlaybackPositionUpdateIntervalMs;
+
+    PrefetchNextSegmentIfNeeded();
+  }
+
+  if (options_.gapless_)
+    UpdateGaplessSegment();
+  else if (ShouldPerformSeek())
+    FinishSegment();
+
+  return TRUE;
+}
+
+gint64 MediaSourcePipeline::QueryPosition() {
+  gint64 position = -1;
+  if (pipeline_type_ != kAudioOnly)  // westeros sink gives a more accurate position
+    gst_element_query_position(video_sink_, GST_FORMAT_TIME, &position);
   else
-    gst_element_query_position(pipeline_, fmt, &position);
+    gst_element_query_position(pipeline_, GST_FORMAT_TIME, &position);
+  return position;
+}
 
-  position += (seek_offset_ * 1000);
-  if (position != static_cast<gint64>(GST_CLOCK_TIME_NONE)) {
-    AddPlaybackPositionToHistory(position);
-    if (!playback_started_)
-      playback_started_ = HasPlaybackAdvanced();
-    playback_position_secs_ = (static_cast<double>(position) / GST_SECOND);
+void MediaSourcePipeline::FinishSegment() {
+  // the feeders read from the catalog, stop them before it can be rebuilt
+  StopFeedingAppSource(appsrc_source_video_);
+  StopFeedingAppSource(appsrc_source_audio_);
+  UpdateSegmentCatalog();
+  if (IsPlaybackOver()) {
+    if (OnLoopPlayed())
+      return;
+    printf("Current end time:%f\n", current_end_time_secs_);
+    printf("Playback Complete! Starting over...\n");
+    if (options_.use_frame_pool_) {
+      audio_frame_pool_.PrintStats();
+      video_frame_pool_.PrintStats();
+    }
+    network_.PrintStats();
+    abr_.PrintStats();
+    qos_.PrintSummary();
 
-    static int64_t position_update_cnt = 0;
-    if (position_update_cnt == 0)
-      printf("playback position: %f secs\n", playback_position_secs_);
+    // reset file counter back to before beginning
+    current_file_counter_ = -1;
+    PerformSeek();
+  } else {
+    printf("Performing Seek!\n");
+    PerformSeek();
+  }
+}
 
-    position_update_cnt = (position_update_cnt + kStatusDelayMs) %
-                          kPlaybackPositionUpdateIntervalMs;
+AVType MediaSourcePipeline::SegmentEndTrack() const {
+  // the track whose sink gives the playback position
+  return pipeline_type_ != kAudioOnly ? kVideo : kAudio;
+}
+
+void MediaSourcePipeline::WatchForSegmentEnd() {
+  if (options_.gapless_ || end_probe_pad_ != NULL)
+    return;
+
+  GstElement* sink = SegmentEndTrack() == kVideo ? video_sink_ : audio_sink_;
+  if (sink == NULL)
+    return;
+  end_probe_pad_ = gst_element_get_static_pad(sink, "sink");
+  if (end_probe_pad_ == NULL)
+    return;
+
+  end_probe_id_ = gst_pad_add_probe(
+      end_probe_pad_,
+      static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                   GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+      reinterpret_cast<GstPadProbeCallback>(SegmentEndProbeStatic),
+      this,
+      NULL);
+}
+
+void MediaSourcePipeline::OnSegmentEndProbe(GstPadProbeInfo* info) {
+  // runs on the streaming thread of the sink
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+      return;
+    // only this thread writes it
+    if (static_cast<int64_t>(GST_BUFFER_PTS(buffer)) > sink_pts_ns_)
+      sink_pts_ns_ = GST_BUFFER_PTS(buffer);
+  } else {
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+      sink_pts_ns_ = -1;  // whatever came before belongs to the old segment
+    else if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+      sink_pts_ns_ = G_MAXINT64;
+    else
+      return;
   }
+  CheckSegmentEnd();
+}
 
-#ifdef DEBUG_PRINTS
-  printf("playback started:%d\n", playback_started_);
-#endif
-  if (ShouldPerformSeek()) {
-    if (IsPlaybackOver()) {
-      printf("Current end time:%f\n", current_end_time_secs_);
-      printf("Playback Complete! Starting over...\n");
+void MediaSourcePipeline::CheckSegmentEnd() {
+  // the segment is over once the last frame fed on the position track has
+  // reached the sink; frames reach a sink in presentation order
+  AVType type = SegmentEndTrack();
+  if (end_probe_pad_ == NULL || !track_ended_[type] ||
+      max_fed_pts_us_[type] == kTimestampNone ||
+      sink_pts_ns_ < (max_fed_pts_us_[type] - seek_offset_) * 1000)
+    return;
 
-      // reset file counter back to before beginning
-      current_file_counter_ = -1;
-      PerformSeek();
-    } else {
-      printf("Performing Seek!\n");
-      PerformSeek();
+  if (g_atomic_int_compare_and_exchange(&segment_end_posted_, 0, 1))
+    g_idle_add(reinterpret_cast<GSourceFunc>(SegmentEndStatic), this);
+}
+
+gboolean MediaSourcePipeline::OnSegmentEnd() {
+  segment_end_handle_ = 0;
+  // a seek got in first
+  if (!g_atomic_int_get(&segment_end_posted_) || seeking_)
+    return FALSE;
+
+  // hold on until the last frame has been on screen for its duration
+  AVType type = SegmentEndTrack();
+  gint64 end_ns = (max_fed_pts_us_[type] + max_fed_duration_us_[type] -
+                   seek_offset_) * 1000;
+  gint64 position = QueryPosition();
+  if (position >= 0 && position < end_ns) {
+    guint delay_ms = (end_ns - position + GST_MSECOND - 1) / GST_MSECOND;
+    segment_end_handle_ = g_timeout_add(
+        delay_ms, reinterpret_cast<GSourceFunc>(SegmentEndStatic), this);
+    return FALSE;
+  }
+
+  printf("Segment %d ended at %f secs\n", current_file_counter_,
+         end_ns / static_cast<double>(GST_SECOND) + seek_offset_ / 1000000.0);
+  FinishSegment();
+  return FALSE;
+}
+
+void MediaSourcePipeline::EndTrack(AVType type) {
+  if (track_ended_[type].exchange(true))
+    return;
+
+  // a decoder ahead of the sink keeps frames for reordering until more input
+  // or the end of the stream comes; with the next segment behind a flush
+  // only the EOS gets the last ones out. The flush clears it again
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  if (appsrc)
+    gst_app_src_end_of_stream(appsrc);
+}
+
+void MediaSourcePipeline::ResetSegmentEnd() {
+  for (int type = kAudio; type <= kVideo; type++) {
+    track_ended_[type] = false;
+    max_fed_pts_us_[type] = kTimestampNone;
+    max_fed_duration_us_[type] = 0;
+  }
+  stall_position_us_ = -1;
+  stall_start_us_ = 0;
+  g_atomic_int_set(&segment_end_posted_, 0);
+  if (segment_end_handle_) {
+    g_source_remove(segment_end_handle_);
+    segment_end_handle_ = 0;
+  }
+}
+
+void MediaSourcePipeline::ResetTracks() {
+  for (int type = kAudio; type <= kVideo; type++) {
+    track_counters_[type] = current_file_counter_;
+    timeline_shift_us_[type] = 0;
+    loop_offset_us_[type] = 0;
+    start_frames_[type] = 0;
+    last_read_pts_us_[type] = kTimestampNone;
+  }
+  timeline_segments_.clear();
+  segment_renditions_.clear();
+  current_timeline_start_us_ = 0;
+  ResetSegmentEnd();
+}
+
+void MediaSourcePipeline::UpdateGaplessSegment() {
+  bool looped = false;
+
+  g_mutex_lock(&feeder_mutex_);
+  while (!timeline_segments_.empty() &&
+         timeline_segments_.front().first <= playback_position_us_) {
+    int32_t counter = timeline_segments_.front().second;
+    const Segment* segment = catalog_.segment(counter);
+    if (segment == NULL) {
+      // the catalog was rebuilt without it
+      timeline_segments_.pop_front();
+      break;
     }
+
+    bool first = current_timeline_start_us_ == 0;
+    current_timeline_start_us_ = timeline_segments_.front().first;
+    timeline_segments_.pop_front();
+
+    if (counter == 0 && !first) {
+      looped = true;
+      printf("Playback Complete! Starting over...\n");
+      if (options_.use_frame_pool_) {
+        audio_frame_pool_.PrintStats();
+        video_frame_pool_.PrintStats();
+      }
+      network_.PrintStats();
+      abr_.PrintStats();
+      qos_.PrintSummary();
+    }
+    current_file_counter_ = counter;
+    qos_.NoteSegmentTransition();
+
+    current_end_time_secs_ =
+        (current_timeline_start_us_ + segment->duration_us_) / 1000000.0;
+    printf("Playing segment %d from %f secs (gapless)\n", counter,
+           current_timeline_start_us_ / 1000000.0f);
   }
+  g_mutex_unlock(&feeder_mutex_);
 
-  return TRUE;
+  if (looped)
+    OnLoopPlayed();
 }
 
 gboolean MediaSourcePipeline::ReadVideoFrame() {
-  if (seeking_) {
+  metrics_.RecordWakeup(kVideo);
+  if (seeking_ || !FeedAppSource(kVideo)) {
     video_frame_timeout_handle_ = 0;
     return FALSE;
   }
 
-  AVFrame video_frame;
-  ReadStatus read_status = GetNextFrame(&video_frame, kVideo);
-#ifdef DEBUG_PRINTS
-  printf("Video frame read status:%d\n", read_status);
-#endif
+  return TRUE;
+}
 
-  if (read_status != kFrameRead) {
-    video_frame_timeout_handle_ = 0;
+gboolean MediaSourcePipeline::ReadAudioFrame() {
+  metrics_.RecordWakeup(kAudio);
+  if (seeking_ || !FeedAppSource(kAudio)) {
+    audio_frame_timeout_handle_ = 0;
     return FALSE;
   }
 
+  return TRUE;
+}
+
+bool MediaSourcePipeline::FeedAppSource(AVType type) {
+  return IsBatchFeeding() ? ReadFrameBatch(type) : ReadAndPushFrame(type);
+}
+
+bool MediaSourcePipeline::ReadAndPushFrame(AVType type) {
+  AVFrame frame;
+  ReadStatus read_status = GetNextFrame(&frame, type);
 #ifdef DEBUG_PRINTS
-  float frame_time_seconds = video_frame.timestamp_us_ / 1000000.0f;
-  printf("read video frame: time:%f secs, size:%d bytes\n",
+  printf("%s frame read status:%d\n", type == kVideo ? "Video" : "Audio",
+         read_status);
+#endif
+
+  if (read_status != kFrameRead)
+    return false;
+
+#ifdef DEBUG_PRINTS
+  float frame_time_seconds = frame.pts_us_ / 1000000.0f;
+  printf("read %s frame: time:%f secs, size:%d bytes\n",
+         type == kVideo ? "video" : "audio",
          frame_time_seconds,
-         video_frame.size_);
+         frame.size_);
 #endif
 
-  PushFrameToAppSrc(video_frame, kVideo);
+  PushFrameToAppSrc(frame, type);
 
-  return TRUE;
+  return true;
 }
 
-gboolean MediaSourcePipeline::ReadAudioFrame() {
+gboolean MediaSourcePipeline::FeedEmulated(AVType type) {
+  guint& handle = (type == kVideo) ? video_frame_timeout_handle_
+                                   : audio_frame_timeout_handle_;
+  handle = 0;
+  if (seeking_)
+    return FALSE;
+
+  metrics_.RecordWakeup(type);
+  int64_t now_us = g_get_monotonic_time();
+
+  while (ShouldBeReading(type) && !seeking_) {
+    if (!has_pending_frame_[type]) {
+      // a reader that is not open yet means the next frame starts a segment
+      bool new_segment = !readers_[type].is_open();
+      if (GetNextFrame(&pending_frames_[type], type) != kFrameRead)
+        return FALSE;
+
+      has_pending_frame_[type] = true;
+      pending_ready_us_[type] = now_us;
+      if (network_.enabled()) {
+        pending_ready_us_[type] = network_.Deliver(
+            type, now_us, pending_frames_[type].size_, new_segment);
+        abr_.estimator().AddSample(pending_frames_[type].size_,
+                                   pending_ready_us_[type] - now_us);
+      }
+    }
+
+    // once arrived, a live frame waits for its time on the pipeline clock
+    if (options_.live_ && pending_ready_us_[type] <= now_us)
+      pending_ready_us_[type] = now_us + LiveDelayUs(pending_frames_[type]);
+
+    if (pending_ready_us_[type] > now_us) {
+      // still on the wire, come back when it has arrived
+      guint delay_ms = (pending_ready_us_[type] - now_us + 999) / 1000;
+      handle = g_timeout_add(delay_ms,
+                             reinterpret_cast<GSourceFunc>(
+                                 type == kVideo ? feedEmulatedVideoStatic
+                                                : feedEmulatedAudioStatic),
+                             this);
+      return FALSE;
+    }
+
+    has_pending_frame_[type] = false;
+    PushFrameToAppSrc(pending_frames_[type], type);
+  }
+
+  return FALSE;
+}
+
+gboolean MediaSourcePipeline::FillAppSource(AVType type) {
+  guint& handle = (type == kVideo) ? video_frame_timeout_handle_
+                                   : audio_frame_timeout_handle_;
   if (seeking_) {
-    audio_frame_timeout_handle_ = 0;
+    handle = 0;
     return FALSE;
   }
 
-  AVFrame audio_frame;
-  ReadStatus read_status = GetNextFrame(&audio_frame, kAudio);
+  const FeedWatermarks& marks = options_.watermarks_[type];
+  metrics_.RecordWakeup(type);
 
-#ifdef DEBUG_PRINTS
-  printf("Audio frame read status:%d\n", read_status);
-#endif
+  // fill up to the high watermark, or further if need-data asked for more
+  guint64 target_bytes = marks.high_bytes_;
+  guint64 level_bytes = 0;
+  GstClockTime level_time = 0;
+  GetAppSourceLevel(type, &level_bytes, &level_time);
+  if (need_data_bytes_[type] > 0)
+    target_bytes = std::max(target_bytes, level_bytes + need_data_bytes_[type]);
 
-  if (read_status != kFrameRead) {
-    audio_frame_timeout_handle_ = 0;
-    return FALSE;
+  while (ShouldBeReading(type) && !seeking_) {
+    if (level_bytes >= target_bytes)
+      break;
+    if (marks.high_ms_ > 0 && GST_CLOCK_TIME_IS_VALID(level_time) &&
+        level_time >= marks.high_ms_ * GST_MSECOND)
+      break;
+
+    if (!FeedAppSource(type))
+      break;
+
+    GetAppSourceLevel(type, &level_bytes, &level_time);
   }
 
 #ifdef DEBUG_PRINTS
-  float frame_time_seconds = audio_frame.timestamp_us_ / 1000000.0f;
-  printf("read audio frame: time:%f secs, size:%d bytes\n",
-         frame_time_seconds,
-         audio_frame.size_);
+  printf("%s fill done, level:%" G_GUINT64_FORMAT " bytes\n",
+         type == kVideo ? "video" : "audio", level_bytes);
 #endif
 
-  PushFrameToAppSrc(audio_frame, kAudio);
+  // sleep until need-data reports the level dropped under the low watermark
+  SetShouldBeReading(false, type);
+  handle = 0;
+  return FALSE;
+}
 
-  return TRUE;
+void MediaSourcePipeline::GetAppSourceLevel(AVType type,
+                                            guint64* bytes,
+                                            GstClockTime* time) const {
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  *bytes = gst_app_src_get_current_level_bytes(appsrc);
+  *time = GST_CLOCK_TIME_NONE;
+
+  // current-level-time only exists in newer appsrc versions
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(appsrc),
+                                   "current-level-time"))
+    g_object_get(G_OBJECT(appsrc), "current-level-time", time, NULL);
 }
 
-void MediaSourcePipeline::StartFeedingAppSource(GstAppSrc* p_src) {
+void MediaSourcePipeline::OnAppSourceSignal(GstAppSrc* appsrc, bool need_data) {
+  AVType type = (appsrc == appsrc_source_video_) ? kVideo : kAudio;
+  if (need_data) {
+    bool underrun = gst_app_src_get_current_level_bytes(appsrc) == 0;
+    metrics_.RecordNeedData(type, underrun);
+    if (underrun)
+      qos_.NoteUnderrun();
+  } else {
+    metrics_.RecordEnoughData(type);
+  }
+}
+
+void MediaSourcePipeline::StartFeedingAppSource(GstAppSrc* p_src, guint length) {
   if (seeking_)
     return;
 
+  AVType type = (p_src == appsrc_source_video_) ? kVideo : kAudio;
+  if (UsesFeederThreads()) {
+    ResumeFeeder(type);
+    return;
+  }
+
+  // the length hint is -1 when appsrc has no idea how much it needs
+  need_data_bytes_[type] = (length == static_cast<guint>(-1)) ? 0 : length;
+
   bool start_up_reading_again = false;
 
-  start_up_reading_again =
-      !ShouldBeReading(p_src == appsrc_source_video_ ? kVideo : kAudio);
+  start_up_reading_again = !ShouldBeReading(type);
   if (start_up_reading_again)
-    SetShouldBeReading(true, p_src == appsrc_source_video_ ? kVideo : kAudio);
+    SetShouldBeReading(true, type);
+
+  if (start_up_reading_again && (network_.enabled() || options_.live_)) {
+    // frames are pushed as they arrive over the emulated link, and live ones
+    // as they fall due
+    if (type == kVideo) {
+      video_frame_timeout_handle_ = g_idle_add(
+          reinterpret_cast<GSourceFunc>(feedEmulatedVideoStatic), this);
+    } else {
+      audio_frame_timeout_handle_ = g_idle_add(
+          reinterpret_cast<GSourceFunc>(feedEmulatedAudioStatic), this);
+    }
+  } else if (start_up_reading_again && UsesDemandFeed()) {
+    // fill once up to the high watermark, then wait for the next need-data
+    if (type == kVideo) {
+      video_frame_timeout_handle_ =
+          g_idle_add(reinterpret_cast<GSourceFunc>(fillVideoStatic), this);
+    } else {
+      audio_frame_timeout_handle_ =
+          g_idle_add(reinterpret_cast<GSourceFunc>(fillAudioStatic), this);
+    }
+  } else if (start_up_reading_again) {
+    // a batch carries batch_ms_ of media, waking up twice as often keeps the
+    // feed ahead of real time
+    int video_delay_ms = kVideoReadDelayMs;
+    int audio_delay_ms = kAudioReadDelayMs;
+    if (IsBatchFeeding()) {
+      video_delay_ms = std::max(video_delay_ms, options_.batch_ms_ / 2);
+      audio_delay_ms = std::max(audio_delay_ms, options_.batch_ms_ / 2);
+    }
 
-  if (start_up_reading_again) {
     if (p_src == appsrc_source_video_) {
       video_frame_timeout_handle_ =
-          g_timeout_add(kVideoReadDelayMs,
+          g_timeout_add(video_delay_ms,
                         reinterpret_cast<GSourceFunc>(readVideoFrameStatic),
                         this);
     } else {  // audio
       audio_frame_timeout_handle_ =
-          g_timeout_add(kAudioReadDelayMs,
+          g_timeout_add(audio_delay_ms,
                         reinterpret_cast<GSourceFunc>(readAudioFrameStatic),
                         this);
     }
@@ -436,6 +1176,9 @@ void MediaSourcePipeline::StartFeedingAppSource(GstAppSrc* p_src) {
 }
 
 void MediaSourcePipeline::StopFeedingAppSource(GstAppSrc* p_src) {
+  if (UsesFeederThreads())
+    PauseFeeder(p_src == appsrc_source_video_ ? kVideo : kAudio);
+
   if (p_src == appsrc_source_video_) {
     if (video_frame_timeout_handle_) {
       g_source_remove(video_frame_timeout_handle_);
@@ -452,7 +1195,177 @@ void MediaSourcePipeline::StopFeedingAppSource(GstAppSrc* p_src) {
 }
 
 void MediaSourcePipeline::SetNewAppSourceReadPosition(GstAppSrc* p_src,
-                                                      guint64 position) {}
+                                                      guint64 position) {
+  // seek-data comes from the thread handling the seek event, the readers
+  // are only repositioned from the main context
+  reposition_pending_[p_src == appsrc_source_video_ ? kVideo : kAudio] = true;
+  AppSourceSeek* seek = new AppSourceSeek;
+  seek->pipeline_ = this;
+  seek->appsrc_ = p_src;
+  seek->position_ = position;
+  g_idle_add(reinterpret_cast<GSourceFunc>(AppSourceSeekStatic), seek);
+}
+
+void MediaSourcePipeline::RepositionAppSource(GstAppSrc* p_src,
+                                              guint64 position) {
+  AVType type = (p_src == appsrc_source_video_) ? kVideo : kAudio;
+  if (catalog_.empty()) {
+    reposition_pending_[type] = false;
+    return;
+  }
+
+  // appsrc positions are buffer times, which are offset by seek_offset_
+  int64_t pts_us = 0;
+  int64_t loop_offset_us = 0;
+  int32_t counter = ResolvePosition(
+      position / 1000 + seek_offset_, &pts_us, &loop_offset_us);
+
+  StopFeedingAppSource(p_src);
+  readers_[type].Close();
+  // the seek flushed out any EOS sent at the end of the track
+  track_ended_[type] = false;
+
+  track_counters_[type] = counter;
+  loop_offset_us_[type] = loop_offset_us;
+  if (!options_.gapless_ && counter != current_file_counter_) {
+    current_file_counter_ = counter;
+    CalculateCurrentEndTime();
+  }
+  PositionTrack(type, pts_us);
+  reposition_pending_[type] = false;
+
+  printf("%s appsrc seek to %f secs: segment %d\n",
+         type == kVideo ? "Video" : "Audio", pts_us / 1000000.0f, counter);
+  StartFeedingAppSource(p_src);
+}
+
+int32_t MediaSourcePipeline::ResolvePosition(int64_t position_us,
+                                             int64_t* pts_us,
+                                             int64_t* loop_offset_us) const {
+  *loop_offset_us = 0;
+  if (!options_.gapless_) {
+    *pts_us = position_us;
+    return catalog_.FindSegment(position_us);
+  }
+
+  // gapless positions are on the looping timeline, which starts where the
+  // first segment does
+  int64_t origin_us = catalog_.segment(0)->start_pts_us_;
+  int64_t timeline_us = std::max<int64_t>(0, position_us - origin_us);
+  int64_t duration_us = catalog_.duration_us();
+  if (duration_us > 0) {
+    *loop_offset_us = timeline_us / duration_us * duration_us;
+    timeline_us -= *loop_offset_us;
+  }
+
+  int32_t counter = catalog_.FindTimelineSegment(timeline_us);
+  const Segment* segment = catalog_.segment(counter);
+  *pts_us = timeline_us - segment->timeline_start_us_ + segment->start_pts_us_;
+  return counter;
+}
+
+int64_t MediaSourcePipeline::PositionTrack(AVType type, int64_t pts_us) {
+  track_renditions_[type] = abr_.current();
+  const Segment* segment =
+      RenditionCatalog(track_renditions_[type]).segment(track_counters_[type]);
+  if (segment == NULL || !segment->tracks_[type].present() ||
+      segment->tracks_[type].frame_count() == 0)
+    return kTimestampNone;
+
+  const FrameIndex& index = *segment->tracks_[type].index_;
+  size_t frame = index.FindKeyframe(pts_us);
+  // audio can start anywhere, take the first frame not ahead of pts_us so
+  // nothing is timestamped before the new start
+  if (type == kAudio && index[frame].pts_us_ < pts_us && frame + 1 < index.size())
+    frame++;
+
+  // applied when GetNextFrame opens the reader
+  start_frames_[type] = frame;
+  return index[frame].pts_us_;
+}
+
+void MediaSourcePipeline::SeekToPosition(int64_t position_us) {
+  if (catalog_.empty() || FlushTarget() == NULL)
+    return;
+
+  seek_start_us_ = g_get_monotonic_time();
+  metrics_.RecordSeek();
+  qos_.NoteSeek();
+  seeking_ = true;
+  StopFeedingAppSource(appsrc_source_video_);
+  StopFeedingAppSource(appsrc_source_audio_);
+  CloseAllFiles();
+
+  int64_t start_us = PositionTracks(position_us);
+  printf("Seeking to %f secs: segment %d from %f secs\n",
+         position_us / 1000000.0f,
+         current_file_counter_,
+         start_us / 1000000.0f);
+
+  FlushAndRestartFeeding();
+  WatchForFirstFrameAfterSeek();
+}
+
+int64_t MediaSourcePipeline::PositionTracks(int64_t position_us) {
+  int64_t pts_us = 0;
+  int64_t loop_offset_us = 0;
+  current_file_counter_ = ResolvePosition(position_us, &pts_us, &loop_offset_us);
+  ResetTracks();
+  CalculateCurrentEndTime();
+  const Segment* segment = catalog_.segment(current_file_counter_);
+
+  // video can only start at a keyframe, audio follows from there
+  int64_t start_us = pts_us;
+  int64_t keyframe_us = PositionTrack(kVideo, pts_us);
+  if (keyframe_us != kTimestampNone)
+    start_us = keyframe_us;
+  PositionTrack(kAudio, start_us);
+
+  seek_offset_ = start_us;
+  if (options_.gapless_) {
+    loop_offset_us_[kAudio] = loop_offset_us_[kVideo] = loop_offset_us;
+    seek_offset_ += loop_offset_us + segment->timeline_start_us_ +
+                    catalog_.segment(0)->start_pts_us_ - segment->start_pts_us_;
+  }
+  return start_us;
+}
+
+int64_t MediaSourcePipeline::CurrentPositionUs() {
+  gint64 position = pipeline_ ? QueryPosition() : -1;
+  if (position >= 0)
+    return position / 1000 + seek_offset_;
+  return playback_position_us_;
+}
+
+void MediaSourcePipeline::WatchForFirstFrameAfterSeek() {
+  GstElement* sink = (pipeline_type_ != kAudioOnly) ? video_sink_ : audio_sink_;
+  if (sink == NULL)
+    return;
+
+  // one probe is enough for a burst of seeks, it reports against the last
+  if (seek_probe_pending_.exchange(true))
+    return;
+
+  GstPad* pad = gst_element_get_static_pad(sink, "sink");
+  if (pad == NULL) {
+    seek_probe_pending_ = false;
+    return;
+  }
+
+  gst_pad_add_probe(pad,
+                    GST_PAD_PROBE_TYPE_BUFFER,
+                    reinterpret_cast<GstPadProbeCallback>(FirstFrameAfterSeekStatic),
+                    this,
+                    NULL);
+  gst_object_unref(pad);
+}
+
+void MediaSourcePipeline::OnFirstFrameAfterSeek() {
+  int64_t latency_us = g_get_monotonic_time() - seek_start_us_;
+  seek_probe_pending_ = false;
+  metrics_.RecordSeekLatency(latency_us);
+  printf("Seek: first frame at the sink after %.1f ms\n", latency_us / 1000.0);
+}
 
 void MediaSourcePipeline::OnAutoPadAddedMediaSource(GstElement* element,
                                                     GstPad* pad) {
@@ -501,21 +1414,34 @@ void MediaSourcePipeline::OnAutoElementAddedMediaSource(GstElement* element) {
   }
 }
 
-MediaSourcePipeline::MediaSourcePipeline(std::string frame_files_path)
-  : frame_files_path_(frame_files_path)
+MediaSourcePipeline::MediaSourcePipeline(std::string frame_files_path,
+                                         const PipelineOptions& options)
+  : frame_files_path_(frame_files_path),
+    options_(options),
+    audio_frame_pool_("Audio"),
+    video_frame_pool_("Video"),
+    suspend_tier_(options.suspend_tier_),
+    suspended_tier_(options.suspend_tier_),
+    suspend_position_us_(0),
+    stats_interval_ms_(options.stats_interval_ms_),
+    loops_played_(0),
+    finished_callback_(NULL),
+    finished_data_(NULL)
 {
+    g_mutex_init(&feeder_mutex_);
+    g_cond_init(&feeder_cond_);
     Init();
 }
 
-MediaSourcePipeline::~MediaSourcePipeline() { Destroy(); }
+MediaSourcePipeline::~MediaSourcePipeline() {
+  Destroy();
+  g_cond_clear(&feeder_cond_);
+  g_mutex_clear(&feeder_mutex_);
+}
 
 void MediaSourcePipeline::Init()
 {
   current_file_counter_ = 0;
-  current_video_file_ = NULL;
-  current_video_timestamp_file_ = NULL;
-  current_audio_file_ = NULL;
-  current_audio_timestamp_file_ = NULL;
   seeking_ = false;
   pipeline_ = NULL;
   appsrc_source_video_ = NULL;
@@ -523,26 +1449,62 @@ void MediaSourcePipeline::Init()
   video_sink_ = NULL;
   audio_sink_ = NULL;
   playback_position_secs_ = 0;
+  playback_position_us_ = 0;
+  position_update_ms_ = 0;
   current_end_time_secs_ = 0;
   video_frame_timeout_handle_ = 0;
   audio_frame_timeout_handle_ = 0;
   status_timeout_handle_ = 0;
-  current_playback_history_cnt_ = 0;
-  playback_started_ = false;
   is_playing_ = false;
   pipeline_type_ = kAudioVideo;
   source_ = NULL;
-  appsrc_caps_video_ = NULL;
-  appsrc_caps_audio_ = NULL;
+  end_probe_pad_ = NULL;
+  end_probe_id_ = 0;
+  live_probe_pad_ = NULL;
+  live_probe_id_ = 0;
+  sink_pts_ns_ = -1;
+  segment_end_posted_ = 0;
+  segment_end_handle_ = 0;
   pause_before_seek_  = false;
   is_active_ = true;
   seek_offset_ = 0;
+  segment_switch_start_us_ = 0;
+  segment_switch_end_us_ = 0;
+  segment_switch_end_posted_ = 0;
+  seek_start_us_ = 0;
+  seek_probe_pending_ = false;
+  reposition_pending_[kAudio] = reposition_pending_[kVideo] = false;
+  ResetStartup();
+  start_position_us_ = -1;
+  resume_start_us_ = 0;
+  teardown_thread_ = NULL;
+  teardown_pipeline_ = NULL;
+  teardown_source_ = NULL;
+  teardown_start_us_ = 0;
+  teardown_end_us_ = 0;
+  teardown_done_handle_ = 0;
+  stats_timeout_handle_ = 0;
+  feed_report_us_ = 0;
+  feed_report_wakeups_[kAudio] = feed_report_wakeups_[kVideo] = 0;
+  ResetTracks();
+  feeders_quit_ = false;
+  for (int type = kAudio; type <= kVideo; type++) {
+    feeders_[type].pipeline_ = this;
+    feeders_[type].type_ = static_cast<AVType>(type);
+    feeders_[type].thread_ = NULL;
+    feeders_[type].run_ = false;
+    feeders_[type].busy_ = false;
+  }
+  track_renditions_[kAudio] = track_renditions_[kVideo] = abr_.current();
+  prefetch_rendition_ = abr_.current();
+  prefetcher_.Reset();
+  prefetcher_.set_prefetch_us(options_.prefetch_secs_ * 1000000);
  
 
   memset(&should_be_reading_, 0, sizeof(should_be_reading_));
+  memset(&need_data_bytes_, 0, sizeof(need_data_bytes_));
+  memset(&has_pending_frame_, 0, sizeof(has_pending_frame_));
 
-  playback_position_history_.resize(kPlaybackPositionHistorySize, 0);
-  ResetPlaybackHistory();
 }
 
 bool MediaSourcePipeline::ShouldBeReading(AVType av) {
@@ -553,139 +1515,450 @@ void MediaSourcePipeline::SetShouldBeReading(bool is_reading, AVType av) {
   should_be_reading_[av] = is_reading;
 }
 
+bool MediaSourcePipeline::UsesFeederThreads() const {
+  return options_.feeder_threads_;
+}
+
+void MediaSourcePipeline::StartFeederThreads() {
+  for (int type = kAudio; type <= kVideo; type++) {
+    feeders_[type].thread_ = g_thread_new(
+        type == kVideo ? "video-feeder" : "audio-feeder",
+        FeederThreadStatic,
+        &feeders_[type]);
+  }
+}
+
+void MediaSourcePipeline::StopFeederThreads() {
+  g_mutex_lock(&feeder_mutex_);
+  feeders_quit_ = true;
+  g_cond_broadcast(&feeder_cond_);
+  g_mutex_unlock(&feeder_mutex_);
+
+  for (int type = kAudio; type <= kVideo; type++) {
+    if (feeders_[type].thread_)
+      g_thread_join(feeders_[type].thread_);
+    feeders_[type].thread_ = NULL;
+  }
+}
+
+void MediaSourcePipeline::ResumeFeeder(AVType type) {
+  g_mutex_lock(&feeder_mutex_);
+  feeders_[type].run_ = true;
+  g_cond_broadcast(&feeder_cond_);
+  g_mutex_unlock(&feeder_mutex_);
+}
+
+void MediaSourcePipeline::PauseFeeder(AVType type) {
+  Feeder& feeder = feeders_[type];
+
+  g_mutex_lock(&feeder_mutex_);
+  feeder.run_ = false;
+  g_cond_broadcast(&feeder_cond_);
+  bool busy = feeder.busy_;
+  g_mutex_unlock(&feeder_mutex_);
+
+  // the thread may be blocked pushing into a full appsrc. Flushing would
+  // unblock it too, but not every caller flushes the pipeline afterwards,
+  // so let the push through instead: a non-blocking appsrc queues the
+  // buffer over its limit, and changing max-bytes wakes the waiting push.
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  guint64 max_bytes = 0;
+  if (busy && appsrc) {
+    max_bytes = gst_app_src_get_max_bytes(appsrc);
+    g_object_set(G_OBJECT(appsrc), "block", FALSE, NULL);
+    gst_app_src_set_max_bytes(appsrc, max_bytes + 1);
+  }
+
+  g_mutex_lock(&feeder_mutex_);
+  while (feeder.busy_)
+    g_cond_wait(&feeder_cond_, &feeder_mutex_);
+  g_mutex_unlock(&feeder_mutex_);
+
+  if (busy && appsrc) {
+    gst_app_src_set_max_bytes(appsrc, max_bytes);
+    g_object_set(G_OBJECT(appsrc), "block", TRUE, NULL);
+  }
+}
+
+void MediaSourcePipeline::RunFeeder(AVType type) {
+  Feeder& feeder = feeders_[type];
+
+  g_mutex_lock(&feeder_mutex_);
+  while (!feeders_quit_) {
+    if (!feeder.run_) {
+      g_cond_wait(&feeder_cond_, &feeder_mutex_);
+      continue;
+    }
+
+    feeder.busy_ = true;
+    bool more = true;
+
+    if (!network_.enabled() && !options_.live_) {
+      g_mutex_unlock(&feeder_mutex_);
+      more = FeedAppSource(type);
+      g_mutex_lock(&feeder_mutex_);
+    } else {
+      bool new_segment = !readers_[type].is_open();
+      AVFrame frame;
+      g_mutex_unlock(&feeder_mutex_);
+      more = GetNextFrame(&frame, type) == kFrameRead;
+      g_mutex_lock(&feeder_mutex_);
+
+      if (more) {
+        // the emulator is shared by both feeders, feeder_mutex_ guards it
+        int64_t ready_us = g_get_monotonic_time();
+        if (network_.enabled()) {
+          int64_t now_us = ready_us;
+          ready_us = network_.Deliver(type, now_us, frame.size_, new_segment);
+          abr_.estimator().AddSample(frame.size_, ready_us - now_us);
+        }
+        while (feeder.run_ && !feeders_quit_ &&
+               g_cond_wait_until(&feeder_cond_, &feeder_mutex_, ready_us)) {
+        }
+
+        // then a live frame waits for its time on the pipeline clock
+        int64_t delay_us = 0;
+        while (options_.live_ && feeder.run_ && !feeders_quit_ &&
+               (delay_us = LiveDelayUs(frame)) > 0) {
+          g_cond_wait_until(&feeder_cond_, &feeder_mutex_,
+                            g_get_monotonic_time() + delay_us);
+        }
+
+        if (feeder.run_ && !feeders_quit_) {
+          g_mutex_unlock(&feeder_mutex_);
+          PushFrameToAppSrc(frame, type);
+          g_mutex_lock(&feeder_mutex_);
+        } else {
+          ReleaseFrame(frame);
+        }
+      }
+    }
+
+    // out of frames, wait for the seek to the next segment
+    if (!more)
+      feeder.run_ = false;
+    feeder.busy_ = false;
+    g_cond_broadcast(&feeder_cond_);
+  }
+  g_mutex_unlock(&feeder_mutex_);
+}
+
+GstBuffer* MediaSourcePipeline::CreateBuffer(const AVFrame& frame) {
+  GstBuffer* gst_buffer = NULL;
+  if (frame.release_) {
+    // the buffer keeps the segment mapping or pool block alive until
+    // gstreamer is done with it
+    gst_buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+                                             frame.data_,
+                                             frame.size_,
+                                             0,
+                                             frame.size_,
+                                             frame.owner_,
+                                             frame.release_);
+  } else {
+    gst_buffer = gst_buffer_new_wrapped(frame.data_, frame.size_);
+  }
+  GST_BUFFER_PTS(gst_buffer) = (frame.pts_us_ - seek_offset_) * 1000;
+  // frames decoded ahead of the segment start would get a negative dts, leave
+  // those to the decoder
+  if (frame.dts_us_ != kTimestampNone && frame.dts_us_ >= seek_offset_)
+    GST_BUFFER_DTS(gst_buffer) = (frame.dts_us_ - seek_offset_) * 1000;
+  if (frame.duration_us_ > 0)
+    GST_BUFFER_DURATION(gst_buffer) = frame.duration_us_ * 1000;
+
+  // only scanned video frames are known not to be keyframes
+  if ((frame.flags_ & kFrameFlagScanned) && !(frame.flags_ & kFrameFlagKeyframe))
+    GST_BUFFER_FLAG_SET(gst_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  if (frame.flags_ & kFrameFlagNonReference)
+    GST_BUFFER_FLAG_SET(gst_buffer, GST_BUFFER_FLAG_DROPPABLE);
+  return gst_buffer;
+}
+
 bool MediaSourcePipeline::PushFrameToAppSrc(const AVFrame& frame, AVType type) {
   GstFlowReturn ret = GST_FLOW_OK;
 
-  GstBuffer* gst_buffer = gst_buffer_new_wrapped(frame.data_, frame.size_);
-  GstSample* sample = NULL;
-  GST_BUFFER_TIMESTAMP(gst_buffer) = (frame.timestamp_us_ - seek_offset_) * 1000;
+  // the appsrc caps apply, so there is no need to wrap the buffer in a
+  // sample; the appsrc takes ownership of it
+  if (reposition_pending_[type]) {
+    ReleaseFrame(frame);
+    return false;
+  }
 
-  if (type == kVideo)
-  {
-     sample = gst_sample_new(gst_buffer, appsrc_caps_video_, NULL, NULL);
-     ret = gst_app_src_push_sample(GST_APP_SRC(appsrc_source_video_), sample);
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  int64_t push_start_us = g_get_monotonic_time();
+  ret = gst_app_src_push_buffer(appsrc, CreateBuffer(frame));
+
+  if (ret != GST_FLOW_OK) {
+    // a paused feeder thread gets unblocked with a flush
+    if (ret != GST_FLOW_FLUSHING)
+      fprintf(stderr, "APPSRC PUSH FAILED!\n");
+    return false;
   }
-  else  // kAudio
-  {
-     sample = gst_sample_new(gst_buffer, appsrc_caps_audio_, NULL, NULL);
-     ret = gst_app_src_push_sample(GST_APP_SRC(appsrc_source_audio_), sample);
+
+  metrics_.RecordPush(type, 1, frame.size_, g_get_monotonic_time() - push_start_us);
+  if (options_.live_ && type == SegmentEndTrack())
+    live_latency_.RecordPush((frame.pts_us_ - seek_offset_) * 1000, push_start_us);
+
+  OnFramePushed();
+
+  return true;
+}
+
+bool MediaSourcePipeline::UsesDemandFeed() const {
+  // unsynced headless sinks set the pace of a benchmark, a timer feed would
+  // only measure its own cadence
+  return options_.demand_feed_ || (options_.headless_ && !options_.headless_sync_);
+}
+
+bool MediaSourcePipeline::IsBatchFeeding() const {
+  return options_.batch_ms_ > 0 || options_.batch_bytes_ > 0;
+}
+
+bool MediaSourcePipeline::ReadFrameBatch(AVType type) {
+  int64_t batch_us = static_cast<int64_t>(options_.batch_ms_) * 1000;
+  int64_t first_pts_us = kTimestampNone;
+  uint64_t bytes = 0;
+  guint frames = 0;
+  ReadStatus read_status = kFrameRead;
+  GstBufferList* list = gst_buffer_list_new_sized(kInitialBatchSize);
+
+  while (true) {
+    // stop before the frame that would take the batch over its budget, but
+    // always send at least one frame
+    const FrameRecord* next = readers_[type].Peek();
+    // a batch doesn't span segments either, the next one may come with new
+    // caps which appsrc would apply to the whole list
+    if (frames > 0 && next == NULL)
+      break;
+    if (frames > 0) {
+      if (batch_us > 0 &&
+          next->pts_us_ + timeline_shift_us_[type] - first_pts_us >= batch_us)
+        break;
+      if (options_.batch_bytes_ > 0 &&
+          bytes + next->size_ > static_cast<uint64_t>(options_.batch_bytes_))
+        break;
+    }
+
+    AVFrame frame;
+    read_status = GetNextFrame(&frame, type);
+    if (read_status != kFrameRead)
+      break;
+
+    if (first_pts_us == kTimestampNone)
+      first_pts_us = frame.pts_us_;
+    bytes += frame.size_;
+    frames++;
+    gst_buffer_list_add(list, CreateBuffer(frame));
   }
 
-  gst_buffer_unref(gst_buffer);
-  gst_sample_unref(sample);
+  if (frames == 0 || reposition_pending_[type]) {
+    gst_buffer_list_unref(list);
+    return false;
+  }
 
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  int64_t push_start_us = g_get_monotonic_time();
+  GstFlowReturn ret = gst_app_src_push_buffer_list(appsrc, list);
   if (ret != GST_FLOW_OK) {
-    fprintf(stderr, "APPSRC PUSH FAILED!\n");
+    if (ret != GST_FLOW_FLUSHING)
+      fprintf(stderr, "APPSRC PUSH FAILED!\n");
     return false;
   }
+  metrics_.RecordPush(type, frames, bytes, g_get_monotonic_time() - push_start_us);
 
-  return true;
+  OnFramePushed();
+
+  return read_status == kFrameRead;
 }
 
-int64_t MediaSourcePipeline::GetCurrentStartTimeMicroseconds() const {
-  std::ostringstream counter_stream;
-  counter_stream << current_file_counter_;
-
-  std::string audio_timestamp_path =
-      frame_files_path_ + "/raw_audio_frames_" + counter_stream.str() + ".txt";
-  std::string video_timestamp_path =
-      frame_files_path_ + "/raw_video_frames_" + counter_stream.str() + ".txt";
-
-  FILE* audio_timestamp_file = fopen(audio_timestamp_path.c_str(), "r");
-  FILE* video_timestamp_file = fopen(video_timestamp_path.c_str(), "r");
-
-  int64_t smallest_time_ms = -1;
-
-  int64_t timestamp_us;
-  int32_t frame_size;
-  if (audio_timestamp_file) {
-    if (fscanf(audio_timestamp_file,
-               "%" PRId64 ",%d,",
-               &timestamp_us,
-               &frame_size) == 2) {
-      smallest_time_ms = timestamp_us;
+void MediaSourcePipeline::PrintFeedStats() {
+  int64_t now_us = g_get_monotonic_time();
+
+  for (int type = kAudio; type <= kVideo; type++) {
+    const TrackMetrics& track = metrics_.track(static_cast<AVType>(type));
+    uint64_t pushes = LoadCounter(track.pushes_);
+    uint64_t wakeups = LoadCounter(track.wakeups_);
+    if (pushes == 0)
+      continue;
+
+    double wakeups_per_sec = 0;
+    if (feed_report_us_ > 0 && now_us > feed_report_us_) {
+      wakeups_per_sec = (wakeups - feed_report_wakeups_[type]) *
+                        1000000.0 / (now_us - feed_report_us_);
     }
-    fclose(audio_timestamp_file);
-  }
-
-  if (video_timestamp_file) {
-    if (fscanf(video_timestamp_file,
-               "%" PRId64 ",%d,",
-               &timestamp_us,
-               &frame_size) == 2) {
-      if (smallest_time_ms == -1)
-        smallest_time_ms = timestamp_us;
-      else
-        smallest_time_ms = std::min(smallest_time_ms, timestamp_us);
+    feed_report_wakeups_[type] = wakeups;
+
+    printf("%s feed: %.1f frames/push, %.1f KB/push, %.1f wake-ups/s\n",
+           type == kVideo ? "video" : "audio",
+           static_cast<double>(LoadCounter(track.frames_)) / pushes,
+           LoadCounter(track.bytes_) / 1024.0 / pushes,
+           wakeups_per_sec);
+  }
+  feed_report_us_ = now_us;
+}
+
+FramePool& MediaSourcePipeline::frame_pool(AVType type) {
+  return type == kVideo ? video_frame_pool_ : audio_frame_pool_;
+}
+
+void MediaSourcePipeline::PrefetchNextSegmentIfNeeded() {
+  if (options_.prefetch_secs_ <= 0 || seeking_)
+    return;
+
+  const Segment* current = catalog_.segment(current_file_counter_);
+  if (current == NULL || current->start_pts_us_ == kTimestampNone)
+    return;
+
+  // start reading ahead once playback crosses prefetch_at_ of the segment
+  float start_secs = (options_.gapless_ ? current_timeline_start_us_
+                                        : current->start_pts_us_) /
+                     1000000.0f;
+  float trigger_secs =
+      start_secs + (current_end_time_secs_ - start_secs) * options_.prefetch_at_;
+  if (playback_position_secs_ < trigger_secs)
+    return;
+
+  // guess the next segment plays in the current rendition, OpenTrack()
+  // doesn't use the prefetch if the guess was wrong
+  int32_t next_counter = IsPlaybackOver() ? 0 : current_file_counter_ + 1;
+  const Segment* next = RenditionCatalog(abr_.current()).segment(next_counter);
+  if (next == NULL || prefetcher_.requested(next_counter))
+    return;
+
+#ifdef DEBUG_PRINTS
+  printf("prefetching segment %d at %f secs\n", next_counter,
+         playback_position_secs_);
+#endif
+  prefetch_rendition_ = abr_.current();
+  prefetcher_.Request(next_counter, RenditionCatalog(abr_.current()));
+}
+
+void MediaSourcePipeline::OnFramePushed() {
+  MarkStartup(kStartupFirstPush);
+  if (!segment_switch_start_us_)
+    return;
+
+  if (!UsesFeederThreads()) {
+    segment_switch_end_us_ = g_get_monotonic_time();
+    EndSegmentSwitch();
+    return;
+  }
+
+  // the first feeder thread to push reports the switch from the main context
+  if (g_atomic_int_compare_and_exchange(&segment_switch_end_posted_, 0, 1)) {
+    segment_switch_end_us_ = g_get_monotonic_time();
+    g_idle_add(reinterpret_cast<GSourceFunc>(EndSegmentSwitchStatic), this);
+  }
+}
+
+void MediaSourcePipeline::EndSegmentSwitch() {
+  if (!segment_switch_start_us_)
+    return;
+
+  PrefetchStats& stats = prefetcher_.stats();
+  int64_t gap_us = segment_switch_end_us_ - segment_switch_start_us_;
+  segment_switch_start_us_ = 0;
+
+  stats.boundaries_++;
+  stats.total_gap_us_ += gap_us;
+  stats.max_gap_us_ = std::max(stats.max_gap_us_, gap_us);
+
+  printf("Segment %d switch gap: %.1f ms (prefetch hits:%u misses:%u, "
+         "avg gap:%.1f ms, max gap:%.1f ms)\n",
+         current_file_counter_,
+         gap_us / 1000.0,
+         stats.hits_,
+         stats.misses_,
+         stats.total_gap_us_ / 1000.0 / stats.boundaries_,
+         stats.max_gap_us_ / 1000.0);
+}
+
+int64_t MediaSourcePipeline::GetCurrentStartTimeMicroseconds() const {
+  const Segment* segment = catalog_.segment(current_file_counter_);
+  if (segment == NULL || segment->start_pts_us_ == kTimestampNone)
+    return -1;
+
+  return segment->start_pts_us_;
+}
+
+bool MediaSourcePipeline::UpdateSegmentCatalog() {
+  // the catalogs are only rebuilt when a frame files directory changes
+  bool stale = catalog_.empty() || catalog_.IsStale();
+  for (size_t i = 1; i < rendition_catalogs_.size(); i++)
+    stale = stale || rendition_catalogs_[i].IsStale();
+  if (!stale)
+    return true;
+
+  return BuildSegmentCatalogs();
+}
+
+bool MediaSourcePipeline::BuildSegmentCatalogs() {
+  std::vector<Rendition> renditions = FindRenditions(frame_files_path_);
+  rendition_catalogs_.clear();
+  if (renditions.empty()) {
+    abr_.Configure(renditions, options_.abr_);
+    return catalog_.Build(frame_files_path_);
+  }
+
+  if (!catalog_.Build(renditions[0].dir_))
+    return false;
+
+  // switching renditions keeps the segment counter, so they must all be cut
+  // the same way
+  rendition_catalogs_.resize(renditions.size());
+  for (size_t i = 1; i < renditions.size(); i++) {
+    if (!rendition_catalogs_[i].Build(renditions[i].dir_) ||
+        rendition_catalogs_[i].size() != catalog_.size()) {
+      fprintf(stderr, "Ignoring rendition %s and up, its segments don't "
+              "match those of %s\n", renditions[i].dir_.c_str(),
+              renditions[0].dir_.c_str());
+      renditions.resize(i);
+      rendition_catalogs_.resize(i);
+      break;
     }
-    fclose(video_timestamp_file);
   }
 
-  return smallest_time_ms;
+  abr_.Configure(renditions, options_.abr_);
+  track_renditions_[kAudio] = track_renditions_[kVideo] = abr_.current();
+  prefetcher_.Reset();
+  return true;
+}
+
+const SegmentCatalog& MediaSourcePipeline::RenditionCatalog(
+    size_t rendition) const {
+  return rendition == 0 || rendition >= rendition_catalogs_.size()
+             ? catalog_
+             : rendition_catalogs_[rendition];
+}
+
+int64_t MediaSourcePipeline::BufferedUs() const {
+  int64_t pts_us = last_read_pts_us_[kVideo];
+  if (pts_us == kTimestampNone)
+    pts_us = last_read_pts_us_[kAudio];
+  if (pts_us == kTimestampNone)
+    return -1;
+  return std::max<int64_t>(
+      0, pts_us - playback_position_us_);
 }
 
 void MediaSourcePipeline::CalculateCurrentEndTime() {
-  std::ostringstream counter_stream;
-  counter_stream << current_file_counter_;
   current_end_time_secs_ = 0;
-  bool have_audio = false;
-  bool have_video = false;
-
-  std::string audio_timestamp_path =
-      frame_files_path_ + "/raw_audio_frames_" + counter_stream.str() + ".txt";
-  std::string video_timestamp_path =
-      frame_files_path_ + "/raw_video_frames_" + counter_stream.str() + ".txt";
 
-  FILE* audio_timestamp_file = fopen(audio_timestamp_path.c_str(), "r");
-  FILE* video_timestamp_file = fopen(video_timestamp_path.c_str(), "r");
+  const Segment* segment = catalog_.segment(current_file_counter_);
+  if (segment == NULL)
+    return;
 
+  bool have_audio = segment->tracks_[kAudio].present();
+  bool have_video = segment->tracks_[kVideo].present();
   float greatest_time_secs = 0;
-  float greatest_video_time_secs = 0;
-  float greatest_audio_time_secs = 0;
-
-  int64_t timestamp_us;
-  int32_t frame_size;
-  if (audio_timestamp_file) {
-    while (fscanf(audio_timestamp_file,
-                  "%" PRId64 ",%d,",
-                  &timestamp_us,
-                  &frame_size) == 2) {
-      float timestamp_secs = timestamp_us / 1000000.0f;
-      if (greatest_audio_time_secs < timestamp_secs)
-        greatest_audio_time_secs = timestamp_secs;
-    }
-    fclose(audio_timestamp_file);
-    have_audio = true;
-  }
-
-  if (video_timestamp_file) {
-    while (fscanf(video_timestamp_file,
-                  "%" PRId64 ",%d,",
-                  &timestamp_us,
-                  &frame_size) == 2) {
-      float timestamp_secs = timestamp_us / 1000000.0f;
-      if (greatest_video_time_secs < timestamp_secs)
-        greatest_video_time_secs = timestamp_secs;
-    }
-    fclose(video_timestamp_file);
-    have_video = true;
-  }
 
-  if (greatest_audio_time_secs > 0 && greatest_video_time_secs > 0)
-    greatest_time_secs =
-        std::min(greatest_audio_time_secs, greatest_video_time_secs);
-  else if (greatest_audio_time_secs > 0)
-    greatest_time_secs = greatest_audio_time_secs;
-  else if (greatest_video_time_secs > 0)
-    greatest_time_secs = greatest_video_time_secs;
+  if (segment->end_pts_us_ != kTimestampNone)
+    greatest_time_secs = segment->end_pts_us_ / 1000000.0f;
 
 #ifdef DEBUG_PRINTS
   printf("calculated end time, counter:%d, end time:%f\n",
          current_file_counter_,
          greatest_time_secs);
-  printf("greatest audio time:%f, greatest video time:%f\n",
-         greatest_audio_time_secs,
-         greatest_video_time_secs);
 #endif
 
   if(have_audio && have_video)
@@ -699,25 +1972,28 @@ void MediaSourcePipeline::CalculateCurrentEndTime() {
     current_end_time_secs_ = greatest_time_secs;
 }
 
-void MediaSourcePipeline::ResetPlaybackHistory() {
-  for (int i = 0; i < kPlaybackPositionHistorySize; i++)
-    playback_position_history_[i] = -1;
-}
-
 void MediaSourcePipeline::PerformSeek() {
   // put us in a seeking state and stop any reading of the current file(s)
   seeking_ = true;
-  playback_started_ = false;
-  bool did_pause = false;
-  ResetPlaybackHistory();
+  segment_switch_start_us_ = g_get_monotonic_time();
+  qos_.NoteSegmentTransition();
+  g_atomic_int_set(&segment_switch_end_posted_, 0);
   StopFeedingAppSource(appsrc_source_video_);
   StopFeedingAppSource(appsrc_source_audio_);
   CloseAllFiles();
 
   // go to the next file(s), and calculate the end time of the file av segment
   current_file_counter_++;
+  ResetTracks();
   CalculateCurrentEndTime();
 
+  seek_offset_ = GetCurrentStartTimeMicroseconds();
+  FlushAndRestartFeeding();
+}
+
+void MediaSourcePipeline::FlushAndRestartFeeding() {
+  bool did_pause = false;
+
   if(pause_before_seek_) {
     if (is_playing_) {
         did_pause = true;
@@ -729,10 +2005,8 @@ void MediaSourcePipeline::PerformSeek() {
   // have gstreamer perform a seek
   gboolean seek_succeeded = FALSE;
 
-  int64_t seek_time_us = GetCurrentStartTimeMicroseconds();
-  seek_offset_ = seek_time_us;
   GstClockTime seek_time_ns =
-      seek_time_us * 1000;  // GstClockTime is a time in nanoseconds
+      seek_offset_ * 1000;  // GstClockTime is a time in nanoseconds
 
 /*
   seek_succeeded = gst_element_seek(
@@ -747,11 +2021,11 @@ void MediaSourcePipeline::PerformSeek() {
   */
 
   // A seek is just a flush of the pipeline
-  seek_succeeded = gst_element_send_event(source_, gst_event_new_flush_start());
+  seek_succeeded = gst_element_send_event(FlushTarget(), gst_event_new_flush_start());
   if (!seek_succeeded)
     printf("failed to send flush-start event\n");
 
-  seek_succeeded = gst_element_send_event(source_, gst_event_new_flush_stop(TRUE));
+  seek_succeeded = gst_element_send_event(FlushTarget(), gst_event_new_flush_stop(TRUE));
   if (!seek_succeeded)
     printf("failed to send flush-stop event\n");
 
@@ -762,7 +2036,9 @@ void MediaSourcePipeline::PerformSeek() {
     // mse source performing its own seek before we can
     // starting reading data again
 
-    g_timeout_add(kChunkDemuxerSeekDelayMs,
+    // with network emulation the latency of the seek is paid by the request
+    // for the first frames of the new segment instead
+    g_timeout_add(network_.enabled() ? 0 : kChunkDemuxerSeekDelayMs,
                   reinterpret_cast<GSourceFunc>(ChunkDemuxerSeekStatic),
                   this);
   }
@@ -790,68 +2066,218 @@ void MediaSourcePipeline::DoPause() {
 }
 
 void MediaSourcePipeline::CloseAllFiles() {
-  if (current_video_file_)
-    fclose(current_video_file_);
-  if (current_video_timestamp_file_)
-    fclose(current_video_timestamp_file_);
-  if (current_audio_file_)
-    fclose(current_audio_file_);
-  if (current_audio_timestamp_file_)
-    fclose(current_audio_timestamp_file_);
+  readers_[kAudio].Close();
+  readers_[kVideo].Close();
+
+  // frames still on the emulated link belong to the segment being left
+  for (int type = kAudio; type <= kVideo; type++) {
+    if (has_pending_frame_[type])
+      ReleaseFrame(pending_frames_[type]);
+    has_pending_frame_[type] = false;
+  }
+  network_.Cancel(g_get_monotonic_time());
+}
+
+bool MediaSourcePipeline::OpenTrack(AVType type, bool use_prefetched) {
+  FrameReader& reader = readers_[type];
+
+  // renditions only change at segment boundaries. A track positioned by a
+  // seek stays in the rendition its start frame was picked from
+  if (start_frames_[type] == 0)
+    track_renditions_[type] = ChooseRendition(type);
+
+  const SegmentCatalog& catalog = RenditionCatalog(track_renditions_[type]);
+  const Segment* segment = catalog.segment(track_counters_[type]);
+  if (segment == NULL || !segment->tracks_[type].present())
+    return false;
+
+  const SegmentTrack& track = segment->tracks_[type];
+  if (!reader.Open(track.index_, catalog.OpenPayload(track),
+                   options_.use_mmap_))
+    return false;
+
+  // a seek may have picked a keyframe to start from
+  reader.SeekTo(start_frames_[type]);
+  start_frames_[type] = 0;
+  metrics_.RecordSegment(type);
 
-  current_video_file_ = current_video_timestamp_file_ = current_audio_file_ =
-      current_audio_timestamp_file_ = NULL;
+  UpdateAppSourceCaps(type, track.index_->caps());
+
+  // serve the start of the segment from memory if it was read ahead
+  if (use_prefetched && options_.prefetch_secs_ > 0 &&
+      track_renditions_[type] == prefetch_rendition_) {
+    FrameMapping* block = prefetcher_.Take(track_counters_[type], type);
+    if (block) {
+      reader.SetPrefetched(block);
+      block->Unref();
+    }
+  }
+
+  if (options_.gapless_) {
+    // place the segment right after the previous one on the timeline, which
+    // starts where the first segment does
+    timeline_shift_us_[type] = loop_offset_us_[type] +
+                               segment->timeline_start_us_ +
+                               catalog_.segment(0)->start_pts_us_ -
+                               segment->start_pts_us_;
+
+    // let StatusPoll know when playback gets to this segment
+    int64_t start_us = segment->start_pts_us_ + timeline_shift_us_[type];
+    g_mutex_lock(&feeder_mutex_);
+    if (timeline_segments_.empty() || timeline_segments_.back().first < start_us)
+      timeline_segments_.push_back(std::make_pair(start_us, track_counters_[type]));
+    g_mutex_unlock(&feeder_mutex_);
+  }
+
+  return true;
 }
 
-ReadStatus MediaSourcePipeline::GetNextFrame(AVFrame* frame, AVType type) {
-  FILE* current_file = NULL;
-  FILE* current_timestamp_file = NULL;
-  std::ostringstream counter_stream;
-  counter_stream << current_file_counter_;
-
-  if (type == kAudio) {
-    if (current_audio_file_ == NULL) {
-      std::string audio_path = frame_files_path_ + "/raw_audio_frames_" +
-                               counter_stream.str() + ".bin";
-      std::string audio_timestamp_path = frame_files_path_ +
-                                         "/raw_audio_frames_" +
-                                         counter_stream.str() + ".txt";
-      current_audio_file_ = fopen(audio_path.c_str(), "rb");
-      current_audio_timestamp_file_ = fopen(audio_timestamp_path.c_str(), "r");
+size_t MediaSourcePipeline::ChooseRendition(AVType type) {
+  std::pair<int64_t, int32_t> segment(loop_offset_us_[type],
+                                      track_counters_[type]);
+  size_t rendition = abr_.current();
+
+  // both tracks of a segment play the same rendition, whichever opens it
+  // first decides. Outside gapless mode every boundary flushes the
+  // pipeline, so there is no buffer to weigh against the estimate
+  g_mutex_lock(&feeder_mutex_);
+  bool decided = false;
+  for (size_t i = 0; i < segment_renditions_.size() && !decided; i++) {
+    if (segment_renditions_[i].first == segment) {
+      rendition = segment_renditions_[i].second;
+      decided = true;
     }
-    current_file = current_audio_file_;
-    current_timestamp_file = current_audio_timestamp_file_;
-  } else {  // video
-    if (current_video_file_ == NULL) {
-      std::string video_path = frame_files_path_ + "/raw_video_frames_" +
-                               counter_stream.str() + ".bin";
-      std::string video_timestamp_path = frame_files_path_ +
-                                         "/raw_video_frames_" +
-                                         counter_stream.str() + ".txt";
-      current_video_file_ = fopen(video_path.c_str(), "rb");
-      current_video_timestamp_file_ = fopen(video_timestamp_path.c_str(), "r");
+  }
+  if (!decided) {
+    if (abr_.enabled())
+      rendition = abr_.Choose(segment.second,
+                              options_.gapless_ ? BufferedUs() : -1);
+    segment_renditions_.push_back(std::make_pair(segment, rendition));
+    if (segment_renditions_.size() > kRememberedRenditions)
+      segment_renditions_.pop_front();
+  }
+  g_mutex_unlock(&feeder_mutex_);
+  return rendition;
+}
+
+void MediaSourcePipeline::UpdateAppSourceCaps(AVType type,
+                                              const std::string& caps) {
+  GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+  std::string wanted = caps;
+  if (wanted.empty())
+    wanted = (type == kVideo) ? kDefaultVideoCaps : kDefaultAudioCaps;
+  if (appsrc == NULL || wanted == appsrc_caps_[type])
+    return;
+
+  GstCaps* gst_caps = gst_caps_from_string(wanted.c_str());
+  if (gst_caps == NULL) {
+    fprintf(stderr, "Invalid %s caps: %s\n",
+            type == kVideo ? "video" : "audio", wanted.c_str());
+    return;
+  }
+
+  // appsrc sends the new caps ahead of the next buffer it is given
+  gst_app_src_set_caps(appsrc, gst_caps);
+  gst_caps_unref(gst_caps);
+  if (!appsrc_caps_[type].empty())
+    printf("%s caps changed: %s\n", type == kVideo ? "Video" : "Audio",
+           wanted.c_str());
+  appsrc_caps_[type] = wanted;
+}
+
+bool MediaSourcePipeline::AppendNextSegment(AVType type) {
+  readers_[type].Close();
+
+  // skip segments missing the track, but don't go round more than once
+  for (size_t i = 0; i < catalog_.size(); i++) {
+    track_counters_[type]++;
+    if (catalog_.segment(track_counters_[type]) == NULL) {
+      track_counters_[type] = 0;
+      loop_offset_us_[type] += catalog_.duration_us();
     }
-    current_file = current_video_file_;
-    current_timestamp_file = current_video_timestamp_file_;
+
+    if (OpenTrack(type, true))
+      return true;
   }
 
-  if (current_file == NULL || current_timestamp_file == NULL)
+  return false;
+}
+
+ReadStatus MediaSourcePipeline::GetNextFrame(AVFrame* frame, AVType type) {
+  FrameReader& reader = readers_[type];
+
+  // RepositionAppSource() restarts the feed
+  if (reposition_pending_[type])
+    return kDone;
+
+  if (!reader.is_open() && !OpenTrack(type, segment_switch_start_us_ != 0))
     return kDone;
 
-  // read data from both the timestamp file and the raw frames file
-  // if we fail reading either assume we are at the end of the file
-  // and we need to peform a seek (aka read the next timestamp/datafile)
-  int ret = fscanf(current_timestamp_file,
-                   "%" PRId64 ",%d,",
-                   &frame->timestamp_us_,
-                   &frame->size_);
-  if (ret != 2)
+  // the whole segment index is loaded when the reader is opened, so running
+  // off its end means we need to peform a seek (aka read the next segment),
+  // or in gapless mode just carry on with the next one
+  const FrameRecord* record = reader.Peek();
+  // open GOP frames that decode after the start keyframe but are shown
+  // before it can't be decoded, and would wrap below seek_offset_
+  while (record != NULL &&
+         record->pts_us_ + timeline_shift_us_[type] < seek_offset_) {
+    reader.Skip();
+    record = reader.Peek();
+  }
+  if (record == NULL && options_.gapless_) {
+    // the next segment pushes the reordered frames out, only the end of
+    // the content needs a drain
+    if (!AppendNextSegment(type)) {
+      EndTrack(type);
+      return kDone;
+    }
+    record = reader.Peek();
+  }
+
+  // batches stop short of the end, so everything read is pushed by now
+  if (record == NULL) {
+    EndTrack(type);
+    CheckSegmentEnd();
     return kPerformSeek;
+  }
+
+  frame->pts_us_ = record->pts_us_ + timeline_shift_us_[type];
+  frame->dts_us_ = record->dts_us_ == kTimestampNone
+                       ? kTimestampNone
+                       : record->dts_us_ + timeline_shift_us_[type];
+  frame->duration_us_ = record->duration_us_;
+  frame->size_ = record->size_;
+  frame->flags_ = record->flags_;
+  frame->owner_ = NULL;
+  frame->release_ = NULL;
+  last_read_pts_us_[type] = frame->pts_us_;
+  // the frame presented last marks the end of the segment
+  if (max_fed_pts_us_[type] == kTimestampNone ||
+      frame->pts_us_ > max_fed_pts_us_[type]) {
+    max_fed_pts_us_[type] = frame->pts_us_;
+    max_fed_duration_us_[type] = frame->duration_us_;
+  }
+
+  // single reads are too short to tell the bandwidth, the prefetcher and the
+  // emulated network feed the estimate
+  if (reader.is_mapped()) {
+    // zero copy, the frame points straight into the page cache
+    FrameMapping* mapping = NULL;
+    frame->data_ = const_cast<guint8*>(reader.ReadMapped(&mapping));
+    frame->owner_ = mapping;
+    frame->release_ = FrameMappingUnrefStatic;
+    return kFrameRead;
+  }
+
+  if (options_.use_frame_pool_) {
+    frame->data_ = frame_pool(type).Alloc(
+        frame->size_, &frame->owner_, &frame->release_);
+  } else {
+    frame->data_ = static_cast<guint8*>(g_malloc(frame->size_));
+  }
 
-  frame->data_ = static_cast<guint8*>(g_malloc(frame->size_));
-  ret = fread(frame->data_, 1, frame->size_, current_file);
-  if (ret != frame->size_) {
-    g_free(frame->data_);
+  if (!reader.Read(frame->data_)) {
+    ReleaseFrame(*frame);
     return kPerformSeek;
   }
 
@@ -862,8 +2288,8 @@ ReadStatus MediaSourcePipeline::GetNextFrame(AVFrame* frame, AVType type) {
 bool MediaSourcePipeline::Build()
 {
   source_ = NULL;
-  appsrc_caps_video_ = NULL;
-  appsrc_caps_audio_ = NULL; 
+  appsrc_caps_[kAudio].clear();
+  appsrc_caps_[kVideo].clear();
   appsrc_source_video_ = (GstAppSrc*) gst_element_factory_make("appsrc", NULL);
   appsrc_source_audio_ = (GstAppSrc*) gst_element_factory_make("appsrc", NULL);
 
@@ -892,6 +2318,42 @@ bool MediaSourcePipeline::Build()
                GST_FORMAT_TIME,
                NULL);
 
+  if (UsesFeederThreads()) {
+    g_object_set(G_OBJECT(appsrc_source_video_), "block", TRUE, NULL);
+    g_object_set(G_OBJECT(appsrc_source_audio_), "block", TRUE, NULL);
+  }
+
+  if (options_.live_) {
+    // frames come in paced to the clock, so the queues only need to bridge
+    // a wake-up; the watermarks give their size
+    gint64 latency_ns = options_.live_latency_ms_ * GST_MSECOND;
+    for (int type = kAudio; type <= kVideo; type++) {
+      GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+      g_object_set(G_OBJECT(appsrc),
+                   "is-live", TRUE,
+                   "min-latency", latency_ns,
+                   "max-latency", latency_ns,
+                   "max-bytes", static_cast<guint64>(options_.watermarks_[type].high_bytes_),
+                   NULL);
+    }
+  }
+
+  if (UsesDemandFeed()) {
+    // enough-data fires at the high watermark and need-data once the level
+    // drops under the low one, which gives the feed its hysteresis
+    for (int type = kAudio; type <= kVideo; type++) {
+      const FeedWatermarks& marks = options_.watermarks_[type];
+      GstAppSrc* appsrc = (type == kVideo) ? appsrc_source_video_ : appsrc_source_audio_;
+      guint min_percent = marks.high_bytes_
+          ? static_cast<guint>(marks.low_bytes_ * 100 / marks.high_bytes_)
+          : 0;
+      g_object_set(G_OBJECT(appsrc),
+                   "max-bytes", static_cast<guint64>(marks.high_bytes_),
+                   "min-percent", min_percent,
+                   NULL);
+    }
+  }
+
   g_signal_connect(
       appsrc_source_video_, "seek-data", G_CALLBACK(SeekDataStatic), this);
 
@@ -905,15 +2367,34 @@ bool MediaSourcePipeline::Build()
   //gchar* caps_string_video = g_strdup_printf("video/x-h264, stream-format=(string)avc, alignment=(string)au, level=(string)3.1, profile=(string)main, codec_data=(buffer)014d401fffe1001c674d401fe8802802dd80b501010140000003004000000c03c60c448001000468ebef20, width=(int)1280, height=(int)720, pixel-aspect-ratio=(fraction)1/1, framerate=(fraction)100000/4201");
   //gchar* caps_string_audio = g_strdup_printf("audio/mpeg, mpegversion=(int)4, framed=(boolean)true, stream-format=(string)raw, level=(string)2, base-profile=(string)lc, profile=(string)lc, codec_data=(buffer)1210, rate=(int)44100, channels=(int)2");
 
-  // rdk video caps
-  gchar* caps_string_video = g_strdup_printf("video/x-h264, stream-format=(string)avc, alignment=(string)au, level=(string)3.1, profile=(string)main, codec_data=(buffer)014d401fffe1001b674d401fe8802802dd80b5010101400000fa40003a9803c60c448001000468ebaf20, width=(int)1280, height=(int)720, pixel-aspect-ratio=(fraction)1/1, framerate=(fraction)100000/3357");
-  gchar* caps_string_audio = g_strdup_printf("audio/mpeg, mpegversion=(int)4, framed=(boolean)true, stream-format=(string)raw, level=(string)2, base-profile=(string)lc, profile=(string)lc, codec_data=(buffer)1210, rate=(int)44100, channels=(int)2");
+  // buffers carry no caps, so the appsrcs need those of the first segment up
+  // front; OpenTrack() changes them when a later segment differs
+  const Segment* segment = catalog_.segment(current_file_counter_);
+  for (int type = kAudio; type <= kVideo; type++) {
+    std::string caps;
+    if (segment && segment->tracks_[type].present())
+      caps = segment->tracks_[type].index_->caps();
+    UpdateAppSourceCaps(static_cast<AVType>(type), caps);
+  }
+
+  if (options_.headless_) {
+    if (!BuildHeadless())
+      return false;
+  } else {
+    BuildPlaybin();
+  }
+
+  GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
+  gst_bus_add_signal_watch(bus);
+  g_signal_connect(bus, "message", G_CALLBACK(MessageCallbackStatic), this);
+  gst_object_unref(bus);
 
-  appsrc_caps_video_ = gst_caps_from_string(caps_string_video);
-  appsrc_caps_audio_ = gst_caps_from_string(caps_string_audio);
-  g_free(caps_string_video);
-  g_free(caps_string_audio);
+  MarkStartup(kStartupBuild);
+  return true;
+}
 
+void MediaSourcePipeline::BuildPlaybin()
+{
   GstElementFactory* src_factory = gst_element_factory_find("msesrc");
   if (!src_factory) {
      gst_element_register(0, "msesrc", GST_RANK_PRIMARY + 100, GST_MSE_TYPE_SRC);
@@ -933,70 +2414,265 @@ bool MediaSourcePipeline::Build()
   {
      g_object_set( G_OBJECT( video_sink_ ), "secure-video", true, NULL );
   }
+  if( !options_.video_rectangle_.empty() &&
+      g_object_class_find_property( G_OBJECT_GET_CLASS( video_sink_ ), "rectangle" ) )
+  {
+     g_object_set( G_OBJECT( video_sink_ ), "rectangle", options_.video_rectangle_.c_str(), NULL );
+  }
+  // have the sink report late and dropped frames, see QosAnalyzer
+  if( g_object_class_find_property( G_OBJECT_GET_CLASS( video_sink_ ), "qos" ) )
+  {
+     g_object_set( G_OBJECT( video_sink_ ), "qos", true, NULL );
+  }
 
   unsigned flagAudio = getGstPlayFlag("audio");
   unsigned flagVideo = getGstPlayFlag("video");
   unsigned flagNativeVideo = getGstPlayFlag("native-video");
   unsigned flagBuffering = getGstPlayFlag("buffering");
 
-  g_object_set(pipeline_, "uri", "mse://", "flags", flagAudio | flagVideo | flagNativeVideo | flagBuffering, NULL);
+  // buffering would hold a live pipeline in PAUSED until its queues fill
+  unsigned flags = flagAudio | flagVideo | flagNativeVideo;
+  if (!options_.live_)
+    flags |= flagBuffering;
 
-  GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
-  gst_bus_add_signal_watch(bus);
-  g_signal_connect(bus, "message", G_CALLBACK(MessageCallbackStatic), this);
-  gst_object_unref(bus);
+  g_object_set(pipeline_, "uri", "mse://", "flags", flags, NULL);
+}
+
+bool MediaSourcePipeline::BuildHeadless()
+{
+  pipeline_ = gst_pipeline_new(NULL);
 
+  if (pipeline_type_ != kAudioOnly) {
+    video_sink_ = gst_element_factory_make("fakesink", "vsink");
+    if (!AddHeadlessTrack(GST_ELEMENT(appsrc_source_video_), video_sink_,
+                          &ms_video_pipeline_))
+      return false;
+  }
+
+  if (pipeline_type_ != kVideoOnly) {
+    // fakeaudiosink only exists in newer gstreamer versions
+    audio_sink_ = gst_element_factory_make("fakeaudiosink", "asink");
+    if (audio_sink_ == NULL)
+      audio_sink_ = gst_element_factory_make("fakesink", "asink");
+    if (!AddHeadlessTrack(GST_ELEMENT(appsrc_source_audio_), audio_sink_,
+                          &ms_audio_pipeline_))
+      return false;
+  }
+
+  // the appsrcs are linked from the start, so is playback
+  MarkStartup(kStartupPadLink);
+  WatchForFirstFrame();
+  WatchForSegmentEnd();
+  WatchLiveLatency();
   return true;
 }
 
+bool MediaSourcePipeline::AddHeadlessTrack(GstElement* appsrc,
+                                           GstElement* sink,
+                                           std::vector<GstElement*>* chain)
+{
+  g_object_set(G_OBJECT(sink), "sync", options_.headless_sync_ ? TRUE : FALSE, NULL);
+  gst_bin_add_many(GST_BIN(pipeline_), appsrc, sink, NULL);
+  if (!options_.software_decode_) {
+    if (gst_element_link(appsrc, sink))
+      return true;
+    fprintf(stderr, "Couldn't link appsrc to the headless sink\n");
+    return false;
+  }
+
+  GstElement* decoder = gst_element_factory_make("decodebin", NULL);
+  if (decoder == NULL) {
+    fprintf(stderr, "Couldn't create decodebin for software decoding\n");
+    return false;
+  }
+  gst_bin_add(GST_BIN(pipeline_), decoder);
+
+  // decodebin adds its source pad once it found a decoder, which then gets
+  // linked with the next element of the chain
+  chain->clear();
+  chain->push_back(decoder);
+  chain->push_back(sink);
+  g_signal_connect(decoder, "pad-added",
+                   G_CALLBACK(OnAutoPadAddedMediaSourceStatic), this);
+  if (gst_element_link(appsrc, decoder))
+    return true;
+  fprintf(stderr, "Couldn't link appsrc to decodebin\n");
+  return false;
+}
+
+GstElement* MediaSourcePipeline::FlushTarget() const
+{
+  return options_.headless_ ? pipeline_ : source_;
+}
+
 void MediaSourcePipeline::StopAllTimeouts()
 {
   seeking_ = true;
-  g_source_remove(status_timeout_handle_);
+  if (status_timeout_handle_) {
+    g_source_remove(status_timeout_handle_);
+    status_timeout_handle_ = 0;
+  }
+  if (stats_timeout_handle_) {
+    g_source_remove(stats_timeout_handle_);
+    stats_timeout_handle_ = 0;
+  }
   StopFeedingAppSource(appsrc_source_video_);
   StopFeedingAppSource(appsrc_source_audio_);
+  if (dispatch_probe_.running()) {
+    dispatch_probe_.PrintStats(UsesFeederThreads() ? "[feeder threads]"
+                                                   : "[main loop feed]");
+    dispatch_probe_.Stop();
+  }
+  ResetSegmentEnd();
 }
 
 void MediaSourcePipeline::Destroy() {
+  if (BeginTeardown()) {
+    RunTeardown(false);
+    FinishTeardown();
+  }
+}
+
+void MediaSourcePipeline::Stop() {
+  Destroy();
+  prefetcher_.Reset();
+}
+
+void MediaSourcePipeline::DestroyAsync() {
+  if (BeginTeardown()) {
+    teardown_done_handle_ = 0;
+    teardown_thread_ = g_thread_new("teardown", TeardownThreadStatic, this);
+  }
+}
+
+bool MediaSourcePipeline::BeginTeardown() {
+  WaitForTeardown();
   StopAllTimeouts();
+  StopFeederThreads();
   CloseAllFiles();
 
-  if (pipeline_) {
-    GstState state;
-    GstState pending;
+  if (!pipeline_)
+    return false;
 
-    // clear out the pipeline
-    gst_element_set_state (pipeline_, GST_STATE_NULL);
-    gst_element_get_state (pipeline_,&state,&pending,GST_CLOCK_TIME_NONE);
-    while (state!=GST_STATE_NULL) {
-        gst_element_get_state (pipeline_,&state,&pending,GST_CLOCK_TIME_NONE);
-        usleep(10000);
-    }
-    gst_object_unref(GST_OBJECT(pipeline_));
+  // nothing from the old pipeline may call back in once it's detached
+  GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
+  g_signal_handlers_disconnect_by_data(bus, this);
+  gst_bus_remove_signal_watch(bus);
+  gst_object_unref(bus);
+  g_signal_handlers_disconnect_by_data(pipeline_, this);
+  g_signal_handlers_disconnect_by_data(appsrc_source_video_, this);
+  g_signal_handlers_disconnect_by_data(appsrc_source_audio_, this);
 
-    if (source_)
-      gst_object_unref(source_);
-    if (appsrc_caps_video_)
-      gst_caps_unref(appsrc_caps_video_);
-    if (appsrc_caps_audio_)
-      gst_caps_unref(appsrc_caps_audio_);
+  if (end_probe_pad_) {
+    gst_pad_remove_probe(end_probe_pad_, end_probe_id_);
+    gst_object_unref(end_probe_pad_);
+  }
+  if (live_probe_pad_) {
+    gst_pad_remove_probe(live_probe_pad_, live_probe_id_);
+    gst_object_unref(live_probe_pad_);
+  }
+
+  teardown_pipeline_ = pipeline_;
+  teardown_source_ = source_;
+  teardown_start_us_ = g_get_monotonic_time();
+
+  pipeline_ = NULL;
+  appsrc_source_video_ = NULL;
+  appsrc_source_audio_ = NULL;
+  video_sink_ = NULL;
+  audio_sink_ = NULL;
+  source_ = NULL;
+  end_probe_pad_ = NULL;
+  live_probe_pad_ = NULL;
+  appsrc_caps_[kAudio].clear();
+  appsrc_caps_[kVideo].clear();
+  return true;
+}
+
+void MediaSourcePipeline::RunTeardown(bool post_done) {
+  // clear out the pipeline; going to NULL doesn't return before every
+  // element got there, the wait only guards against one finishing async
+  gst_element_set_state(teardown_pipeline_, GST_STATE_NULL);
+  gst_element_get_state(teardown_pipeline_, NULL, NULL, GST_CLOCK_TIME_NONE);
+  gst_object_unref(GST_OBJECT(teardown_pipeline_));
+  if (teardown_source_)
+    gst_object_unref(teardown_source_);
+  teardown_end_us_ = g_get_monotonic_time();
+
+  if (post_done) {
+    teardown_done_handle_ =
+        g_idle_add(reinterpret_cast<GSourceFunc>(TeardownDoneStatic), this);
+  }
+}
+
+gboolean MediaSourcePipeline::OnTeardownDone() {
+  // the thread is done once it has posted this
+  g_thread_join(teardown_thread_);
+  teardown_thread_ = NULL;
+  teardown_done_handle_ = 0;
+  FinishTeardown();
+  return FALSE;
+}
+
+void MediaSourcePipeline::WaitForTeardown() {
+  if (teardown_thread_ == NULL)
+    return;
+
+  g_thread_join(teardown_thread_);
+  teardown_thread_ = NULL;
+  if (teardown_done_handle_) {
+    g_source_remove(teardown_done_handle_);
+    teardown_done_handle_ = 0;
+  }
+  FinishTeardown();
+}
 
-    pipeline_ = NULL;
-    appsrc_source_video_ = NULL;
-    appsrc_source_audio_ = NULL;
-    video_sink_ = NULL;
-    audio_sink_ = NULL;
-    source_ = NULL;
-    appsrc_caps_video_ = NULL;
-    appsrc_caps_audio_ = NULL;
+void MediaSourcePipeline::FinishTeardown() {
+  double teardown_ms = (teardown_end_us_ - teardown_start_us_) / 1000.0;
+  teardown_pipeline_ = NULL;
+  teardown_source_ = NULL;
 
-    printf("Pipeline Destroyed\n");
+  printf("Pipeline Destroyed after %.1f ms\n", teardown_ms);
+  if (options_.use_frame_pool_) {
+    audio_frame_pool_.PrintStats();
+    video_frame_pool_.PrintStats();
   }
+  network_.PrintStats();
+  abr_.PrintStats();
+  qos_.PrintSummary();
+
+  rtObjectRef freed = new rtMapObject;
+  freed.set("teardownMs", teardown_ms);
+  mEmit.send("onResourcesFreed", freed);
 }
 
 bool MediaSourcePipeline::Start() {
+  startup_start_us_ = g_get_monotonic_time();
+  benchmark_start_ = SampleBenchmark();
+  pass_start_ = benchmark_start_;
+  if (!UpdateSegmentCatalog()) {
+    fprintf(stderr, "No raw frame files found in %s\n", frame_files_path_.c_str());
+    return false;
+  }
+
   CalculateCurrentEndTime();
 
+  // a deep resume picks up where playback was suspended
+  if (start_position_us_ >= 0) {
+    int64_t start_us = PositionTracks(start_position_us_);
+    printf("Starting at %f secs: segment %d from %f secs\n",
+           start_position_us_ / 1000000.0f,
+           current_file_counter_,
+           start_us / 1000000.0f);
+  }
+
+  if (!network_.Configure(options_.network_)) {
+    fprintf(stderr, "Failed to set up network emulation\n");
+    return false;
+  }
+  // emulated delivery times stand in for the reads when the network is on
+  prefetcher_.set_estimator(network_.enabled() ? NULL : &abr_.estimator());
+
   if (!Build()) {
     fprintf(stderr, "Failed to build gstreamer pipeline\n");
     return false;
@@ -1004,35 +2680,123 @@ bool MediaSourcePipeline::Start() {
 
   printf("Current end time:%f secs\n", current_end_time_secs_);
 
-  printf("Pausing pipeline!\n");
-  gst_element_set_state(pipeline_, GST_STATE_PAUSED);
+  if (UsesFeederThreads())
+    StartFeederThreads();
+  if (options_.measure_dispatch_latency_)
+    dispatch_probe_.Start(kDispatchProbeIntervalMs);
+
+  if (options_.fast_start_ || options_.headless_) {
+    // the sources get linked on source setup, or already are, nothing to
+    // wait for
+    printf("Starting pipeline!\n");
+    gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+    is_playing_ = true;
+  } else {
+    printf("Pausing pipeline!\n");
+    gst_element_set_state(pipeline_, GST_STATE_PAUSED);
+  }
 
   status_timeout_handle_ = g_timeout_add(
       kStatusDelayMs, reinterpret_cast<GSourceFunc>(StatusPollStatic), this);
+  RestartStatsTimer();
 
   return true;
 }
 
 void MediaSourcePipeline::HandleKeyboardInput(unsigned int key) {
+  // a suspended pipeline stays put until resume()
+  if (!is_active_)
+    return;
 
   switch (key) {
     case KEY_P:  // pause/play
       is_playing_ = !is_playing_;
       DoPause();
       break;
+    case KEY_LEFT:
+      SeekToPosition(playback_position_secs_ * 1000000.0 - kKeySeekStepUs);
+      break;
+    case KEY_RIGHT:
+      SeekToPosition(playback_position_secs_ * 1000000.0 + kKeySeekStepUs);
+      break;
     default:
       break;
   }
 }
 
+void MediaSourcePipeline::SuspendLight()
+{
+  // READY releases the decoders and the sinks' resources but keeps the
+  // appsrcs with their caps and the segment catalog. uridecodebin replaces
+  // the msesrc on the way back, sourceChanged() moves the appsrcs over
+  StopAllTimeouts();
+  if (gst_element_set_state(pipeline_, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+    printf("Failed to set the pipeline to READY\n");
+  CloseAllFiles();
+}
+
+void MediaSourcePipeline::ResumeLight()
+{
+  // whatever was queued got dropped on the way to READY, refill from the
+  // keyframe before where playback stopped
+  int64_t start_us = PositionTracks(suspend_position_us_);
+  printf("Resuming at %f secs: segment %d from %f secs\n",
+         suspend_position_us_ / 1000000.0f,
+         current_file_counter_,
+         start_us / 1000000.0f);
+
+  sink_pts_ns_ = -1;
+  seeking_ = false;
+  WatchForFirstFrame();
+  if (options_.measure_dispatch_latency_)
+    dispatch_probe_.Start(kDispatchProbeIntervalMs);
+
+  gst_element_set_state(pipeline_, is_playing_ ? GST_STATE_PLAYING : GST_STATE_PAUSED);
+  status_timeout_handle_ = g_timeout_add(
+      kStatusDelayMs, reinterpret_cast<GSourceFunc>(StatusPollStatic), this);
+  RestartStatsTimer();
+}
+
 rtError MediaSourcePipeline::suspend()
 {
    if(is_active_)
    {
-     printf("MediaSourcePipeline is going to suspend\n");
-     // Destroy gstreamer pipeline to free all AV resources
-     Destroy();
+     int64_t start_us = g_get_monotonic_time();
+     suspended_tier_ = suspend_tier_;
+     suspend_position_us_ = CurrentPositionUs();
+     resume_start_us_ = 0;
+     printf("MediaSourcePipeline is going to suspend (%s)\n",
+            SuspendTierName(suspended_tier_));
+
+     if (suspended_tier_ == kSuspendLight) {
+       SuspendLight();
+     } else {
+       // Destroy gstreamer pipeline to free all AV resources, the RPC
+       // returns before that's done and onResourcesFreed follows
+       DestroyAsync();
+     }
      is_active_ = false;
+
+     printf("Suspend (%s): %.1f ms at %f secs\n",
+            SuspendTierName(suspended_tier_),
+            (g_get_monotonic_time() - start_us) / 1000.0,
+            suspend_position_us_ / 1000000.0f);
+   }
+   return RT_OK;
+}
+
+rtError MediaSourcePipeline::seek(float seconds)
+{
+   if(is_active_)
+     SeekToPosition(static_cast<int64_t>(seconds * 1000000.0));
+   return RT_OK;
+}
+
+rtError MediaSourcePipeline::suspendTier(rtString tier)
+{
+   if (!ParseSuspendTier(tier.cString(), &suspend_tier_)) {
+     printf("Unknown suspend tier '%s'\n", tier.cString());
+     return RT_ERROR_INVALID_ARG;
    }
    return RT_OK;
 }
@@ -1041,11 +2805,271 @@ rtError MediaSourcePipeline::resume()
 {
    if(!is_active_)
    {
-     printf("MediaSourcePipeline is going to resume\n");
-     // Re-create the pipeline and start playing again
-     Init();
-     Start();
+     int64_t start_us = g_get_monotonic_time();
+     printf("MediaSourcePipeline is going to resume (%s)\n",
+            SuspendTierName(suspended_tier_));
+
+     if (suspended_tier_ == kSuspendLight) {
+       resume_start_us_ = start_us;
+       ResumeLight();
+     } else {
+       // Re-create the pipeline and pick up where playback was, once the
+       // old one is gone
+       WaitForTeardown();
+       Init();
+       start_position_us_ = suspend_position_us_;
+       resume_start_us_ = start_us;
+       Start();
+     }
      is_active_ = true;
+
+     printf("Resume (%s): returned after %.1f ms\n",
+            SuspendTierName(suspended_tier_),
+            (g_get_monotonic_time() - start_us) / 1000.0);
    }
    return RT_OK;
 }
+
+rtObjectRef MediaSourcePipeline::TrackStats(AVType type) const
+{
+  const TrackMetrics& track = metrics_.track(type);
+  uint64_t pushes = LoadCounter(track.pushes_);
+  guint64 level_bytes = 0;
+  GstClockTime level_time = GST_CLOCK_TIME_NONE;
+  if (pipeline_)
+    GetAppSourceLevel(type, &level_bytes, &level_time);
+
+  rtObjectRef stats = new rtMapObject;
+  stats.set("frames", LoadCounter(track.frames_));
+  stats.set("bytes", LoadCounter(track.bytes_));
+  stats.set("wakeups", LoadCounter(track.wakeups_));
+  stats.set("pushes", pushes);
+  stats.set("pushAvgUs",
+            pushes ? LoadCounter(track.push_total_us_) / static_cast<double>(pushes)
+                   : 0.0);
+  stats.set("pushMaxUs", LoadCounter(track.push_max_us_));
+  stats.set("levelBytes", static_cast<uint64_t>(level_bytes));
+  stats.set("levelMs", GST_CLOCK_TIME_IS_VALID(level_time)
+                           ? static_cast<double>(level_time) / GST_MSECOND
+                           : -1.0);
+  stats.set("needData", LoadCounter(track.need_data_));
+  stats.set("enoughData", LoadCounter(track.enough_data_));
+  stats.set("underruns", LoadCounter(track.underruns_));
+  stats.set("segments", LoadCounter(track.segments_));
+  return stats;
+}
+
+rtError MediaSourcePipeline::videoStats(rtObjectRef& stats) const
+{
+  stats = TrackStats(kVideo);
+  return RT_OK;
+}
+
+rtError MediaSourcePipeline::audioStats(rtObjectRef& stats) const
+{
+  stats = TrackStats(kAudio);
+  return RT_OK;
+}
+
+rtError MediaSourcePipeline::seekStats(rtObjectRef& stats) const
+{
+  uint64_t completed = metrics_.seeks_completed();
+  stats = new rtMapObject;
+  stats.set("seeks", metrics_.seeks());
+  stats.set("completed", completed);
+  stats.set("latencyAvgMs",
+            completed ? metrics_.seek_latency_total_us() / 1000.0 / completed : 0.0);
+  stats.set("latencyMaxMs", metrics_.seek_latency_max_us() / 1000.0);
+  return RT_OK;
+}
+
+rtError MediaSourcePipeline::statsInterval(int32_t& ms) const
+{
+  ms = stats_interval_ms_;
+  return RT_OK;
+}
+
+rtError MediaSourcePipeline::setStatsInterval(int32_t ms)
+{
+  stats_interval_ms_ = std::max<int32_t>(ms, 0);
+  if (is_active_)
+    RestartStatsTimer();
+  return RT_OK;
+}
+
+void MediaSourcePipeline::RestartStatsTimer()
+{
+  if (stats_timeout_handle_) {
+    g_source_remove(stats_timeout_handle_);
+    stats_timeout_handle_ = 0;
+  }
+  if (stats_interval_ms_ > 0) {
+    stats_timeout_handle_ = g_timeout_add(
+        stats_interval_ms_, reinterpret_cast<GSourceFunc>(EmitStatsStatic), this);
+  }
+}
+
+gboolean MediaSourcePipeline::EmitStats()
+{
+  rtObjectRef seek;
+  seekStats(seek);
+
+  rtObjectRef stats = new rtMapObject;
+  stats.set("video", TrackStats(kVideo));
+  stats.set("audio", TrackStats(kAudio));
+  stats.set("seek", seek);
+  rtObjectRef qos;
+  qosStats(qos);
+  stats.set("qos", qos);
+  if (options_.live_) {
+    rtObjectRef live;
+    liveStats(live);
+    stats.set("live", live);
+  }
+  mEmit.send("onStats", stats);
+  return TRUE;
+}
+
+rtError MediaSourcePipeline::qosStats(rtObjectRef& stats) const
+{
+  rtObjectRef elements = new rtMapObject;
+  uint64_t dropped = 0;
+  for (std::map<std::string, QosElementStats>::const_iterator it =
+           qos_.elements().begin();
+       it != qos_.elements().end(); ++it) {
+    const QosElementStats& element = it->second;
+    rtObjectRef entry = new rtMapObject;
+    entry.set("messages", element.messages_);
+    entry.set("processed", static_cast<uint64_t>(element.processed_));
+    entry.set("dropped", element.drops_);
+    entry.set("jitterAvgMs", element.jitter_sum_ns_ / element.messages_ / 1000000.0);
+    entry.set("jitterMaxMs", element.jitter_max_ns_ / 1000000.0);
+    entry.set("proportionMin", element.proportion_min_);
+    entry.set("proportionAvg", element.proportion_sum_ / element.messages_);
+    entry.set("proportionLast", element.proportion_last_);
+    elements.set(it->first.c_str(), entry);
+    dropped += element.drops_;
+  }
+
+  rtObjectRef causes = new rtMapObject;
+  for (int cause = 0; cause < kDropCauses; cause++) {
+    causes.set(DropCauseName(static_cast<DropCause>(cause)),
+               qos_.drops(static_cast<DropCause>(cause)));
+  }
+
+  stats = new rtMapObject;
+  stats.set("dropped", dropped);
+  stats.set("dropCauses", causes);
+  stats.set("elements", elements);
+  stats.set("live", qos_.live());
+  stats.set("latencyMinMs", GST_CLOCK_TIME_IS_VALID(qos_.latency_min())
+                                ? static_cast<double>(qos_.latency_min()) / GST_MSECOND
+                                : -1.0);
+  stats.set("latencyMaxMs", GST_CLOCK_TIME_IS_VALID(qos_.latency_max())
+                                ? static_cast<double>(qos_.latency_max()) / GST_MSECOND
+                                : -1.0);
+  stats.set("bufferingMinPercent", qos_.buffering_percent_min());
+  stats.set("bufferingMs", qos_.buffering_us() / 1000.0);
+  return RT_OK;
+}
+
+rtError MediaSourcePipeline::liveStats(rtObjectRef& stats) const
+{
+  LiveLatencyStats total = live_latency_.total();
+  stats = new rtMapObject;
+  stats.set("live", options_.live_);
+  stats.set("frames", total.samples_);
+  stats.set("unmatched", total.unmatched_);
+  stats.set("latencyAvgMs",
+            total.samples_ ? total.total_us_ / 1000.0 / total.samples_ : 0.0);
+  stats.set("latencyMinMs", total.samples_ ? total.min_us_ / 1000.0 : 0.0);
+  stats.set("latencyMaxMs", total.max_us_ / 1000.0);
+  return RT_OK;
+}
+
+void MediaSourcePipeline::SetFinishedCallback(GSourceFunc callback, gpointer data)
+{
+  finished_callback_ = callback;
+  finished_data_ = data;
+}
+
+bool MediaSourcePipeline::OnLoopPlayed()
+{
+  loops_played_++;
+  bool finished = options_.loops_ > 0 && loops_played_ >= options_.loops_;
+  if (options_.headless_ || options_.loops_ > 0) {
+    gchar* label = g_strdup_printf("Loop %d", loops_played_);
+    PrintBenchmark(label, pass_start_);
+    g_free(label);
+    pass_start_ = SampleBenchmark();
+    if (finished || options_.loops_ <= 0)
+      PrintBenchmark("Total", benchmark_start_);
+  }
+
+  if (!finished)
+    return false;
+
+  printf("%sPlayed %d loop(s), stopping\n", LogPrefix().c_str(), loops_played_);
+  StopAllTimeouts();
+  if (options_.use_frame_pool_) {
+    audio_frame_pool_.PrintStats();
+    video_frame_pool_.PrintStats();
+  }
+  network_.PrintStats();
+  abr_.PrintStats();
+  qos_.PrintSummary();
+  if (finished_callback_)
+    g_idle_add(finished_callback_, finished_data_);
+  return true;
+}
+
+BenchmarkMark MediaSourcePipeline::SampleBenchmark()
+{
+  BenchmarkMark mark;
+  mark.usage_ = ResourceUsage::Sample();
+  mark.frames_ = metrics_.track(kAudio).frames_ + metrics_.track(kVideo).frames_;
+  mark.bytes_ = metrics_.track(kAudio).bytes_ + metrics_.track(kVideo).bytes_;
+  FramePoolStats audio_pool = audio_frame_pool_.stats();
+  FramePoolStats video_pool = video_frame_pool_.stats();
+  mark.pool_allocations_ = audio_pool.allocations_ + video_pool.allocations_;
+  mark.pool_reuses_ = audio_pool.reuses_ + video_pool.reuses_;
+  return mark;
+}
+
+void MediaSourcePipeline::PrintBenchmark(const char* label,
+                                         const BenchmarkMark& start_mark)
+{
+  BenchmarkMark now_mark = SampleBenchmark();
+  const ResourceUsage& now = now_mark.usage_;
+  const ResourceUsage& start = start_mark.usage_;
+  double secs = (now.wall_us_ - start.wall_us_) / 1000000.0;
+  double cpu_secs = (now.user_us_ - start.user_us_ +
+                     now.system_us_ - start.system_us_) / 1000000.0;
+  uint64_t frames = now_mark.frames_ - start_mark.frames_;
+  double mb = (now_mark.bytes_ - start_mark.bytes_) / (1024.0 * 1024.0);
+  if (secs <= 0)
+    return;
+
+  printf("%s%s: %.1f s, %llu frames (%.1f frames/s), %.1f MB (%.2f MB/s), "
+         "cpu %.2f s (%.0f%%), heap %+.1f MB, max rss %.1f MB, "
+         "pool allocations %llu, reuses %llu\n",
+         LogPrefix().c_str(),
+         label,
+         secs,
+         static_cast<unsigned long long>(frames),
+         frames / secs,
+         mb,
+         mb / secs,
+         cpu_secs,
+         cpu_secs * 100.0 / secs,
+         (static_cast<double>(now.heap_bytes_) - start.heap_bytes_) / (1024.0 * 1024.0),
+         now.max_rss_kb_ / 1024.0,
+         static_cast<unsigned long long>(now_mark.pool_allocations_ -
+                                         start_mark.pool_allocations_),
+         static_cast<unsigned long long>(now_mark.pool_reuses_ - start_mark.pool_reuses_));
+}
+
+std::string MediaSourcePipeline::LogPrefix() const
+{
+  return options_.name_.empty() ? std::string() : "[" + options_.name_ + "] ";
+}
@@ -23,7 +23,9 @@
 #include <gst/app/gstappsrc.h>
 #include <gst/gst.h>
 
+#include <atomic>
 #include <cstdio>
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -32,15 +34,137 @@
 #include <rtRemote.h>
 #include <rtError.h>
 
+#include "abrcontroller.h"
+#include "feedmetrics.h"
+#include "framefile.h"
+#include "framepool.h"
+#include "glib_tools.h"
+#include "livelatency.h"
+#include "networkemulator.h"
+#include "prefetcher.h"
+#include "qosanalyzer.h"
+#include "resourceusage.h"
+#include "segmentcatalog.h"
+
 enum ReadStatus { kDone = 0, kFrameRead, kPerformSeek };
 enum PipelineType { kAudioVideo = 0, kAudioOnly, kVideoOnly };
 
-enum AVType { kAudio = 0, kVideo };
+// what suspend() gives up
+enum SuspendTier {
+  kSuspendLight = 0,  // drop to READY, keep the pipeline, caps and segments
+  kSuspendDeep        // tear everything down
+};
+
+// "light" or "deep"
+bool ParseSuspendTier(const std::string& name, SuspendTier* tier);
+const char* SuspendTierName(SuspendTier tier);
+
+// startup milestones, timed from Start()
+enum StartupMilestone {
+  kStartupBuild = 0,     // pipeline built
+  kStartupSourceSetup,   // playbin created the msesrc
+  kStartupPadLink,       // appsrcs linked into the msesrc
+  kStartupFirstPush,     // first frame pushed into an appsrc
+  kStartupPreroll,       // pipeline reached PAUSED
+  kStartupPlaying,       // pipeline reached PLAYING
+  kStartupFirstFrame,    // first buffer at the video (or audio) sink
+  kStartupMilestones
+};
 
 struct AVFrame {
   guint8* data_;
   int32_t size_;
-  int64_t timestamp_us_;
+  int64_t pts_us_;
+  int64_t dts_us_;       // kTimestampNone if unknown
+  int64_t duration_us_;  // 0 if unknown
+  uint32_t flags_;       // kFrameFlag* of the frame record
+  // data_ is given back with release_(owner_) once gstreamer is done with it,
+  // or with g_free() when release_ is NULL
+  gpointer owner_;
+  GDestroyNotify release_;
+};
+
+// appsrc fill levels of the demand driven feed
+struct FeedWatermarks {
+  FeedWatermarks(guint64 low_bytes = 0, guint64 high_bytes = 0,
+                 guint64 high_ms = 0)
+    : low_bytes_(low_bytes), high_bytes_(high_bytes), high_ms_(high_ms) {}
+
+  guint64 low_bytes_;   // need-data once the queue drops below this
+  guint64 high_bytes_;  // stop filling at this many queued bytes
+  guint64 high_ms_;     // or at this much queued time, 0 = bytes only
+};
+
+struct PipelineOptions {
+  PipelineOptions() : use_mmap_(false), use_frame_pool_(true), prefetch_at_(0.5f),
+                      prefetch_secs_(2.0f), batch_ms_(0), batch_bytes_(0),
+                      demand_feed_(false), feeder_threads_(false),
+                      measure_dispatch_latency_(false), gapless_(false),
+                      fast_start_(false), suspend_tier_(kSuspendDeep),
+                      stats_interval_ms_(0), headless_(false),
+                      headless_sync_(false), software_decode_(false),
+                      loops_(0), live_(false), live_latency_ms_(100) {
+    watermarks_[kAudio] = FeedWatermarks(16 * 1024, 64 * 1024);
+    watermarks_[kVideo] = FeedWatermarks(64 * 1024, 256 * 1024);
+  }
+
+  bool use_mmap_;  // hand out buffers pointing straight into mmapped segments
+  bool use_frame_pool_;  // recycle payload memory instead of a g_malloc per frame
+  float prefetch_at_;    // fraction of the current segment played before the
+                         // next one is read ahead
+  float prefetch_secs_;  // seconds of the next segment to read ahead, 0 = off
+  // batched feeding, pushes a GstBufferList per wake-up holding up to batch_ms_
+  // of media and/or batch_bytes_ of payload; both 0 = one frame per wake-up
+  int32_t batch_ms_;
+  int32_t batch_bytes_;
+  // fill each appsrc to its high watermark on need-data instead of pushing
+  // on a fixed timer
+  bool demand_feed_;
+  FeedWatermarks watermarks_[2];  // indexed by AVType
+  NetworkProfile network_;
+  // read and push each track on its own thread with a blocking appsrc,
+  // keeping file I/O off the main loop
+  bool feeder_threads_;
+  bool measure_dispatch_latency_;
+  // append segment after segment onto one running timeline instead of
+  // flushing the pipeline at every segment boundary
+  bool gapless_;
+  // applies when the frame files directory holds <bitrate_kbps>/ renditions
+  AbrOptions abr_;
+  // link the appsrcs as soon as playbin sets up the source and push the
+  // first GOP before going to PLAYING, instead of linking from the main loop
+  bool fast_start_;
+  SuspendTier suspend_tier_;  // initial tier used by suspend()
+  int32_t stats_interval_ms_;  // period of the onStats event, 0 = off
+  // appsrc ! [decodebin !] fakesink per track instead of playbin with the
+  // msesrc and westerossink, runs without a display or hardware decoder
+  bool headless_;
+  bool headless_sync_;    // headless sinks sync to the clock
+  bool software_decode_;  // headless tracks go through decodebin
+  // finish after playing the frame files this many times, 0 = loop forever
+  int32_t loops_;
+  // tells the pipelines of a process apart in the periodic reports, empty
+  // for a single pipeline
+  std::string name_;
+  // westerossink "rectangle" ("x,y,w,h") for picture-in-picture or mosaic
+  // layouts, empty = the sink's default
+  std::string video_rectangle_;
+  // live appsrcs without playbin buffering, frames pushed when the pipeline
+  // running time reaches them instead of as fast as the appsrcs take them
+  bool live_;
+  int32_t live_latency_ms_;  // min/max-latency the live appsrcs report
+};
+
+// process usage and feed counters at the start of a benchmark interval
+struct BenchmarkMark {
+  BenchmarkMark() : frames_(0), bytes_(0), pool_allocations_(0),
+                    pool_reuses_(0) {}
+
+  ResourceUsage usage_;
+  uint64_t frames_;
+  uint64_t bytes_;
+  uint64_t pool_allocations_;
+  uint64_t pool_reuses_;
 };
 
 class MediaSourcePipeline : public rtObject {
@@ -48,55 +172,317 @@ class MediaSourcePipeline : public rtObject {
   rtDeclareObject(MediaSourcePipeline, rtObject);
   rtMethodNoArgAndNoReturn("suspend", suspend);
   rtMethodNoArgAndNoReturn("resume", resume);
+  rtMethod1ArgAndNoReturn("seek", seek, float);
+  rtMethod1ArgAndNoReturn("suspendTier", suspendTier, rtString);
+  rtReadOnlyProperty(startupTimes, startupTimes, rtObjectRef);
+  rtReadOnlyProperty(videoStats, videoStats, rtObjectRef);
+  rtReadOnlyProperty(audioStats, audioStats, rtObjectRef);
+  rtReadOnlyProperty(seekStats, seekStats, rtObjectRef);
+  rtProperty(statsInterval, statsInterval, setStatsInterval, int32_t);
+  rtReadOnlyProperty(qosStats, qosStats, rtObjectRef);
+  rtReadOnlyProperty(liveStats, liveStats, rtObjectRef);
 
-  explicit MediaSourcePipeline(std::string frame_files_path);
+  explicit MediaSourcePipeline(std::string frame_files_path,
+                               const PipelineOptions& options = PipelineOptions());
   virtual ~MediaSourcePipeline();
   virtual bool Start();
+  // Tears the pipeline down, waiting for a teardown still running on its
+  // worker; call before gst_deinit().
+  void Stop();
+  // called from the main loop once options.loops_ loops have been played
+  void SetFinishedCallback(GSourceFunc callback, gpointer data);
   virtual void HandleKeyboardInput(unsigned int key);
   rtError suspend();
   rtError resume();
+  // seconds are a playback position, as printed while playing
+  rtError seek(float seconds);
+  // "light" or "deep", applies from the next suspend()
+  rtError suspendTier(rtString tier);
+  // ms from Start() to each milestone reached so far, -1 for the others
+  rtError startupTimes(rtObjectRef& times) const;
+  // feed metrics of a track, see FeedMetrics
+  rtError videoStats(rtObjectRef& stats) const;
+  rtError audioStats(rtObjectRef& stats) const;
+  rtError seekStats(rtObjectRef& stats) const;
+  // frame drops by element and cause, latency and buffering, see QosAnalyzer
+  rtError qosStats(rtObjectRef& stats) const;
+  // push to render latency of the live feed, see LiveLatencyMeter
+  rtError liveStats(rtObjectRef& stats) const;
+  // ms between onStats events, 0 stops them
+  rtError statsInterval(int32_t& ms) const;
+  rtError setStatsInterval(int32_t ms);
+
+  struct Feeder {
+    MediaSourcePipeline* pipeline_;
+    AVType type_;
+    GThread* thread_;
+    // protected by feeder_mutex_
+    bool run_;   // set by need-data, cleared to pause the thread
+    bool busy_;  // reading or pushing a frame
+  };
 
   // functions called by glib static functions
   gboolean HandleMessage(GstMessage* message);
-  void StartFeedingAppSource(GstAppSrc* p_src);
+  void StartFeedingAppSource(GstAppSrc* p_src, guint length = 0);
   void StopFeedingAppSource(GstAppSrc* p_src);
   void SetNewAppSourceReadPosition(GstAppSrc* p_src, guint64 position);
+  void RepositionAppSource(GstAppSrc* p_src, guint64 position);
+  void OnFirstFrameAfterSeek();
   void OnAutoPadAddedMediaSource(GstElement* element, GstPad* pad);
   void OnAutoElementAddedMediaSource(GstElement* element);
   gboolean ReadVideoFrame();
   gboolean ReadAudioFrame();
+  gboolean FillAppSource(AVType type);
+  // pushes frames as they arrive over the emulated network and, when live,
+  // once they are due on the pipeline clock
+  gboolean FeedEmulated(AVType type);
   gboolean StatusPoll();
   gboolean ChunkDemuxerSeek();
   void sourceChanged();
+  bool UsesFeederThreads() const;
+  void RunFeeder(AVType type);
+  void EndSegmentSwitch();
+  void OnSegmentEndProbe(GstPadProbeInfo* info);
+  gboolean OnSegmentEnd();
+  void finishPipelineLinkingAndStartPlaybackIfNeeded();
+  void OnFirstFrameAtSink();
+  // records the render time of a buffer reaching the sink of the live
+  // latency probe, called from the sink streaming thread
+  void OnLiveFrameAtSink(GstPad* pad, GstBuffer* buffer);
+  void ReportStartup();
+  // post_done hands over to OnTeardownDone() on the main loop
+  void RunTeardown(bool post_done);
+  gboolean OnTeardownDone();
+  // counts need-data and enough-data signals, called from the appsrc
+  void OnAppSourceSignal(GstAppSrc* appsrc, bool need_data);
+  gboolean EmitStats();
 
  private:
   bool Build();
+  void BuildPlaybin();
+  bool BuildHeadless();
+  bool AddHeadlessTrack(GstElement* appsrc,
+                        GstElement* sink,
+                        std::vector<GstElement*>* chain);
+  // element flushes for the appsrcs go to: the msesrc, or the headless
+  // pipeline; NULL until there is one
+  GstElement* FlushTarget() const;
+  // Counts a loop over the frame files; returns true once options_.loops_
+  // have been played and the finished callback has been posted.
+  bool OnLoopPlayed();
+  BenchmarkMark SampleBenchmark();
+  // Prints what was used between start and now.
+  void PrintBenchmark(const char* label, const BenchmarkMark& start);
+  // "[<name>] " of options_.name_, or nothing
+  std::string LogPrefix() const;
   void Init();
   void Destroy();
+  // Stops feeding and detaches the pipeline on the calling thread, then
+  // takes it down to NULL on a worker; OnTeardownDone() follows on the main
+  // loop once its resources are freed.
+  void DestroyAsync();
+  bool BeginTeardown();
+  void WaitForTeardown();
+  void FinishTeardown();
   void StopAllTimeouts();
   void CloseAllFiles();
   void PerformSeek();
   ReadStatus GetNextFrame(AVFrame* frame, AVType type);
+  bool OpenTrack(AVType type, bool use_prefetched);
+  // Rendition of the segment the reader of type is about to open.
+  size_t ChooseRendition(AVType type);
+  // Sets caps on the appsrc of type if they differ from the current ones.
+  void UpdateAppSourceCaps(AVType type, const std::string& caps);
+  bool AppendNextSegment(AVType type);
+  void ResetTracks();
+  // Maps a playback position to a segment counter and a pts inside it.
+  int32_t ResolvePosition(int64_t position_us,
+                          int64_t* pts_us,
+                          int64_t* loop_offset_us) const;
+  // Makes the track start at the keyframe for pts_us in its current segment
+  // and returns the keyframe pts.
+  int64_t PositionTrack(AVType type, int64_t pts_us);
+  void SeekToPosition(int64_t position_us);
+  void FlushAndRestartFeeding();
+  void WatchForFirstFrameAfterSeek();
+  // Points the tracks at the keyframe for a playback position and returns
+  // the pts they start at.
+  int64_t PositionTracks(int64_t position_us);
+  // playback position in us, from the sink if it knows
+  int64_t CurrentPositionUs();
+  void SuspendLight();
+  void ResumeLight();
+  // appsrcs get registered with the msesrc once, returns false if they were
+  bool LinkSources();
+  // Takes the appsrcs out of an msesrc uridecodebin has dropped, so that
+  // LinkSources() can register them with its replacement.
+  void ReleaseAppSources(GstElement* source);
+  // Pushes the video frames up to the second keyframe and the audio frames
+  // they cover, each track as one buffer list.
+  void PushFirstGop();
+  // Pushes frames of type until the next keyframe, or until end_pts_us
+  // unless that is kTimestampNone; returns the end of the last frame pushed.
+  int64_t PushStartupFrames(AVType type, int64_t end_pts_us);
+  void WatchForFirstFrame();
+  void WatchLiveLatency();
+  // pipeline running time, -1 unless PLAYING on a clock
+  gint64 RunningTimeNs() const;
+  // us until a live frame is due: when the running time reaches its dts, or
+  // its pts if the dts is unknown
+  int64_t LiveDelayUs(const AVFrame& frame) const;
+  // Records milestone the first time it is reached, thread safe.
+  void MarkStartup(StartupMilestone milestone);
+  void ResetStartup();
+  void UpdateGaplessSegment();
+  GstBuffer* CreateBuffer(const AVFrame& frame);
   bool PushFrameToAppSrc(const AVFrame& frame, AVType type);
+  bool FeedAppSource(AVType type);
+  bool ReadAndPushFrame(AVType type);
+  bool IsBatchFeeding() const;
+  // demand_feed_, or a headless run without --sync
+  bool UsesDemandFeed() const;
+  bool ReadFrameBatch(AVType type);
+  void GetAppSourceLevel(AVType type, guint64* bytes, GstClockTime* time) const;
+  rtObjectRef TrackStats(AVType type) const;
+  void RestartStatsTimer();
+  void PrintFeedStats();
   bool ShouldBeReading(AVType av);
   void SetShouldBeReading(bool is_reading, AVType av);
+  bool UpdateSegmentCatalog();
+  bool BuildSegmentCatalogs();
+  const SegmentCatalog& RenditionCatalog(size_t rendition) const;
+  // media read ahead of the playback position, -1 before the first frame
+  int64_t BufferedUs() const;
+  void PrefetchNextSegmentIfNeeded();
+  FramePool& frame_pool(AVType type);
+  void OnFramePushed();
+  void StartFeederThreads();
+  void StopFeederThreads();
+  void ResumeFeeder(AVType type);
+  // Stops the feeder thread of a track and waits until it is idle.
+  void PauseFeeder(AVType type);
   void CalculateCurrentEndTime();
+  // ends the segment by position when there is no sink to probe, or as a
+  // backstop when the last frame never reaches the probed sink
   bool ShouldPerformSeek();
+  // sink position in buffer time, -1 if unknown
+  gint64 QueryPosition();
+  // Moves on to the next segment once the current one has played out.
+  void FinishSegment();
+  // Segment ends are detected on the sink of the position track by comparing
+  // the buffers reaching it with the last frame fed on that track.
+  AVType SegmentEndTrack() const;
+  void WatchForSegmentEnd();
+  // Posts OnSegmentEnd() to the main loop once the end has reached the sink,
+  // called from the feeders and the sink streaming thread.
+  void CheckSegmentEnd();
+  void ResetSegmentEnd();
+  // Marks the track ended and sends EOS down its appsrc, once per segment.
+  void EndTrack(AVType type);
   int64_t GetCurrentStartTimeMicroseconds() const;
   bool IsPlaybackOver();
-  void AddPlaybackPositionToHistory(int64_t position);
-  bool IsPlaybackStalled();
-  bool HasPlaybackAdvanced();
-  void ResetPlaybackHistory();
   void DoPause();
-  void finishPipelineLinkingAndStartPlaybackIfNeeded();
 
   std::string frame_files_path_;
+  PipelineOptions options_;
+  // the catalog of the frame files directory, or of its lowest rendition
+  // which then also provides the segment times for the others
+  SegmentCatalog catalog_;
+  // catalogs of the other renditions, indexed like the renditions of abr_;
+  // the first one stays empty, that's catalog_
+  std::vector<SegmentCatalog> rendition_catalogs_;
+  AbrController abr_;
+  size_t track_renditions_[2];  // rendition each reader is in
+  // rendition of the last few segments opened, keyed by loop offset and
+  // counter; the first track to open a segment picks it and the other one
+  // follows. Guarded by feeder_mutex_
+  std::deque<std::pair<std::pair<int64_t, int32_t>, size_t> >
+      segment_renditions_;
+  size_t prefetch_rendition_;   // rendition the prefetcher is loading
+  // pts of the last frame read per AVType, kTimestampNone after a reset
+  std::atomic<int64_t> last_read_pts_us_[2];
+  // end of segment detection, see WatchForSegmentEnd()
+  std::atomic<bool> track_ended_[2];  // reader ran off the segment end
+  // ShouldPerformSeek() backstop: position seen and when it last changed
+  int64_t stall_position_us_;
+  int64_t stall_start_us_;
+  // latest pts fed in the segment per AVType and that frame's duration
+  std::atomic<int64_t> max_fed_pts_us_[2];
+  std::atomic<int64_t> max_fed_duration_us_[2];
+  std::atomic<int64_t> sink_pts_ns_;  // latest buffer pts seen at the sink
+  GstPad* end_probe_pad_;
+  gulong end_probe_id_;
+  // sink pad of the position track while live
+  GstPad* live_probe_pad_;
+  gulong live_probe_id_;
+  LiveLatencyMeter live_latency_;
+  gint segment_end_posted_;
+  guint segment_end_handle_;
+  SegmentPrefetcher prefetcher_;
+  FramePool audio_frame_pool_;
+  FramePool video_frame_pool_;
+  // 0 unless waiting for the first push; read by the feeder threads
+  std::atomic<int64_t> segment_switch_start_us_;
+  int64_t segment_switch_end_us_;
+  gint segment_switch_end_posted_;
+  std::atomic<int64_t> seek_start_us_;
+  std::atomic<bool> seek_probe_pending_;
+  // seek-data came in for the track and RepositionAppSource() hasn't run
+  // yet; the appsrc already dropped its queue, frames of the old position
+  // must not refill it
+  std::atomic<bool> reposition_pending_[2];
+  int64_t startup_start_us_;
+  // us after startup_start_us_ per StartupMilestone, -1 until reached
+  std::atomic<int64_t> startup_us_[kStartupMilestones];
+  std::atomic<bool> startup_reported_;
+  SuspendTier suspend_tier_;    // tier the next suspend() uses
+  SuspendTier suspended_tier_;  // tier of the current suspension
+  int64_t suspend_position_us_;
+  int64_t start_position_us_;   // where Start() begins, -1 = first segment
+  // set by resume() until the first frame is back at the sink
+  std::atomic<int64_t> resume_start_us_;
+  // pipeline being taken down by teardown_thread_, see DestroyAsync()
+  GThread* teardown_thread_;
+  GstElement* teardown_pipeline_;
+  GstElement* teardown_source_;
+  int64_t teardown_start_us_;
+  int64_t teardown_end_us_;
+  guint teardown_done_handle_;
+  FeedMetrics metrics_;
+  // wake-up rate baseline of PrintFeedStats(), main loop only
+  int64_t feed_report_us_;
+  uint64_t feed_report_wakeups_[2];  // indexed by AVType
+  QosAnalyzer qos_;
+  int32_t stats_interval_ms_;
+  guint stats_timeout_handle_;
+  int32_t loops_played_;
+  BenchmarkMark benchmark_start_;  // since Start()
+  BenchmarkMark pass_start_;       // since the current loop began
+  GSourceFunc finished_callback_;
+  gpointer finished_data_;
+  guint64 need_data_bytes_[2];  // last need-data length hint, 0 = none
+  NetworkEmulator network_;
+  // frame read but still in flight on the emulated network, per AVType
+  AVFrame pending_frames_[2];
+  int64_t pending_ready_us_[2];
+  bool has_pending_frame_[2];
   int32_t current_file_counter_;
-  FILE* current_video_file_;
-  FILE* current_video_timestamp_file_;
-  FILE* current_audio_file_;
-  FILE* current_audio_timestamp_file_;
+  FrameReader readers_[2];  // indexed by AVType
+  // segment each reader is in; both follow current_file_counter_ unless
+  // gapless, where every track moves on by itself
+  int32_t track_counters_[2];
+  int64_t timeline_shift_us_[2];  // added to the pts of the track's frames
+  int64_t loop_offset_us_[2];     // catalog duration times the loops played
+  size_t start_frames_[2];        // first frame to read after a seek
+  // {timeline start, counter} of segments the feeders have moved into but
+  // playback has not reached yet; protected by feeder_mutex_
+  std::deque<std::pair<int64_t, int32_t> > timeline_segments_;
+  int64_t current_timeline_start_us_;
+  Feeder feeders_[2];        // indexed by AVType
+  GMutex feeder_mutex_;
+  GCond feeder_cond_;
+  bool feeders_quit_;
+  DispatchLatencyProbe dispatch_probe_;
   bool seeking_;
   GstElement* pipeline_;
   GstAppSrc* appsrc_source_video_;
@@ -107,19 +493,19 @@ class MediaSourcePipeline : public rtObject {
   std::vector<GstElement*> ms_audio_pipeline_;
   bool should_be_reading_[2];
   float playback_position_secs_;
+  // the same position in microseconds, precise on long timelines
+  int64_t playback_position_us_;
+  int64_t position_update_ms_;  // time since the last playback position report
   float current_end_time_secs_;
   guint video_frame_timeout_handle_;
   guint audio_frame_timeout_handle_;
   guint status_timeout_handle_;
-  int32_t current_playback_history_cnt_;
-  std::vector<int64_t> playback_position_history_;
-  bool playback_started_;
   bool is_playing_;
   PipelineType pipeline_type_;
 
   GstElement* source_;
-  GstCaps    *appsrc_caps_video_;
-  GstCaps    *appsrc_caps_audio_;
+  // caps last set on each appsrc, indexed by AVType
+  std::string appsrc_caps_[2];
   bool pause_before_seek_;
   bool is_active_;
   int64_t seek_offset_;
@@ -0,0 +1,137 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Offline converter from the legacy raw_*_frames_N.txt/.bin pairs to the
+// indexed raw_*_frames_N.msef container read by mse_player.
+//
+//   mse_frames_convert [--video-caps CAPS] [--audio-caps CAPS] [directory]
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "framefile.h"
+
+namespace {
+
+void PrintUsage(const char* name) {
+  printf("Usage: %s [--video-caps CAPS] [--audio-caps CAPS] [directory]\n"
+         "Converts every raw_<audio|video>_frames_N.txt/.bin pair in directory\n"
+         "(default: current directory) to raw_<audio|video>_frames_N%s\n"
+         "Caps default to a raw_<audio|video>_frames_N%s sidecar, else to\n"
+         "caps derived from the payloads\n",
+         name, kFrameFileExtension, kCapsExtension);
+}
+
+bool ConvertTrack(const std::string& segment_path,
+                  AVType type,
+                  const std::string& caps) {
+  FrameIndex index;
+  if (!index.LoadLegacy(segment_path + ".txt", segment_path + ".bin", type))
+    return false;
+
+  if (!caps.empty())
+    index.set_caps(caps);
+
+  int payload_fd = open(index.payload_path().c_str(), O_RDONLY);
+  if (payload_fd < 0) {
+    fprintf(stderr, "Failed to open %s\n", index.payload_path().c_str());
+    return false;
+  }
+
+  std::string path = segment_path + kFrameFileExtension;
+  bool ok = WriteFrameFile(path, index, payload_fd);
+  close(payload_fd);
+
+  if (ok) {
+    size_t keyframes = 0;
+    for (size_t i = 0; i < index.size(); i++)
+      keyframes += (index[i].flags_ & kFrameFlagKeyframe) ? 1 : 0;
+
+    printf("%s: %zu frames (%zu keyframes), %llu bytes\n",
+           path.c_str(),
+           index.size(),
+           keyframes,
+           static_cast<unsigned long long>(index.payload_bytes()));
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string caps[2];
+  static const struct option kOptions[] = {
+      {"audio-caps", required_argument, NULL, 'a'},
+      {"video-caps", required_argument, NULL, 'v'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "a:v:h", kOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'a':
+        caps[kAudio] = optarg;
+        break;
+      case 'v':
+        caps[kVideo] = optarg;
+        break;
+      case 'h':
+        PrintUsage(argv[0]);
+        return 0;
+      default:
+        PrintUsage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (argc - optind > 1) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::string dir = (optind < argc) ? argv[optind] : ".";
+
+  int32_t segments = 0;
+  for (int32_t counter = 0;; counter++) {
+    std::string audio_path = SegmentPath(dir, kAudio, counter);
+    std::string video_path = SegmentPath(dir, kVideo, counter);
+    bool have_audio = access((audio_path + ".txt").c_str(), R_OK) == 0;
+    bool have_video = access((video_path + ".txt").c_str(), R_OK) == 0;
+    if (!have_audio && !have_video)
+      break;
+
+    if (have_audio && !ConvertTrack(audio_path, kAudio, caps[kAudio]))
+      return 1;
+    if (have_video && !ConvertTrack(video_path, kVideo, caps[kVideo]))
+      return 1;
+    segments++;
+  }
+
+  if (segments == 0) {
+    fprintf(stderr, "No raw frame files found in %s\n", dir.c_str());
+    return 1;
+  }
+
+  printf("Converted %d segment(s)\n", segments);
+  return 0;
+}
@@ -0,0 +1,755 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generator of synthetic raw_*_frames_N segments for long-duration and
+// high-bitrate stress tests. Payloads are dummy H.264/AAC frames carrying
+// just enough NAL structure for the frame flags to be derived, good for runs
+// that never decode, or with --encode real x264enc/avenc_aac output.
+//
+//   mse_frames_generate [options] directory
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "framefile.h"
+
+namespace {
+
+// GeneratorOptions::formats_
+const int kFormatLegacy = 1 << 0;
+const int kFormatContainer = 1 << 1;
+
+// smallest dummy access unit, room for the NAL headers
+const size_t kMinVideoFrameBytes = 32;
+
+struct GeneratorOptions {
+  GeneratorOptions()
+    : segments_(3),
+      segment_us_(10000000),
+      start_us_(0),
+      formats_(kFormatContainer),
+      encode_(false),
+      seed_(1),
+      video_(true),
+      width_(1280),
+      height_(720),
+      fps_num_(30),
+      fps_den_(1),
+      gop_(60),
+      bframes_(2),
+      video_kbps_(3000),
+      i_weight_(5.0),
+      b_weight_(0.5),
+      size_spread_(0.2),
+      audio_(true),
+      audio_rate_(48000),
+      audio_channels_(2),
+      audio_frame_samples_(1024),
+      audio_kbps_(128) {}
+
+  int32_t segments_;
+  int64_t segment_us_;
+  int64_t start_us_;  // pts of the first frame
+  int formats_;
+  bool encode_;
+  uint32_t seed_;
+
+  bool video_;
+  int32_t width_;
+  int32_t height_;
+  int64_t fps_num_;
+  int64_t fps_den_;
+  int32_t gop_;      // frames from one IDR to the next
+  int32_t bframes_;  // most B frames between two reference frames
+  int32_t video_kbps_;
+  double i_weight_;  // size of an I frame relative to a P frame
+  double b_weight_;  // size of a B frame relative to a P frame
+  double size_spread_;  // sigma of the log-normal frame size jitter
+
+  bool audio_;
+  int32_t audio_rate_;
+  int32_t audio_channels_;
+  int32_t audio_frame_samples_;
+  int32_t audio_kbps_;
+};
+
+void PrintUsage(const char* name) {
+  printf("Usage: %s [options] directory\n"
+         "Writes synthetic raw_<audio|video>_frames_N segments to directory.\n"
+         "  --segments=N           number of segments (default 3)\n"
+         "  --segment-secs=SECS    duration of each segment (default 10)\n"
+         "  --start-secs=SECS      pts of the first frame, large values test\n"
+         "                         timestamp precision (default 0)\n"
+         "  --format=FORMAT        legacy (.txt/.bin), msef or both (default msef)\n"
+         "  --encode               encode a test pattern with x264enc/avenc_aac\n"
+         "                         instead of writing dummy payloads\n"
+         "  --seed=N               random seed of the frame sizes (default 1)\n"
+         "Video:\n"
+         "  --no-video             audio only\n"
+         "  --size=WIDTHxHEIGHT    resolution (default 1280x720)\n"
+         "  --fps=NUM[/DEN]        frame rate (default 30)\n"
+         "  --gop=FRAMES           frames from one IDR to the next (default 60)\n"
+         "  --bframes=N            B frames between reference frames (default 2)\n"
+         "  --video-kbps=KBPS      average bitrate (default 3000)\n"
+         "  --frame-weights=I,B    dummy I and B frame sizes relative to P frames\n"
+         "                         (default 5,0.5)\n"
+         "  --size-spread=SIGMA    log-normal jitter of the dummy frame sizes\n"
+         "                         (default 0.2)\n"
+         "Audio:\n"
+         "  --no-audio             video only\n"
+         "  --audio-rate=HZ        sample rate (default 48000)\n"
+         "  --audio-channels=N     channels (default 2)\n"
+         "  --audio-frame=SAMPLES  samples per frame (default 1024)\n"
+         "  --audio-kbps=KBPS      bitrate (default 128)\n"
+         "Segments start on an IDR frame; each GOP is closed. Timestamps are\n"
+         "computed from the frame number, not accumulated, so they don't drift.\n",
+         name);
+}
+
+// Presentation time of video frame n, counted from the first frame.
+int64_t VideoPts(const GeneratorOptions& options, int64_t n) {
+  return (n * 1000000LL * options.fps_den_ + options.fps_num_ / 2) /
+         options.fps_num_;
+}
+
+// First video frame presented at or after time_us.
+int64_t VideoFrameAt(const GeneratorOptions& options, int64_t time_us) {
+  int64_t scale = 1000000LL * options.fps_den_;
+  return (time_us * options.fps_num_ + scale - 1) / scale;
+}
+
+int64_t AudioPts(const GeneratorOptions& options, int64_t n) {
+  return (n * options.audio_frame_samples_ * 1000000LL + options.audio_rate_ / 2) /
+         options.audio_rate_;
+}
+
+int64_t AudioFrameAt(const GeneratorOptions& options, int64_t time_us) {
+  int64_t scale = options.audio_frame_samples_ * 1000000LL;
+  return (time_us * options.audio_rate_ + scale - 1) / scale;
+}
+
+std::string VideoCaps(const GeneratorOptions& options) {
+  char caps[256];
+  snprintf(caps, sizeof(caps),
+           "video/x-h264, stream-format=(string)avc, alignment=(string)au, "
+           "width=(int)%d, height=(int)%d, framerate=(fraction)%lld/%lld",
+           options.width_,
+           options.height_,
+           static_cast<long long>(options.fps_num_),
+           static_cast<long long>(options.fps_den_));
+  return caps;
+}
+
+// AAC-LC caps with the AudioSpecificConfig of the configured rate and
+// channels, or an empty string if the rate has no sampling frequency index.
+std::string AudioCaps(const GeneratorOptions& options) {
+  static const int32_t kRates[] = {96000, 88200, 64000, 48000, 44100, 32000,
+                                   24000, 22050, 16000, 12000, 11025, 8000,
+                                   7350};
+  int32_t rate_index = -1;
+  for (size_t i = 0; i < sizeof(kRates) / sizeof(kRates[0]); i++) {
+    if (kRates[i] == options.audio_rate_)
+      rate_index = i;
+  }
+  if (rate_index < 0 || options.audio_channels_ < 1 || options.audio_channels_ > 7)
+    return std::string();
+
+  // object type 2 (LC):5 | frequency index:4 | channel configuration:4 | 0:3
+  uint16_t config = (2 << 11) | (rate_index << 7) | (options.audio_channels_ << 3);
+  char caps[256];
+  snprintf(caps, sizeof(caps),
+           "audio/mpeg, mpegversion=(int)4, framed=(boolean)true, "
+           "stream-format=(string)raw, base-profile=(string)lc, "
+           "profile=(string)lc, codec_data=(buffer)%04x, rate=(int)%d, "
+           "channels=(int)%d",
+           config,
+           options.audio_rate_,
+           options.audio_channels_);
+  return caps;
+}
+
+// Writes one track of one segment as a legacy .txt/.bin pair with a .caps
+// sidecar, then converts it to a container if one is asked for.
+class SegmentWriter {
+ public:
+  SegmentWriter() : type_(kVideo), timestamps_(NULL), payloads_(NULL) {}
+  ~SegmentWriter() { Abort(); }
+
+  bool Open(const std::string& segment_path, AVType type, const std::string& caps);
+  bool Add(int64_t pts_us, const uint8_t* data, size_t size);
+  bool Close(int formats);
+  bool is_open() const { return timestamps_ != NULL; }
+
+ private:
+  SegmentWriter(const SegmentWriter&);
+  SegmentWriter& operator=(const SegmentWriter&);
+
+  void Abort();
+
+  std::string path_;
+  AVType type_;
+  FILE* timestamps_;
+  FILE* payloads_;
+};
+
+bool SegmentWriter::Open(const std::string& segment_path,
+                         AVType type,
+                         const std::string& caps) {
+  path_ = segment_path;
+  type_ = type;
+
+  std::string caps_path = path_ + kCapsExtension;
+  unlink(caps_path.c_str());
+  if (!caps.empty()) {
+    FILE* file = fopen(caps_path.c_str(), "w");
+    if (file == NULL || fprintf(file, "%s\n", caps.c_str()) < 0) {
+      fprintf(stderr, "Failed to write %s\n", caps_path.c_str());
+      if (file)
+        fclose(file);
+      return false;
+    }
+    fclose(file);
+  }
+
+  timestamps_ = fopen((path_ + ".txt").c_str(), "w");
+  payloads_ = fopen((path_ + ".bin").c_str(), "wb");
+  if (timestamps_ == NULL || payloads_ == NULL) {
+    fprintf(stderr, "Failed to create %s.txt/.bin\n", path_.c_str());
+    Abort();
+    return false;
+  }
+  return true;
+}
+
+bool SegmentWriter::Add(int64_t pts_us, const uint8_t* data, size_t size) {
+  if (fprintf(timestamps_, "%lld,%zu,", static_cast<long long>(pts_us), size) < 0 ||
+      fwrite(data, 1, size, payloads_) != size) {
+    fprintf(stderr, "Failed to write frame to %s: %s\n", path_.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool SegmentWriter::Close(int formats) {
+  bool ok = fclose(timestamps_) == 0;
+  ok = fclose(payloads_) == 0 && ok;
+  timestamps_ = NULL;
+  payloads_ = NULL;
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s.txt/.bin\n", path_.c_str());
+    return false;
+  }
+
+  std::string timestamp_path = path_ + ".txt";
+  std::string payload_path = path_ + ".bin";
+  FrameIndex index;
+  if (!index.LoadLegacy(timestamp_path, payload_path, type_))
+    return false;
+
+  std::string written = timestamp_path;
+  if (formats & kFormatContainer) {
+    int payload_fd = open(payload_path.c_str(), O_RDONLY);
+    if (payload_fd < 0) {
+      fprintf(stderr, "Failed to open %s\n", payload_path.c_str());
+      return false;
+    }
+    written = path_ + kFrameFileExtension;
+    ok = WriteFrameFile(written, index, payload_fd);
+    close(payload_fd);
+    if (!ok)
+      return false;
+  }
+
+  if (!(formats & kFormatLegacy)) {
+    unlink(timestamp_path.c_str());
+    unlink(payload_path.c_str());
+    unlink((path_ + kCapsExtension).c_str());
+  }
+
+  size_t keyframes = 0;
+  for (size_t i = 0; i < index.size(); i++)
+    keyframes += (index[i].flags_ & kFrameFlagKeyframe) ? 1 : 0;
+  printf("%s: %zu frames (%zu keyframes), %llu bytes, %f - %f secs\n",
+         written.c_str(),
+         index.size(),
+         keyframes,
+         static_cast<unsigned long long>(index.payload_bytes()),
+         index.first_pts_us() / 1000000.0,
+         index.last_pts_us() / 1000000.0);
+  return true;
+}
+
+void SegmentWriter::Abort() {
+  if (timestamps_)
+    fclose(timestamps_);
+  if (payloads_)
+    fclose(payloads_);
+  timestamps_ = NULL;
+  payloads_ = NULL;
+}
+
+// Display order positions and frame types of a closed GOP of length frames,
+// in decode order. Reference frames are spaced bframes + 1 apart and the last
+// frame is always one, so no B frame refers to the next GOP.
+void GopDecodeOrder(int32_t length,
+                    int32_t bframes,
+                    std::vector<int32_t>* positions,
+                    std::vector<uint32_t>* types) {
+  positions->clear();
+  types->clear();
+  positions->push_back(0);
+  types->push_back(kFrameTypeI);
+
+  int32_t previous = 0;
+  for (int32_t position = 1; position < length; position++) {
+    if (position % (bframes + 1) != 0 && position != length - 1)
+      continue;
+    positions->push_back(position);
+    types->push_back(kFrameTypeP);
+    for (int32_t b = previous + 1; b < position; b++) {
+      positions->push_back(b);
+      types->push_back(kFrameTypeB);
+    }
+    previous = position;
+  }
+}
+
+void AppendNal(uint8_t header, const uint8_t* body, size_t body_size,
+               size_t size, uint8_t fill, std::vector<uint8_t>* unit) {
+  size_t nal_size = std::max(size, body_size + 1);
+  unit->push_back(nal_size >> 24);
+  unit->push_back(nal_size >> 16);
+  unit->push_back(nal_size >> 8);
+  unit->push_back(nal_size);
+  unit->push_back(header);
+  unit->insert(unit->end(), body, body + body_size);
+  unit->insert(unit->end(), nal_size - body_size - 1, fill);
+}
+
+// Builds a stream-format=avc access unit of about size bytes that
+// ScanAvcAccessUnit() classifies as type, with SPS and PPS ahead of IDRs.
+void BuildVideoFrame(uint32_t type, size_t size, uint8_t fill,
+                     std::vector<uint8_t>* unit) {
+  // baseline profile, level 3.1; the body isn't meant to be decoded
+  static const uint8_t kSps[] = {0x42, 0x00, 0x1f, 0xe8};
+  static const uint8_t kPps[] = {0xce, 0x38, 0x80};
+  // first_mb_in_slice 0, then slice_type 7 (I), 5 (P) or 6 (B), ue(v) coded
+  static const uint8_t kSliceI[] = {0x88};
+  static const uint8_t kSliceP[] = {0x98};
+  static const uint8_t kSliceB[] = {0x9c};
+
+  unit->clear();
+  if (type == kFrameTypeI) {
+    AppendNal(0x67, kSps, sizeof(kSps), 0, 0, unit);
+    AppendNal(0x68, kPps, sizeof(kPps), 0, 0, unit);
+  }
+
+  size_t slice_size = size > unit->size() + 4 ? size - unit->size() - 4 : 0;
+  if (type == kFrameTypeI)
+    AppendNal(0x65, kSliceI, sizeof(kSliceI), slice_size, fill, unit);
+  else if (type == kFrameTypeP)
+    AppendNal(0x61, kSliceP, sizeof(kSliceP), slice_size, fill, unit);
+  else
+    AppendNal(0x01, kSliceB, sizeof(kSliceB), slice_size, fill, unit);  // nal_ref_idc 0
+}
+
+bool GenerateDummyVideo(const GeneratorOptions& options,
+                        const std::string& dir,
+                        int32_t counter,
+                        std::mt19937* random) {
+  SegmentWriter writer;
+  if (!writer.Open(SegmentPath(dir, kVideo, counter), kVideo, VideoCaps(options)))
+    return false;
+
+  // scale the frame weights of a full GOP to the bitrate
+  std::vector<int32_t> positions;
+  std::vector<uint32_t> types;
+  GopDecodeOrder(options.gop_, options.bframes_, &positions, &types);
+  double gop_weight = 0;
+  for (size_t i = 0; i < types.size(); i++) {
+    gop_weight += types[i] == kFrameTypeI ? options.i_weight_
+                : types[i] == kFrameTypeB ? options.b_weight_
+                : 1.0;
+  }
+  double frame_bytes = options.video_kbps_ * 1000.0 / 8.0 * options.fps_den_ /
+                       options.fps_num_;
+  double p_bytes = frame_bytes * options.gop_ / gop_weight;
+  // mean 1 whatever the spread
+  std::lognormal_distribution<double> jitter(
+      -options.size_spread_ * options.size_spread_ / 2, options.size_spread_);
+
+  int64_t first = VideoFrameAt(options, counter * options.segment_us_);
+  int64_t end = VideoFrameAt(options, (counter + 1) * options.segment_us_);
+  std::vector<uint8_t> unit;
+  for (int64_t gop_start = first; gop_start < end; gop_start += options.gop_) {
+    int32_t length = static_cast<int32_t>(std::min<int64_t>(options.gop_, end - gop_start));
+    GopDecodeOrder(length, options.bframes_, &positions, &types);
+    for (size_t i = 0; i < positions.size(); i++) {
+      int64_t n = gop_start + positions[i];
+      double weight = types[i] == kFrameTypeI ? options.i_weight_
+                    : types[i] == kFrameTypeB ? options.b_weight_
+                    : 1.0;
+      size_t size = std::max<size_t>(
+          kMinVideoFrameBytes,
+          static_cast<size_t>(p_bytes * weight * jitter(*random)));
+      BuildVideoFrame(types[i], size, static_cast<uint8_t>(n), &unit);
+      if (!writer.Add(options.start_us_ + VideoPts(options, n), &unit[0], unit.size()))
+        return false;
+    }
+  }
+  return writer.Close(options.formats_);
+}
+
+bool GenerateDummyAudio(const GeneratorOptions& options,
+                        const std::string& dir,
+                        int32_t counter) {
+  SegmentWriter writer;
+  if (!writer.Open(SegmentPath(dir, kAudio, counter), kAudio, AudioCaps(options)))
+    return false;
+
+  // constant bitrate, the fractional byte carried over to the next frame
+  int64_t first = AudioFrameAt(options, counter * options.segment_us_);
+  int64_t end = AudioFrameAt(options, (counter + 1) * options.segment_us_);
+  int64_t bits_per_frame_num = static_cast<int64_t>(options.audio_kbps_) * 1000 *
+                               options.audio_frame_samples_;
+  int64_t byte_den = 8LL * options.audio_rate_;
+  std::vector<uint8_t> frame;
+  for (int64_t n = first; n < end; n++) {
+    size_t size = std::max<int64_t>(
+        1, (n + 1) * bits_per_frame_num / byte_den - n * bits_per_frame_num / byte_den);
+    frame.assign(size, static_cast<uint8_t>(n));
+    if (!writer.Add(options.start_us_ + AudioPts(options, n), &frame[0], size))
+      return false;
+  }
+  return writer.Close(options.formats_);
+}
+
+// Pulls the frames of one track from the appsink named "sink" of an encoding
+// pipeline and cuts them into segments, each starting with the first
+// keyframe at or after its start time.
+bool EncodeTrack(const GeneratorOptions& options,
+                 const std::string& dir,
+                 AVType type,
+                 const std::string& description) {
+  GError* error = NULL;
+  GstElement* pipeline = gst_parse_launch(description.c_str(), &error);
+  if (pipeline == NULL || error != NULL) {
+    fprintf(stderr, "Failed to create \"%s\": %s\n",
+            description.c_str(), error ? error->message : "unknown error");
+    g_clear_error(&error);
+    if (pipeline)
+      gst_object_unref(pipeline);
+    return false;
+  }
+
+  GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  SegmentWriter writer;
+  int32_t counter = -1;
+  bool ok = true;
+  while (ok) {
+    GstSample* sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), GST_SECOND);
+    if (sample == NULL) {
+      if (gst_app_sink_is_eos(GST_APP_SINK(sink)))
+        break;
+      GstMessage* message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+      if (message) {
+        GError* message_error = NULL;
+        gst_message_parse_error(message, &message_error, NULL);
+        fprintf(stderr, "Encoding failed: %s\n", message_error->message);
+        g_error_free(message_error);
+        gst_message_unref(message);
+        ok = false;
+      }
+      continue;
+    }
+
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    if (buffer && GST_BUFFER_PTS_IS_VALID(buffer)) {
+      int64_t pts_us = GST_BUFFER_PTS(buffer) / GST_USECOND;
+      bool keyframe = type == kAudio ||
+                      !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+      if (keyframe && counter + 1 < options.segments_ &&
+          pts_us >= (counter + 1) * options.segment_us_) {
+        if (writer.is_open())
+          ok = writer.Close(options.formats_);
+        counter++;
+
+        std::string caps;
+        GstCaps* sample_caps = gst_sample_get_caps(sample);
+        if (sample_caps) {
+          gchar* caps_string = gst_caps_to_string(sample_caps);
+          caps = caps_string;
+          g_free(caps_string);
+        }
+        ok = ok && writer.Open(SegmentPath(dir, type, counter), type, caps);
+      }
+
+      GstMapInfo map;
+      if (ok && writer.is_open() && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        ok = writer.Add(options.start_us_ + pts_us, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+      }
+    }
+    gst_sample_unref(sample);
+  }
+
+  if (ok && writer.is_open())
+    ok = writer.Close(options.formats_);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(bus);
+  gst_object_unref(sink);
+  gst_object_unref(pipeline);
+  return ok;
+}
+
+bool Encode(const GeneratorOptions& options, const std::string& dir) {
+  int64_t total_us = options.segments_ * options.segment_us_;
+  char description[1024];
+
+  if (options.video_) {
+    snprintf(description, sizeof(description),
+             "videotestsrc pattern=ball num-buffers=%lld ! "
+             "video/x-raw,format=I420,width=%d,height=%d,framerate=%lld/%lld ! "
+             "x264enc bitrate=%d key-int-max=%d bframes=%d speed-preset=ultrafast ! "
+             "h264parse ! video/x-h264,stream-format=avc,alignment=au ! "
+             "appsink name=sink sync=false",
+             static_cast<long long>(VideoFrameAt(options, total_us)),
+             options.width_,
+             options.height_,
+             static_cast<long long>(options.fps_num_),
+             static_cast<long long>(options.fps_den_),
+             options.video_kbps_,
+             options.gop_,
+             options.bframes_);
+    if (!EncodeTrack(options, dir, kVideo, description))
+      return false;
+  }
+
+  if (options.audio_) {
+    snprintf(description, sizeof(description),
+             "audiotestsrc num-buffers=%lld samplesperbuffer=%d ! "
+             "audio/x-raw,rate=%d,channels=%d ! audioconvert ! "
+             "avenc_aac bitrate=%d ! aacparse ! audio/mpeg,stream-format=raw ! "
+             "appsink name=sink sync=false",
+             static_cast<long long>(AudioFrameAt(options, total_us)),
+             options.audio_frame_samples_,
+             options.audio_rate_,
+             options.audio_channels_,
+             options.audio_kbps_ * 1000);
+    if (!EncodeTrack(options, dir, kAudio, description))
+      return false;
+  }
+  return true;
+}
+
+bool Generate(const GeneratorOptions& options, const std::string& dir) {
+  std::mt19937 random(options.seed_);
+  for (int32_t counter = 0; counter < options.segments_; counter++) {
+    if (options.video_ && !GenerateDummyVideo(options, dir, counter, &random))
+      return false;
+    if (options.audio_ && !GenerateDummyAudio(options, dir, counter))
+      return false;
+  }
+  return true;
+}
+
+bool ParseFormat(const char* value, int* formats) {
+  if (strcmp(value, "legacy") == 0)
+    *formats = kFormatLegacy;
+  else if (strcmp(value, "msef") == 0)
+    *formats = kFormatContainer;
+  else if (strcmp(value, "both") == 0)
+    *formats = kFormatLegacy | kFormatContainer;
+  else
+    return false;
+  return true;
+}
+
+bool ParseFps(const char* value, GeneratorOptions* options) {
+  long long num = 0, den = 1;
+  int fields = sscanf(value, "%lld/%lld", &num, &den);
+  if (fields < 1 || num <= 0 || den <= 0)
+    return false;
+  options->fps_num_ = num;
+  options->fps_den_ = den;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  GeneratorOptions options;
+  static const struct option kOptions[] = {
+      {"segments", required_argument, NULL, 'n'},
+      {"segment-secs", required_argument, NULL, 'd'},
+      {"start-secs", required_argument, NULL, 's'},
+      {"format", required_argument, NULL, 'f'},
+      {"encode", no_argument, NULL, 'e'},
+      {"seed", required_argument, NULL, 'r'},
+      {"no-video", no_argument, NULL, 'V'},
+      {"size", required_argument, NULL, 'z'},
+      {"fps", required_argument, NULL, 'p'},
+      {"gop", required_argument, NULL, 'g'},
+      {"bframes", required_argument, NULL, 'b'},
+      {"video-kbps", required_argument, NULL, 'v'},
+      {"frame-weights", required_argument, NULL, 'w'},
+      {"size-spread", required_argument, NULL, 'j'},
+      {"no-audio", no_argument, NULL, 'A'},
+      {"audio-rate", required_argument, NULL, 'R'},
+      {"audio-channels", required_argument, NULL, 'C'},
+      {"audio-frame", required_argument, NULL, 'F'},
+      {"audio-kbps", required_argument, NULL, 'a'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", kOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'n':
+        options.segments_ = atoi(optarg);
+        break;
+      case 'd':
+        options.segment_us_ = static_cast<int64_t>(atof(optarg) * 1000000.0 + 0.5);
+        break;
+      case 's':
+        options.start_us_ = static_cast<int64_t>(atof(optarg) * 1000000.0 + 0.5);
+        break;
+      case 'f':
+        if (!ParseFormat(optarg, &options.formats_)) {
+          fprintf(stderr, "Unknown format '%s', expected legacy, msef or both\n", optarg);
+          return 1;
+        }
+        break;
+      case 'e':
+        options.encode_ = true;
+        break;
+      case 'r':
+        options.seed_ = strtoul(optarg, NULL, 10);
+        break;
+      case 'V':
+        options.video_ = false;
+        break;
+      case 'z':
+        if (sscanf(optarg, "%dx%d", &options.width_, &options.height_) != 2) {
+          fprintf(stderr, "Invalid size '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'p':
+        if (!ParseFps(optarg, &options)) {
+          fprintf(stderr, "Invalid frame rate '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'g':
+        options.gop_ = atoi(optarg);
+        break;
+      case 'b':
+        options.bframes_ = atoi(optarg);
+        break;
+      case 'v':
+        options.video_kbps_ = atoi(optarg);
+        break;
+      case 'w':
+        if (sscanf(optarg, "%lf,%lf", &options.i_weight_, &options.b_weight_) != 2) {
+          fprintf(stderr, "Invalid frame weights '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'j':
+        options.size_spread_ = atof(optarg);
+        break;
+      case 'A':
+        options.audio_ = false;
+        break;
+      case 'R':
+        options.audio_rate_ = atoi(optarg);
+        break;
+      case 'C':
+        options.audio_channels_ = atoi(optarg);
+        break;
+      case 'F':
+        options.audio_frame_samples_ = atoi(optarg);
+        break;
+      case 'a':
+        options.audio_kbps_ = atoi(optarg);
+        break;
+      case 'h':
+        PrintUsage(argv[0]);
+        return 0;
+      default:
+        PrintUsage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (argc - optind != 1) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::string dir = argv[optind];
+
+  if (options.segments_ <= 0 || options.segment_us_ <= 0 || options.start_us_ < 0 ||
+      options.gop_ <= 0 || options.bframes_ < 0 || options.video_kbps_ <= 0 ||
+      options.size_spread_ < 0 || options.audio_rate_ <= 0 ||
+      options.audio_frame_samples_ <= 0 || options.audio_kbps_ <= 0 ||
+      (!options.video_ && !options.audio_)) {
+    fprintf(stderr, "Invalid options\n");
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+    return 1;
+  }
+
+  bool ok;
+  if (options.encode_) {
+    gst_init(&argc, &argv);
+    ok = Encode(options, dir);
+  } else {
+    ok = Generate(options, dir);
+  }
+  if (!ok)
+    return 1;
+
+  printf("Generated %d segment(s) of %f secs\n",
+         options.segments_,
+         options.segment_us_ / 1000000.0);
+  return 0;
+}
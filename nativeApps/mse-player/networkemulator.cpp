@@ -0,0 +1,267 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "networkemulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace {
+
+const int64_t kNever = std::numeric_limits<int64_t>::max();
+// shape of the pareto jitter, small enough to give it a heavy tail
+const double kParetoShape = 2.0;
+
+double KbpsToBytesPerUs(double kbps) {
+  return kbps * 1000.0 / 8.0 / 1000000.0;
+}
+
+}  // namespace
+
+NetworkEmulator::NetworkEmulator()
+  : enabled_(false),
+    trace_period_us_(0),
+    epoch_us_(-1),
+    tokens_(0),
+    link_us_(0) {
+  request_bytes_[kAudio] = request_bytes_[kVideo] = 0;
+}
+
+bool NetworkEmulator::Configure(const NetworkProfile& profile) {
+  profile_ = profile;
+  trace_.clear();
+  trace_period_us_ = 0;
+  epoch_us_ = -1;
+  random_.seed(profile.seed_);
+
+  if (!profile.trace_path_.empty() && !LoadTrace(profile.trace_path_))
+    return false;
+
+  enabled_ = profile.bandwidth_kbps_ > 0 || profile.rtt_ms_ > 0 ||
+             profile.jitter_ms_ > 0 || profile.loss_rate_ > 0 ||
+             !trace_.empty();
+  if (enabled_) {
+    printf("Network emulation: %s, burst %u KB, rtt %u ms, jitter %u ms, "
+           "loss %.3f\n",
+           trace_.empty() ? "constant rate" : profile.trace_path_.c_str(),
+           profile.burst_kb_,
+           profile.rtt_ms_,
+           profile.jitter_ms_,
+           profile.loss_rate_);
+  }
+  return true;
+}
+
+bool NetworkEmulator::LoadTrace(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file) {
+    printf("Failed to open bandwidth trace %s\n", path.c_str());
+    return false;
+  }
+
+  char line[256];
+  int64_t start_us = 0;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#')
+      continue;
+
+    double duration_ms = 0, kbps = 0;
+    if (sscanf(line, "%lf %lf", &duration_ms, &kbps) != 2 || duration_ms <= 0 ||
+        kbps < 0)
+      continue;
+
+    TraceStep step;
+    step.start_us_ = start_us;
+    step.bytes_per_us_ = KbpsToBytesPerUs(kbps);
+    trace_.push_back(step);
+    start_us += static_cast<int64_t>(duration_ms * 1000);
+  }
+  fclose(file);
+
+  bool has_bandwidth = false;
+  for (size_t i = 0; i < trace_.size(); i++)
+    has_bandwidth |= trace_[i].bytes_per_us_ > 0;
+
+  if (!has_bandwidth) {
+    printf("Bandwidth trace %s has no usable steps\n", path.c_str());
+    trace_.clear();
+    return false;
+  }
+
+  trace_period_us_ = start_us;
+  printf("Loaded bandwidth trace %s: %zu steps, %.1f secs\n",
+         path.c_str(), trace_.size(), trace_period_us_ / 1000000.0);
+  return true;
+}
+
+int64_t NetworkEmulator::Deliver(AVType type,
+                                 int64_t now_us,
+                                 size_t bytes,
+                                 bool new_segment) {
+  if (!enabled_)
+    return now_us;
+
+  if (epoch_us_ < 0) {
+    epoch_us_ = now_us;
+    link_us_ = now_us;
+    tokens_ = profile_.burst_kb_ * 1024.0;
+  }
+
+  int64_t start_us = now_us;
+  if (new_segment || request_bytes_[type] == 0) {
+    start_us += RequestDelayUs();
+    request_bytes_[type] = profile_.request_kb_
+        ? static_cast<uint64_t>(profile_.request_kb_) * 1024
+        : std::numeric_limits<uint64_t>::max();
+  }
+  request_bytes_[type] -= std::min<uint64_t>(request_bytes_[type], bytes);
+  stats_.bytes_ += bytes;
+
+  int64_t arrival_us = start_us;
+  if (profile_.bandwidth_kbps_ > 0 || !trace_.empty()) {
+    // the response can't start arriving while the link is still busy with
+    // earlier ones
+    if (start_us > link_us_)
+      Refill(start_us);
+
+    if (tokens_ >= bytes) {
+      tokens_ -= bytes;
+    } else {
+      double deficit = bytes - tokens_;
+      tokens_ = 0;
+      Drain(deficit);
+    }
+    arrival_us = std::max(start_us, link_us_);
+  }
+
+  stats_.wait_us_ += arrival_us - now_us;
+  return arrival_us;
+}
+
+void NetworkEmulator::Cancel(int64_t now_us) {
+  if (epoch_us_ < 0)
+    return;
+
+  if (link_us_ > now_us) {
+    link_us_ = now_us;
+    tokens_ = 0;
+  }
+  request_bytes_[kAudio] = request_bytes_[kVideo] = 0;
+}
+
+int64_t NetworkEmulator::RequestDelayUs() {
+  stats_.requests_++;
+  double delay_ms = profile_.rtt_ms_;
+
+  if (profile_.jitter_ms_ > 0) {
+    double mean = profile_.jitter_ms_;
+    switch (profile_.jitter_distribution_) {
+      case kJitterUniform:
+        delay_ms += std::uniform_real_distribution<double>(0, 2 * mean)(random_);
+        break;
+      case kJitterNormal:
+        delay_ms += std::max(
+            0.0, std::normal_distribution<double>(mean, mean / 2)(random_));
+        break;
+      case kJitterPareto: {
+        double scale = mean * (kParetoShape - 1) / kParetoShape;
+        double u = std::uniform_real_distribution<double>(0, 1)(random_);
+        delay_ms += scale / std::pow(1.0 - u, 1.0 / kParetoShape);
+        break;
+      }
+    }
+  }
+
+  // every lost burst costs a retransmission timeout, backing off on each
+  // retry that is lost again
+  double stall_ms = 0;
+  double timeout_ms = profile_.loss_stall_ms_;
+  std::uniform_real_distribution<double> chance(0, 1);
+  while (profile_.loss_rate_ > 0 && chance(random_) < profile_.loss_rate_) {
+    stats_.losses_++;
+    stall_ms += timeout_ms;
+    timeout_ms *= 2;
+  }
+  stats_.stall_us_ += static_cast<int64_t>(stall_ms * 1000);
+
+  return static_cast<int64_t>((delay_ms + stall_ms) * 1000);
+}
+
+double NetworkEmulator::RateAt(int64_t time_us, int64_t* next_change_us) const {
+  if (trace_.empty()) {
+    *next_change_us = kNever;
+    return KbpsToBytesPerUs(profile_.bandwidth_kbps_);
+  }
+
+  int64_t elapsed_us = time_us - epoch_us_;
+  int64_t offset_us = elapsed_us % trace_period_us_;
+  size_t step = trace_.size() - 1;
+  while (step > 0 && trace_[step].start_us_ > offset_us)
+    step--;
+
+  int64_t step_end_us = (step + 1 < trace_.size()) ? trace_[step + 1].start_us_
+                                                   : trace_period_us_;
+  *next_change_us = time_us + (step_end_us - offset_us);
+  return trace_[step].bytes_per_us_;
+}
+
+void NetworkEmulator::Refill(int64_t time_us) {
+  double depth = profile_.burst_kb_ * 1024.0;
+  while (link_us_ < time_us && tokens_ < depth) {
+    int64_t next_change_us;
+    double rate = RateAt(link_us_, &next_change_us);
+    int64_t step_end_us = std::min(time_us, next_change_us);
+    tokens_ = std::min(depth, tokens_ + rate * (step_end_us - link_us_));
+    link_us_ = step_end_us;
+  }
+  link_us_ = std::max(link_us_, time_us);
+}
+
+void NetworkEmulator::Drain(double bytes) {
+  while (bytes > 0) {
+    int64_t next_change_us;
+    double rate = RateAt(link_us_, &next_change_us);
+    if (rate > 0) {
+      double needed_us = std::ceil(bytes / rate);
+      if (next_change_us == kNever || link_us_ + needed_us <= next_change_us) {
+        link_us_ += static_cast<int64_t>(needed_us);
+        return;
+      }
+    }
+
+    // outage or rate change before the transfer is done
+    bytes -= rate * (next_change_us - link_us_);
+    link_us_ = next_change_us;
+  }
+}
+
+void NetworkEmulator::PrintStats() const {
+  if (!enabled_)
+    return;
+
+  printf("Network: requests:%llu losses:%llu stalled:%lld ms received:%llu KB "
+         "frame wait:%lld ms\n",
+         static_cast<unsigned long long>(stats_.requests_),
+         static_cast<unsigned long long>(stats_.losses_),
+         static_cast<long long>(stats_.stall_us_ / 1000),
+         static_cast<unsigned long long>(stats_.bytes_ / 1024),
+         static_cast<long long>(stats_.wait_us_ / 1000));
+}
@@ -0,0 +1,115 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETWORKEMULATOR_H_
+#define NETWORKEMULATOR_H_
+
+#include <stdint.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "framefile.h"
+
+enum JitterDistribution { kJitterUniform = 0, kJitterNormal, kJitterPareto };
+
+// Link model applied to the frame feed. All-zero values disable emulation.
+struct NetworkProfile {
+  NetworkProfile() : bandwidth_kbps_(0), burst_kb_(64), rtt_ms_(0),
+                     jitter_ms_(0), jitter_distribution_(kJitterUniform),
+                     loss_rate_(0), loss_stall_ms_(200), request_kb_(0),
+                     seed_(1) {}
+
+  uint32_t bandwidth_kbps_;  // token bucket rate, 0 = unlimited
+  uint32_t burst_kb_;        // token bucket depth
+  uint32_t rtt_ms_;          // paid once per request
+  uint32_t jitter_ms_;       // mean extra request delay
+  JitterDistribution jitter_distribution_;
+  // probability that a request (and each retry of it) loses a packet burst
+  // and stalls for a retransmission timeout, doubling on every retry
+  float loss_rate_;
+  uint32_t loss_stall_ms_;
+  // a track issues a new request every request_kb_ of payload, 0 = one
+  // request per segment
+  uint32_t request_kb_;
+  // "<duration_ms> <kbps>" per line, replayed in a loop instead of
+  // bandwidth_kbps_
+  std::string trace_path_;
+  uint32_t seed_;
+};
+
+struct NetworkStats {
+  NetworkStats() : requests_(0), losses_(0), bytes_(0), stall_us_(0),
+                   wait_us_(0) {}
+
+  uint64_t requests_;
+  uint64_t losses_;
+  uint64_t bytes_;
+  int64_t stall_us_;  // spent in loss stalls
+  int64_t wait_us_;   // frames spent waiting for the link after being read
+};
+
+// Offline stand-in for the network between the MSE player and its server.
+// Both tracks share one token bucket, so a large video transfer delays the
+// audio behind it just like on a real link.
+class NetworkEmulator {
+ public:
+  NetworkEmulator();
+
+  // Loads the bandwidth trace if there is one.
+  bool Configure(const NetworkProfile& profile);
+  bool enabled() const { return enabled_; }
+
+  // Returns the monotonic time at which a frame of bytes read at now_us has
+  // fully arrived. new_segment starts a new request on the track.
+  int64_t Deliver(AVType type, int64_t now_us, size_t bytes, bool new_segment);
+  // Drops whatever is still in flight, e.g. when the feed is flushed.
+  void Cancel(int64_t now_us);
+
+  const NetworkStats& stats() const { return stats_; }
+  void PrintStats() const;
+
+ private:
+  struct TraceStep {
+    int64_t start_us_;  // offset into the trace
+    double bytes_per_us_;
+  };
+
+  bool LoadTrace(const std::string& path);
+  int64_t RequestDelayUs();
+  double RateAt(int64_t time_us, int64_t* next_change_us) const;
+  void Refill(int64_t time_us);
+  void Drain(double bytes);
+
+  bool enabled_;
+  NetworkProfile profile_;
+  std::vector<TraceStep> trace_;
+  int64_t trace_period_us_;
+  int64_t epoch_us_;  // time the link came up, the trace starts here
+
+  double tokens_;   // bytes
+  int64_t link_us_;  // time tokens_ was last brought up to date
+  uint64_t request_bytes_[2];  // bytes left in the current request per track
+
+  std::mt19937 random_;
+  NetworkStats stats_;
+};
+
+#endif  // NETWORKEMULATOR_H_
@@ -0,0 +1,218 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "prefetcher.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+const int64_t kDefaultPrefetchUs = 2 * 1000000;
+
+// requested_counter_ of a prefetcher being destroyed
+const int32_t kShuttingDown = -2;
+
+int shared_worker_threads = 1;
+
+}  // namespace
+
+struct SegmentPrefetcher::Job {
+  SegmentPrefetcher* prefetcher_;
+  int32_t counter_;
+  int64_t prefetch_us_;
+  BandwidthEstimator* estimator_;
+  SegmentTrack tracks_[2];
+  std::shared_ptr<PayloadFile> files_[2];
+};
+
+SegmentPrefetcher::SegmentPrefetcher()
+    : prefetch_us_(kDefaultPrefetchUs),
+      estimator_(NULL),
+      requested_counter_(-1),
+      ready_counter_(-1),
+      pending_jobs_(0) {
+  g_mutex_init(&mutex_);
+  g_cond_init(&idle_cond_);
+  blocks_[kAudio] = blocks_[kVideo] = NULL;
+  SharedPool();
+}
+
+SegmentPrefetcher::~SegmentPrefetcher() {
+  // queued jobs skip their load, the running one is waited for
+  g_mutex_lock(&mutex_);
+  requested_counter_ = kShuttingDown;
+  while (pending_jobs_ > 0)
+    g_cond_wait(&idle_cond_, &mutex_);
+  g_mutex_unlock(&mutex_);
+
+  ClearBlocks();
+  g_cond_clear(&idle_cond_);
+  g_mutex_clear(&mutex_);
+}
+
+void SegmentPrefetcher::SetWorkerThreads(int threads) {
+  shared_worker_threads = std::max(threads, 1);
+}
+
+GThreadPool* SegmentPrefetcher::SharedPool() {
+  static gsize pool = 0;
+  if (g_once_init_enter(&pool)) {
+    // never freed, pipelines may come and go for the whole process lifetime
+    GThreadPool* shared = g_thread_pool_new(
+        RunStatic, NULL, shared_worker_threads, FALSE, NULL);
+    g_once_init_leave(&pool, reinterpret_cast<gsize>(shared));
+  }
+  return reinterpret_cast<GThreadPool*>(pool);
+}
+
+void SegmentPrefetcher::RunStatic(gpointer job, gpointer) {
+  Job* prefetch = static_cast<Job*>(job);
+  prefetch->prefetcher_->Run(prefetch);
+}
+
+void SegmentPrefetcher::Request(int32_t counter,
+                                const SegmentCatalog& catalog) {
+  const Segment* segment = catalog.segment(counter);
+  if (segment == NULL)
+    return;
+
+  g_mutex_lock(&mutex_);
+  requested_counter_ = counter;
+  ready_counter_ = -1;
+  ClearBlocks();
+  pending_jobs_++;
+  g_mutex_unlock(&mutex_);
+
+  Job* job = new Job();
+  job->prefetcher_ = this;
+  job->counter_ = counter;
+  job->prefetch_us_ = prefetch_us_;
+  job->estimator_ = estimator_;
+  for (int type = kAudio; type <= kVideo; type++) {
+    job->tracks_[type] = segment->tracks_[type];
+    job->files_[type] = catalog.OpenPayload(segment->tracks_[type]);
+  }
+  g_thread_pool_push(SharedPool(), job, NULL);
+}
+
+void SegmentPrefetcher::Run(Job* job) {
+  FrameMapping* blocks[2] = {NULL, NULL};
+
+  // with more than one worker, jobs of one prefetcher may run concurrently;
+  // a superseded one skips the load and the older of two loads is dropped
+  // below
+  g_mutex_lock(&mutex_);
+  bool superseded = requested_counter_ != job->counter_;
+  g_mutex_unlock(&mutex_);
+
+  for (int type = kAudio; type <= kVideo && !superseded; type++) {
+    const SegmentTrack& track = job->tracks_[type];
+    if (!track.present() || track.index_->empty() || !job->files_[type])
+      continue;
+
+    // frames are stored back to back in decode order, so the first seconds
+    // of the segment are one contiguous range of the payload file
+    const FrameIndex& index = *track.index_;
+    int64_t limit_us = index[0].pts_us_ + job->prefetch_us_;
+    size_t count = 0;
+    while (count < index.size() && index[count].pts_us_ < limit_us)
+      count++;
+    if (count == 0)
+      continue;
+
+    uint64_t begin = index[0].offset_;
+    uint64_t end = index[count - 1].offset_ + index[count - 1].size_;
+    // seconds of payload in one read is a transfer worth timing, single
+    // frames mostly come out of the page cache
+    int64_t load_start_us = g_get_monotonic_time();
+    blocks[type] =
+        FrameMapping::Load(job->files_[type]->fd(), begin, end - begin);
+    if (blocks[type] && job->estimator_) {
+      job->estimator_->AddSample(end - begin,
+                                 g_get_monotonic_time() - load_start_us);
+    }
+  }
+
+  g_mutex_lock(&mutex_);
+  if (requested_counter_ == job->counter_) {
+    ClearBlocks();
+    blocks_[kAudio] = blocks[kAudio];
+    blocks_[kVideo] = blocks[kVideo];
+    ready_counter_ = job->counter_;
+    blocks[kAudio] = blocks[kVideo] = NULL;
+  }
+  g_mutex_unlock(&mutex_);
+
+  // superseded by a newer request
+  for (int type = kAudio; type <= kVideo; type++) {
+    if (blocks[type])
+      blocks[type]->Unref();
+  }
+  delete job;
+
+  // last, the prefetcher may be destroyed as soon as it sees no pending jobs
+  g_mutex_lock(&mutex_);
+  if (--pending_jobs_ == 0)
+    g_cond_broadcast(&idle_cond_);
+  g_mutex_unlock(&mutex_);
+}
+
+FrameMapping* SegmentPrefetcher::Take(int32_t counter, AVType type) {
+  FrameMapping* block = NULL;
+
+  // feeder threads may take both tracks concurrently, so the counts are
+  // updated under the lock as well
+  g_mutex_lock(&mutex_);
+  if (ready_counter_ == counter && blocks_[type]) {
+    block = blocks_[type];
+    blocks_[type] = NULL;
+  }
+
+  if (block)
+    stats_.hits_++;
+  else
+    stats_.misses_++;
+
+  // once both tracks are taken the request is served; the same counter may
+  // come up again, e.g. when a single segment loops
+  if (ready_counter_ == counter && blocks_[kAudio] == NULL &&
+      blocks_[kVideo] == NULL) {
+    requested_counter_ = -1;
+    ready_counter_ = -1;
+  }
+  g_mutex_unlock(&mutex_);
+  return block;
+}
+
+void SegmentPrefetcher::Reset() {
+  g_mutex_lock(&mutex_);
+  requested_counter_ = -1;
+  ready_counter_ = -1;
+  ClearBlocks();
+  g_mutex_unlock(&mutex_);
+}
+
+void SegmentPrefetcher::ClearBlocks() {
+  for (int type = kAudio; type <= kVideo; type++) {
+    if (blocks_[type])
+      blocks_[type]->Unref();
+    blocks_[type] = NULL;
+  }
+}
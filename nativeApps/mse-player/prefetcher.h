@@ -0,0 +1,97 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PREFETCHER_H_
+#define PREFETCHER_H_
+
+#include <glib.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "abrcontroller.h"
+#include "framefile.h"
+#include "segmentcatalog.h"
+
+struct PrefetchStats {
+  PrefetchStats() : hits_(0), misses_(0), boundaries_(0), total_gap_us_(0),
+                    max_gap_us_(0) {}
+
+  uint32_t hits_;    // track opens served from a finished prefetch
+  uint32_t misses_;  // track opens that had to go to the disk
+  uint32_t boundaries_;
+  int64_t total_gap_us_;  // segment switch to first frame pushed
+  int64_t max_gap_us_;
+};
+
+// Loads the first seconds of payload of the next segment on a worker thread
+// while the current one is still playing, so the segment switch can read
+// from memory instead of waiting on slow (USB) storage. The workers are
+// shared by all prefetchers of the process.
+class SegmentPrefetcher {
+ public:
+  SegmentPrefetcher();
+  ~SegmentPrefetcher();
+
+  // Number of shared I/O workers (default 1); takes effect if called before
+  // the first prefetcher is created.
+  static void SetWorkerThreads(int threads);
+
+  void set_prefetch_us(int64_t prefetch_us) { prefetch_us_ = prefetch_us; }
+  // Times every block load into estimator, NULL to stop. Set it while no
+  // request is pending.
+  void set_estimator(BandwidthEstimator* estimator) { estimator_ = estimator; }
+
+  // Starts loading segment counter of catalog in the background, replacing
+  // any earlier request.
+  void Request(int32_t counter, const SegmentCatalog& catalog);
+  bool requested(int32_t counter) const { return requested_counter_ == counter; }
+  // Returns a reference to the prefetched block of a track if the load of
+  // segment counter has finished, NULL otherwise. Counts a hit or a miss.
+  // Taking the last block clears the request, so requested() is false again.
+  FrameMapping* Take(int32_t counter, AVType type);
+  // Drops any pending or finished prefetch.
+  void Reset();
+
+  PrefetchStats& stats() { return stats_; }
+
+ private:
+  struct Job;
+
+  static GThreadPool* SharedPool();
+  static void RunStatic(gpointer job, gpointer unused);
+  void Run(Job* job);
+  void ClearBlocks();
+
+  GMutex mutex_;
+  GCond idle_cond_;
+  int64_t prefetch_us_;
+  BandwidthEstimator* estimator_;
+  // written with mutex_ held by Request(), Take(), Reset() and the
+  // destructor; atomic since requested() reads it without the lock
+  std::atomic<int32_t> requested_counter_;
+  // protected by mutex_
+  int32_t ready_counter_;
+  FrameMapping* blocks_[2];
+  int32_t pending_jobs_;  // pushed to the pool and not finished yet
+
+  PrefetchStats stats_;
+};
+
+#endif  // PREFETCHER_H_
@@ -0,0 +1,256 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "qosanalyzer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// a drop is blamed on an event at most this long before it was reported
+const int64_t kBlameWindowUs = 2000000;
+// seconds of QoS timeline kept
+const size_t kTimelineSecs = 600;
+
+const char* const kDropCauseNames[kDropCauses] = {
+    "segment", "seek", "underrun", "unexplained"};
+
+}  // namespace
+
+const char* DropCauseName(DropCause cause) {
+  return kDropCauseNames[cause];
+}
+
+QosElementStats::QosElementStats()
+  : messages_(0), processed_(0), dropped_(0), drops_(0), jitter_last_ns_(0),
+    jitter_max_ns_(0), jitter_sum_ns_(0), proportion_last_(1.0),
+    proportion_min_(1.0), proportion_max_(1.0), proportion_sum_(0) {}
+
+QosAnalyzer::QosAnalyzer() {
+  Reset();
+}
+
+void QosAnalyzer::Reset() {
+  start_us_ = g_get_monotonic_time();
+  elements_.clear();
+  timeline_.clear();
+  for (int cause = 0; cause < kDropCauses; cause++)
+    drops_[cause] = 0;
+  for (int cause = 0; cause < kDropUnexplained; cause++)
+    event_us_[cause] = 0;
+  latency_messages_ = 0;
+  live_ = false;
+  latency_min_ = GST_CLOCK_TIME_NONE;
+  latency_max_ = GST_CLOCK_TIME_NONE;
+  buffering_messages_ = 0;
+  buffering_percent_min_ = 100;
+  buffering_since_us_ = 0;
+  buffering_total_us_ = 0;
+}
+
+void QosAnalyzer::HandleQos(GstMessage* message) {
+  gboolean live = FALSE;
+  guint64 running_time, stream_time, timestamp, duration;
+  gint64 jitter = 0;
+  gdouble proportion = 1.0;
+  gint quality = 0;
+  GstFormat format = GST_FORMAT_UNDEFINED;
+  guint64 processed = 0, dropped = 0;
+  gst_message_parse_qos(message, &live, &running_time, &stream_time,
+                        &timestamp, &duration);
+  gst_message_parse_qos_values(message, &jitter, &proportion, &quality);
+  gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+
+  int64_t now_us = g_get_monotonic_time();
+  QosElementStats& element = elements_[GST_MESSAGE_SRC_NAME(message)];
+  element.messages_++;
+  element.jitter_last_ns_ = jitter;
+  element.jitter_max_ns_ = std::max(element.jitter_max_ns_, jitter);
+  element.jitter_sum_ns_ += jitter;
+  element.proportion_last_ = proportion;
+  if (element.messages_ == 1) {
+    element.proportion_min_ = element.proportion_max_ = proportion;
+  } else {
+    element.proportion_min_ = std::min(element.proportion_min_, proportion);
+    element.proportion_max_ = std::max(element.proportion_max_, proportion);
+  }
+  element.proportion_sum_ += proportion;
+
+  // the counters are running totals, which an element resets on a flush
+  guint64 new_drops = 0;
+  if (format == GST_FORMAT_BUFFERS || format == GST_FORMAT_DEFAULT) {
+    new_drops = dropped >= element.dropped_ ? dropped - element.dropped_
+                                            : dropped;
+    element.processed_ = processed;
+    element.dropped_ = dropped;
+  }
+  element.drops_ += new_drops;
+
+  QosSecond& second = Second(now_us);
+  second.messages_++;
+  second.drops_ += new_drops;
+  second.jitter_max_ns_ = std::max(second.jitter_max_ns_, jitter);
+  second.proportion_min_ = std::min(second.proportion_min_, proportion);
+
+  if (new_drops > 0) {
+    DropCause cause = Blame(now_us);
+    drops_[cause] += new_drops;
+    printf("QoS: %s dropped %llu frame(s), jitter %.1f ms, proportion %.2f "
+           "(%s)\n",
+           GST_MESSAGE_SRC_NAME(message),
+           static_cast<unsigned long long>(new_drops),
+           jitter / 1000000.0,
+           proportion,
+           DropCauseName(cause));
+  }
+}
+
+void QosAnalyzer::HandleLatency(GstElement* pipeline) {
+  latency_messages_++;
+  gst_bin_recalculate_latency(GST_BIN(pipeline));
+
+  GstQuery* query = gst_query_new_latency();
+  if (gst_element_query(pipeline, query)) {
+    gboolean live = FALSE;
+    gst_query_parse_latency(query, &live, &latency_min_, &latency_max_);
+    live_ = live;
+  }
+  gst_query_unref(query);
+}
+
+void QosAnalyzer::HandleBuffering(GstMessage* message) {
+  gint percent = 100;
+  gst_message_parse_buffering(message, &percent);
+  buffering_messages_++;
+  buffering_percent_min_ = std::min(buffering_percent_min_, percent);
+
+  int64_t now_us = g_get_monotonic_time();
+  if (percent < 100 && buffering_since_us_ == 0) {
+    buffering_since_us_ = now_us;
+  } else if (percent >= 100 && buffering_since_us_ != 0) {
+    buffering_total_us_ += now_us - buffering_since_us_;
+    buffering_since_us_ = 0;
+  }
+}
+
+void QosAnalyzer::NoteSegmentTransition() {
+  event_us_[kDropSegment] = g_get_monotonic_time();
+}
+
+void QosAnalyzer::NoteSeek() {
+  event_us_[kDropSeek] = g_get_monotonic_time();
+}
+
+void QosAnalyzer::NoteUnderrun() {
+  event_us_[kDropUnderrun] = g_get_monotonic_time();
+}
+
+int64_t QosAnalyzer::buffering_us() const {
+  int64_t total_us = buffering_total_us_;
+  if (buffering_since_us_ != 0)
+    total_us += g_get_monotonic_time() - buffering_since_us_;
+  return total_us;
+}
+
+DropCause QosAnalyzer::Blame(int64_t now_us) const {
+  DropCause cause = kDropUnexplained;
+  int64_t latest_us = now_us - kBlameWindowUs;
+  for (int i = 0; i < kDropUnexplained; i++) {
+    int64_t event_us = event_us_[i];
+    if (event_us != 0 && event_us >= latest_us) {
+      latest_us = event_us;
+      cause = static_cast<DropCause>(i);
+    }
+  }
+  return cause;
+}
+
+QosSecond& QosAnalyzer::Second(int64_t now_us) {
+  int64_t second = (now_us - start_us_) / 1000000;
+  if (timeline_.empty() || timeline_.back().second_ != second) {
+    QosSecond entry;
+    entry.second_ = second;
+    entry.messages_ = 0;
+    entry.drops_ = 0;
+    entry.jitter_max_ns_ = 0;
+    entry.proportion_min_ = 1.0;
+    timeline_.push_back(entry);
+    if (timeline_.size() > kTimelineSecs)
+      timeline_.pop_front();
+  }
+  return timeline_.back();
+}
+
+void QosAnalyzer::PrintSummary() const {
+  if (elements_.empty() && latency_messages_ == 0 && buffering_messages_ == 0)
+    return;
+
+  printf("QoS summary:\n");
+  for (std::map<std::string, QosElementStats>::const_iterator it =
+           elements_.begin();
+       it != elements_.end(); ++it) {
+    const QosElementStats& element = it->second;
+    printf("  %s: %llu messages, %llu processed, %llu dropped, jitter "
+           "avg %.1f max %.1f ms, proportion min %.2f avg %.2f max %.2f\n",
+           it->first.c_str(),
+           static_cast<unsigned long long>(element.messages_),
+           static_cast<unsigned long long>(element.processed_),
+           static_cast<unsigned long long>(element.drops_),
+           element.jitter_sum_ns_ / element.messages_ / 1000000.0,
+           element.jitter_max_ns_ / 1000000.0,
+           element.proportion_min_,
+           element.proportion_sum_ / element.messages_,
+           element.proportion_max_);
+  }
+
+  printf("  drops by cause:");
+  for (int cause = 0; cause < kDropCauses; cause++) {
+    printf(" %s %llu", DropCauseName(static_cast<DropCause>(cause)),
+           static_cast<unsigned long long>(drops_[cause]));
+  }
+  printf("\n");
+
+  for (std::deque<QosSecond>::const_iterator it = timeline_.begin();
+       it != timeline_.end(); ++it) {
+    if (it->drops_ == 0)
+      continue;
+    printf("  at %llds: %u dropped, jitter max %.1f ms, proportion min %.2f\n",
+           static_cast<long long>(it->second_),
+           it->drops_,
+           it->jitter_max_ns_ / 1000000.0,
+           it->proportion_min_);
+  }
+
+  if (latency_messages_ > 0) {
+    printf("  latency: %llu recalculations, %s, min %.1f ms, max %.1f ms\n",
+           static_cast<unsigned long long>(latency_messages_),
+           live_ ? "live" : "not live",
+           GST_CLOCK_TIME_IS_VALID(latency_min_)
+               ? static_cast<double>(latency_min_) / GST_MSECOND : -1.0,
+           GST_CLOCK_TIME_IS_VALID(latency_max_)
+               ? static_cast<double>(latency_max_) / GST_MSECOND : -1.0);
+  }
+  if (buffering_messages_ > 0) {
+    printf("  buffering: %llu messages, min %d%%, %.1f ms under 100%%\n",
+           static_cast<unsigned long long>(buffering_messages_),
+           buffering_percent_min_,
+           buffering_us() / 1000.0);
+  }
+}
@@ -0,0 +1,122 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QOSANALYZER_H_
+#define QOSANALYZER_H_
+
+#include <gst/gst.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+
+// what a frame drop is blamed on: the latest of these events shortly before
+// the QoS message reporting it
+enum DropCause {
+  kDropSegment = 0,  // segment transition
+  kDropSeek,
+  kDropUnderrun,     // an appsrc ran dry
+  kDropUnexplained,
+  kDropCauses
+};
+
+const char* DropCauseName(DropCause cause);
+
+// QoS reports of one element, usually a sink or a decoder
+struct QosElementStats {
+  QosElementStats();
+
+  uint64_t messages_;
+  guint64 processed_;  // rendered/processed buffers, as last reported
+  guint64 dropped_;    // as last reported
+  uint64_t drops_;     // summed over resets of the element's counters
+  gint64 jitter_last_ns_;
+  gint64 jitter_max_ns_;
+  double jitter_sum_ns_;
+  double proportion_last_;
+  double proportion_min_;
+  double proportion_max_;
+  double proportion_sum_;
+};
+
+// one second of playback in the QoS timeline
+struct QosSecond {
+  int64_t second_;  // since the analyzer was reset
+  uint32_t messages_;
+  uint32_t drops_;
+  gint64 jitter_max_ns_;
+  double proportion_min_;
+};
+
+// Digests the QOS, LATENCY and BUFFERING messages of a pipeline. Messages
+// are handled on the main loop; the Note*() calls may come from any thread.
+class QosAnalyzer {
+ public:
+  QosAnalyzer();
+  void Reset();
+
+  void HandleQos(GstMessage* message);
+  // Recalculates the latency of pipeline, as a LATENCY message asks for, and
+  // records the result.
+  void HandleLatency(GstElement* pipeline);
+  void HandleBuffering(GstMessage* message);
+
+  void NoteSegmentTransition();
+  void NoteSeek();
+  void NoteUnderrun();
+
+  const std::map<std::string, QosElementStats>& elements() const {
+    return elements_;
+  }
+  const std::deque<QosSecond>& timeline() const { return timeline_; }
+  uint64_t drops(DropCause cause) const { return drops_[cause]; }
+  uint64_t latency_messages() const { return latency_messages_; }
+  bool live() const { return live_; }
+  GstClockTime latency_min() const { return latency_min_; }
+  GstClockTime latency_max() const { return latency_max_; }
+  uint64_t buffering_messages() const { return buffering_messages_; }
+  int buffering_percent_min() const { return buffering_percent_min_; }
+  // total time spent under 100%, including a buffering period still open
+  int64_t buffering_us() const;
+
+  void PrintSummary() const;
+
+ private:
+  DropCause Blame(int64_t now_us) const;
+  QosSecond& Second(int64_t now_us);
+
+  int64_t start_us_;
+  std::map<std::string, QosElementStats> elements_;
+  std::deque<QosSecond> timeline_;
+  uint64_t drops_[kDropCauses];
+  // monotonic time of the latest event per cause, 0 = none yet
+  std::atomic<int64_t> event_us_[kDropUnexplained];
+  uint64_t latency_messages_;
+  bool live_;
+  GstClockTime latency_min_;
+  GstClockTime latency_max_;
+  uint64_t buffering_messages_;
+  int buffering_percent_min_;
+  int64_t buffering_since_us_;  // 0 unless under 100%
+  int64_t buffering_total_us_;
+};
+
+#endif  // QOSANALYZER_H_
@@ -0,0 +1,58 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resourceusage.h"
+
+#include <glib.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+namespace {
+
+int64_t ToMicroseconds(const struct timeval& tv) {
+  return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+}  // namespace
+
+ResourceUsage ResourceUsage::Sample() {
+  ResourceUsage usage;
+  usage.wall_us_ = g_get_monotonic_time();
+
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    usage.user_us_ = ToMicroseconds(ru.ru_utime);
+    usage.system_us_ = ToMicroseconds(ru.ru_stime);
+    usage.max_rss_kb_ = ru.ru_maxrss;
+  } else {
+    usage.user_us_ = usage.system_us_ = usage.max_rss_kb_ = 0;
+  }
+
+  // mallinfo() counts in int and wraps past 2 GB, glibc 2.33 added a fix
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+  usage.heap_bytes_ = info.uordblks + info.hblkhd;
+#else
+  struct mallinfo info = mallinfo();
+  usage.heap_bytes_ = static_cast<unsigned int>(info.uordblks) +
+                      static_cast<unsigned int>(info.hblkhd);
+#endif
+  return usage;
+}
@@ -0,0 +1,36 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RESOURCEUSAGE_H_
+#define RESOURCEUSAGE_H_
+
+#include <stdint.h>
+
+// Snapshot of the time, CPU and memory the process has used so far.
+struct ResourceUsage {
+  static ResourceUsage Sample();
+
+  int64_t wall_us_;        // monotonic clock
+  int64_t user_us_;
+  int64_t system_us_;
+  int64_t max_rss_kb_;
+  uint64_t heap_bytes_;    // allocated through malloc and not freed yet
+};
+
+#endif  // RESOURCEUSAGE_H_
@@ -0,0 +1,211 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "segmentcatalog.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// both tracks of the current segment, the next one and the prefetch target
+const size_t kOpenPayloadFiles = 6;
+
+bool StartsAfterPts(int64_t pts_us, const Segment& segment) {
+  return pts_us < segment.start_pts_us_;
+}
+
+bool StartsAfterTimeline(int64_t timeline_us, const Segment& segment) {
+  return timeline_us < segment.timeline_start_us_;
+}
+
+bool GetMtime(const std::string& path, struct timespec* mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  *mtime = st.st_mtim;
+  return true;
+}
+
+}  // namespace
+
+PayloadFileCache::PayloadFileCache(size_t capacity) : capacity_(capacity) {
+  g_mutex_init(&mutex_);
+}
+
+PayloadFileCache::~PayloadFileCache() { g_mutex_clear(&mutex_); }
+
+std::shared_ptr<PayloadFile> PayloadFileCache::Open(const std::string& path) {
+  g_mutex_lock(&mutex_);
+  for (std::list<Entry>::iterator it = files_.begin(); it != files_.end();
+       ++it) {
+    if (it->first == path) {
+      files_.splice(files_.begin(), files_, it);
+      std::shared_ptr<PayloadFile> file = it->second;
+      g_mutex_unlock(&mutex_);
+      return file;
+    }
+  }
+  g_mutex_unlock(&mutex_);
+
+  // open outside the lock, the storage may be slow
+  std::shared_ptr<PayloadFile> file = PayloadFile::Open(path);
+  if (!file)
+    return file;
+
+  g_mutex_lock(&mutex_);
+  files_.push_front(Entry(path, file));
+  if (files_.size() > capacity_)
+    files_.pop_back();
+  g_mutex_unlock(&mutex_);
+  return file;
+}
+
+void PayloadFileCache::Clear() {
+  g_mutex_lock(&mutex_);
+  files_.clear();
+  g_mutex_unlock(&mutex_);
+}
+
+SegmentCatalog::SegmentCatalog()
+    : files_(new PayloadFileCache(kOpenPayloadFiles)) {
+  Clear();
+}
+
+void SegmentCatalog::Clear() {
+  dir_.clear();
+  memset(&dir_mtime_, 0, sizeof(dir_mtime_));
+  segments_.clear();
+  files_->Clear();
+}
+
+bool SegmentCatalog::Build(const std::string& dir) {
+  Clear();
+  dir_ = dir;
+  GetMtime(dir_, &dir_mtime_);
+
+  for (int32_t counter = 0;; counter++) {
+    Segment segment;
+    segment.start_pts_us_ = kTimestampNone;
+    segment.end_pts_us_ = kTimestampNone;
+
+    for (int type = kAudio; type <= kVideo; type++) {
+      std::shared_ptr<FrameIndex> index(new FrameIndex());
+      if (!index->Load(SegmentPath(dir_, static_cast<AVType>(type), counter),
+                       static_cast<AVType>(type)))
+        continue;
+
+      SegmentTrack& track = segment.tracks_[type];
+      track.index_ = index;
+
+      if (index->empty())
+        continue;
+      if (segment.start_pts_us_ == kTimestampNone ||
+          track.start_pts_us() < segment.start_pts_us_)
+        segment.start_pts_us_ = track.start_pts_us();
+      if (segment.end_pts_us_ == kTimestampNone ||
+          track.end_pts_us() < segment.end_pts_us_)
+        segment.end_pts_us_ = track.end_pts_us();
+    }
+
+    if (!segment.tracks_[kAudio].present() && !segment.tracks_[kVideo].present())
+      break;
+
+    segment.duration_us_ = 0;
+    for (int type = kAudio; type <= kVideo; type++) {
+      const SegmentTrack& track = segment.tracks_[type];
+      if (!track.present() || track.frame_count() == 0)
+        continue;
+
+      // the frame presented last is the one with the latest pts, which is
+      // not necessarily the last one decoded; fall back to the average frame
+      // duration if it has none
+      const FrameIndex& index = *track.index_;
+      int64_t frame_us = 0;
+      for (size_t i = 0; i < index.size(); i++) {
+        if (index[i].pts_us_ == track.end_pts_us())
+          frame_us = index[i].duration_us_;
+      }
+      if (frame_us == 0 && track.frame_count() > 1) {
+        int64_t span_us = track.end_pts_us() - track.start_pts_us();
+        frame_us = span_us / static_cast<int64_t>(track.frame_count() - 1);
+      }
+      segment.duration_us_ = std::max(
+          segment.duration_us_,
+          track.end_pts_us() + frame_us - segment.start_pts_us_);
+    }
+    segment.timeline_start_us_ =
+        segments_.empty() ? 0
+                          : segments_.back().timeline_start_us_ +
+                                segments_.back().duration_us_;
+
+    segments_.push_back(segment);
+  }
+
+  printf("Segment catalog: %zu segment(s) in %s\n", segments_.size(),
+         dir_.c_str());
+  return !segments_.empty();
+}
+
+bool SegmentCatalog::IsStale() const {
+  struct timespec mtime;
+  if (!GetMtime(dir_, &mtime))
+    return true;
+  return mtime.tv_sec != dir_mtime_.tv_sec || mtime.tv_nsec != dir_mtime_.tv_nsec;
+}
+
+const Segment* SegmentCatalog::segment(int32_t counter) const {
+  if (counter < 0 || static_cast<size_t>(counter) >= segments_.size())
+    return NULL;
+  return &segments_[counter];
+}
+
+int64_t SegmentCatalog::duration_us() const {
+  if (segments_.empty())
+    return 0;
+  return segments_.back().timeline_start_us_ + segments_.back().duration_us_;
+}
+
+int32_t SegmentCatalog::FindSegment(int64_t pts_us) const {
+  if (segments_.empty())
+    return -1;
+
+  std::vector<Segment>::const_iterator it = std::upper_bound(
+      segments_.begin(), segments_.end(), pts_us, StartsAfterPts);
+  return it == segments_.begin() ? 0 : (it - segments_.begin()) - 1;
+}
+
+std::shared_ptr<PayloadFile> SegmentCatalog::OpenPayload(
+    const SegmentTrack& track) const {
+  if (!track.present())
+    return std::shared_ptr<PayloadFile>();
+  return files_->Open(track.index_->payload_path());
+}
+
+int32_t SegmentCatalog::FindTimelineSegment(int64_t timeline_us) const {
+  if (segments_.empty())
+    return -1;
+
+  std::vector<Segment>::const_iterator it = std::upper_bound(
+      segments_.begin(), segments_.end(), timeline_us, StartsAfterTimeline);
+  return it == segments_.begin() ? 0 : (it - segments_.begin()) - 1;
+}
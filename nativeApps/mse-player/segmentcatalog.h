@@ -0,0 +1,115 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2017 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEGMENTCATALOG_H_
+#define SEGMENTCATALOG_H_
+
+#include <glib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "framefile.h"
+
+struct SegmentTrack {
+  bool present() const { return index_ != NULL; }
+  int64_t start_pts_us() const { return index_->first_pts_us(); }
+  int64_t end_pts_us() const { return index_->last_pts_us(); }
+  size_t frame_count() const { return index_->size(); }
+  uint64_t byte_size() const { return index_->payload_bytes(); }
+
+  std::shared_ptr<const FrameIndex> index_;
+};
+
+struct Segment {
+  SegmentTrack tracks_[2];  // indexed by AVType
+  int64_t start_pts_us_;    // earliest track start
+  int64_t end_pts_us_;      // earliest track end
+  // from start_pts_us_ to the end of the last frame of the longest track
+  int64_t duration_us_;
+  // sum of the durations of the segments before this one, the start of the
+  // segment when they are played back to back
+  int64_t timeline_start_us_;
+};
+
+// Least recently used set of open payload files. A reader or prefetch job
+// holding a file keeps it open after it drops out of the set.
+class PayloadFileCache {
+ public:
+  explicit PayloadFileCache(size_t capacity);
+  ~PayloadFileCache();
+
+  std::shared_ptr<PayloadFile> Open(const std::string& path);
+  void Clear();
+
+ private:
+  PayloadFileCache(const PayloadFileCache&);
+  PayloadFileCache& operator=(const PayloadFileCache&);
+
+  typedef std::pair<std::string, std::shared_ptr<PayloadFile> > Entry;
+
+  GMutex mutex_;
+  size_t capacity_;
+  std::list<Entry> files_;  // most recently used first
+};
+
+// Index of every segment in a frame files directory, built once so that
+// segment start/end times and existence checks don't touch the disk. Indexes
+// are shared with the readers, so rebuilding the catalog never invalidates a
+// segment that is still being read. Payload files are only opened when a
+// segment is read, and only the last few stay open, so a directory of
+// thousands of segments doesn't run out of file descriptors.
+class SegmentCatalog {
+ public:
+  SegmentCatalog();
+
+  bool Build(const std::string& dir);
+  void Clear();
+  // true if files were added, removed or renamed in the directory since Build
+  bool IsStale() const;
+
+  size_t size() const { return segments_.size(); }
+  bool empty() const { return segments_.empty(); }
+  // NULL past the last segment
+  const Segment* segment(int32_t counter) const;
+  const std::string& dir() const { return dir_; }
+  // length of all segments played back to back
+  int64_t duration_us() const;
+  // Counter of the segment playing at pts_us: the last one starting at or
+  // before it, or the first one. -1 if the catalog is empty.
+  int32_t FindSegment(int64_t pts_us) const;
+  // Same for a time on the gapless timeline, relative to its start.
+  int32_t FindTimelineSegment(int64_t timeline_us) const;
+  // Opens the payload file of a track of one of the segments, NULL on error.
+  // May be called from any thread.
+  std::shared_ptr<PayloadFile> OpenPayload(const SegmentTrack& track) const;
+
+ private:
+  std::string dir_;
+  struct timespec dir_mtime_;
+  std::vector<Segment> segments_;
+  // shared by copies of the catalog
+  std::shared_ptr<PayloadFileCache> files_;
+};
+
+#endif  // SEGMENTCATALOG_H_